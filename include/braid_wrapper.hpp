@@ -1,5 +1,7 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "braid.hpp"
 #include "defs.hpp"
@@ -25,6 +27,10 @@ class myBraidVector {
    * thus should be free'd after usage (flag > 0) */
   MyReal sendflag;
 
+  /* Grid level of the vector (0: finest grid). Vectors on coarse levels can
+   * hold fewer examples and channels, see myBraidApp::Coarsen(). */
+  int level;
+
  public:
   /* Get dimensions */
   int getnBatch();
@@ -44,12 +50,53 @@ class myBraidVector {
   MyReal getSendflag();
   void setSendflag(MyReal value);
 
+  /* Get and set the grid level */
+  int getLevel();
+  void setLevel(int Level);
+
+  /* Free the state, turning the vector into a shell that keeps only the
+   * layer pointer, the sendflag and the grid level */
+  void freeState();
+
   /* Constructor */
   myBraidVector(int nChannels, int nBatch);
   /* Destructor */
   ~myBraidVector();
 };
 
+/**
+ * Copy of a state vector in reduced precision (double, float or bfloat16),
+ * used for storing primal states for the adjoint
+ */
+class myStoredVector {
+ protected:
+  int nbatch;    /* Number of examples */
+  int nchannels; /* Number of channels */
+  int precision; /* Storage precision (enum element) */
+
+  void *values; /* Stored state, dimensions: nbatch * nchannels */
+  Layer *layer; /* Pointer to layer information */
+
+ public:
+  /* Store the first nBatch examples of u */
+  void store(myBraidVector *u, int nBatch);
+
+  /* Restore the first nBatch examples into u */
+  void restore(myBraidVector *u, int nBatch);
+
+  /* Return the number of bytes used for the stored state */
+  int getnBytes();
+
+  /* Get and set pointer to the layer */
+  Layer *getLayer();
+  void setLayer(Layer *layer);
+
+  /* Constructor */
+  myStoredVector(int nChannels, int nBatch, int Precision);
+  /* Destructor */
+  ~myStoredVector();
+};
+
 /**
  * Wrapper for the primal braid app.
  * virtual function are overwritten from the adjoint app class
@@ -63,6 +110,47 @@ class myBraidApp : public BraidApp {
 
   BraidCore *core; /* Braid core for running PinT simulation */
 
+  /* Cache for the opening layer output on the slice of the batch, indexed by
+   * the position in the slice, so that it covers all chunks */
+  MyReal **openlayer_cache;   /* dimensions: openlayer_cachesize * nchannels */
+  int *openlayer_cacheIDs;    /* Batch IDs of the cached examples */
+  int openlayer_cachesize;    /* Number of cached examples */
+  int openlayer_cacheversion; /* Design version of the cache (-1: invalid) */
+  int openlayer_nevals;       /* Number of opening layer evaluations */
+
+  /* Checkpointing of the primal states for the adjoint. Braid stores only the
+   * C-points, intermediate states are recomputed from the closest checkpoint */
+  int checkpoint_stride;      /* Distance of checkpoints (0: store all states) */
+  int checkpoint_precision;   /* Precision of the checkpoints (enum element) */
+  int checkpoint_ilower;      /* First local time point */
+  int checkpoint_iupper;      /* Last local time point */
+  myStoredVector **checkpoints; /* Checkpoints that are not stored by braid */
+  myStoredVector **references;  /* Full precision copies of the checkpoints */
+  int reference_keep;           /* Flag: store the full precision copies */
+  int reference_use;            /* Flag: restore from the full precision copies */
+  myBraidVector *restored;      /* Checkpoint restored in full precision */
+  myBraidVector **recomputed;   /* Recomputed states following one checkpoint */
+  int recomputed_first;        /* Checkpoint of the recomputed states (-1: none) */
+
+  /* Spatial coarsening on coarse grid levels */
+  int batch_coarsen;   /* Batch coarsening factor per level (1: none) */
+  int channel_coarsen; /* Channel reduction factor (1: none) */
+  Layer **coarselayers; /* Channel-reduced hidden layers, by layer index */
+  int *coarseversions;  /* Design version of the reduced layers */
+
+  /* Allocate a vector for the largest chunk of the batch on a grid level */
+  myBraidVector *allocateVector(int level);
+
+  /* Return the channel-reduced version of a hidden dense layer. Its weights
+   * are restricted again whenever the design has changed. */
+  Layer *getCoarseLayer(Layer *layer);
+
+  /* Convergence of the last run, used to adapt the iteration cap */
+  int maxiter;        /* Maximum number of braid iterations (configured) */
+  int accesslevel;    /* Braid access level */
+  MyReal rnorm_first; /* Residual norm after the first iteration */
+  MyReal convrate;    /* Residual reduction per iteration (0: unknown) */
+
   /* Output */
   MyReal objective; /* Objective function */
 
@@ -79,12 +167,70 @@ class myBraidApp : public BraidApp {
   /* Return the core */
   BraidCore *getCore();
 
+  /* Return the number of examples the opening layer has been applied to, i.e.
+   * the misses of the opening layer cache */
+  int getnOpenLayerEvals();
+
   /* Get xbraid's grid distribution */
   void GetGridDistribution(int *ilower_ptr, int *iupper_ptr);
 
+  /* Coarsen the batch by batchfactor on each coarser grid level, and reduce
+   * the channels by channelfactor on all coarse levels. Coarse vectors hold
+   * averages of groups of examples and blocks of channels, corrections are
+   * interpolated back to all examples and channels of a group. */
+  void setSpatialCoarsening(int batchfactor, int channelfactor);
+
+  /* Return the number of examples of the current batch that are represented
+   * by the vector u */
+  int getnBatch(myBraidVector *u);
+
+  /* Keep only shell vectors (layer pointer, no state) at the time points
+   * where braid doesn't store the state */
+  void setShell();
+
+  /* Set the maximum number of braid iterations per run */
+  void setMaxIter(int maxIter);
+
+  /* Set the absolute tolerance for the next runs. The iteration cap is
+   * reduced to the number of iterations that the residual reduction of the
+   * previous run needs to reach tol. Returns the iteration cap. */
+  int setTolerance(MyReal tol);
+
   /* Return the time step index of current time t */
   braid_Int GetTimeStepIndex(MyReal t);
 
+  /* Apply the opening layer to all examples of the current chunk. The output
+   * is cached for the whole slice of the batch and reused as long as the
+   * batch doesn't change and, for opening layers that have weights, the
+   * design doesn't change. */
+  void applyOpenLayer(myBraidVector *u);
+
+  /* Free the opening layer cache */
+  void freeOpenLayerCache();
+
+  /* Store only every stride-th primal state (at least the C-points) and
+   * recompute the others when they are requested by getState(). Checkpoints
+   * other than the C-points are kept in the given precision. */
+  void setCheckpointing(int stride, int precision);
+
+  /* Keep full precision copies of the checkpoints in addition (keep = 1), and
+   * restore the states for the adjoint from them instead (use = 1). This is
+   * used to measure the gradient error of the reduced precision. */
+  void setCheckpointReference(int keep, int use);
+
+  /* Return the local number of bytes of the primal states that are kept for
+   * the adjoint, and the number of bytes if all were stored in full
+   * precision */
+  void getCheckpointMemory(MyReal *stored_ptr, MyReal *full_ptr);
+
+  /* Return the primal state at time step ts from the last run, or NULL if it
+   * is not stored on this processor. */
+  myBraidVector *getState(int ts);
+
+  /* Return the vector at time step ts that braid keeps on the finest grid,
+   * or NULL if braid doesn't store it (F-point or not local) */
+  myBraidVector *getStoredVector(int ts);
+
   /* Apply one time step */
   virtual braid_Int Step(braid_Vector u_, braid_Vector ustop_,
                          braid_Vector fstop_, BraidStepStatus &pstatus);
@@ -103,6 +249,15 @@ class myBraidApp : public BraidApp {
   /* De-allocate the vector @a u_. */
   braid_Int Free(braid_Vector u_);
 
+  /* @see braid_PtFcnSInit. Allocate a shell vector for time t. */
+  virtual braid_Int SInit(braid_Real t, braid_Vector *u_ptr);
+
+  /* @see braid_PtFcnSClone. Allocate a shell copy of @a u_. */
+  braid_Int SClone(braid_Vector u_, braid_Vector *v_ptr);
+
+  /* @see braid_PtFcnSFree. Free the state of @a u_, keeping the shell. */
+  braid_Int SFree(braid_Vector u_);
+
   /* Perform the operation: y_ = alpha * x_ + beta * @a y_. */
   braid_Int Sum(braid_Real alpha, braid_Vector x_, braid_Real beta,
                 braid_Vector y_);
@@ -110,6 +265,15 @@ class myBraidApp : public BraidApp {
   /* Compute in @a *norm_ptr an appropriate spatial norm of @a u_. */
   braid_Int SpatialNorm(braid_Vector u_, braid_Real *norm_ptr);
 
+  /* @see braid_PtFcnSCoarsen. Averages groups of examples and channels. */
+  braid_Int Coarsen(braid_Vector fu_, braid_Vector *cu_ptr,
+                    BraidCoarsenRefStatus &status);
+
+  /* @see braid_PtFcnSRefine. Copies each coarse value to all examples and
+   * channels of its group. */
+  braid_Int Refine(braid_Vector cu_, braid_Vector *fu_ptr,
+                   BraidCoarsenRefStatus &status);
+
   /* @see braid_PtFcnAccess. */
   braid_Int Access(braid_Vector u_, BraidAccessStatus &astatus);
 
@@ -132,6 +296,15 @@ class myBraidApp : public BraidApp {
 
   /* Run Braid drive, return norm */
   MyReal run();
+
+  /* Reset the braid initial guess on the finest grid to zero, so that the
+   * warm restart doesn't start from the solution for a different batch */
+  void resetGrid();
+
+  /* Run Braid drive on all chunks of the data set, one after the other,
+   * reusing the same braid vectors. Returns loss and accuracy accumulated
+   * over all chunks. */
+  void runChunked(MyReal *loss_ptr, MyReal *accuracy_ptr);
 };
 
 /**
@@ -139,12 +312,12 @@ class myBraidApp : public BraidApp {
  */
 class myAdjointBraidApp : public myBraidApp {
  protected:
-  BraidCore
-      *primalcore; /* pointer to primal core for accessing primal states */
+  myBraidApp *primalapp; /* pointer to primal app for accessing primal states */
+  BraidCore *primalcore; /* pointer to primal core */
 
  public:
   myAdjointBraidApp(DataSet *Data, Network *Network, Config *config,
-                    BraidCore *Primalcoreptr, MPI_Comm comm);
+                    myBraidApp *Primalapp, MPI_Comm comm);
 
   ~myAdjointBraidApp();
 
@@ -159,6 +332,9 @@ class myAdjointBraidApp : public myBraidApp {
  initial guess appropriate for time t. */
   braid_Int Init(braid_Real t, braid_Vector *u_ptr);
 
+  /* Allocate an adjoint shell vector, without layer pointer */
+  braid_Int SInit(braid_Real t, braid_Vector *u_ptr);
+
   /* @see braid_PtFcnBufSize. */
   braid_Int BufSize(braid_Int *size_ptr, BraidBufferStatus &bstatus);
 
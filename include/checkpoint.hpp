@@ -0,0 +1,42 @@
+#include <mpi.h>
+#include <stdio.h>
+#include "config.hpp"
+#include "dataset.hpp"
+#include "defs.hpp"
+#include "hessianApprox.hpp"
+#include "network.hpp"
+#pragma once
+
+/**
+ * Checkpoint of the optimization state in one binary file, written and read
+ * collectively with MPI-IO by all processors of comm. The file holds a
+ * header (sizes, iteration counters, stepsize, gradient norm and the number
+ * of stochastic batches drawn so far), followed by design, gradient and the
+ * memory of the Hessian approximation, all in global design ordering. With a
+ * basis in time for the hidden weights, the design is its coefficients.
+ * Hence, a run can be restarted with a different number of processors, as
+ * long as the network is the same.
+ */
+
+/**
+ * Write the state at the start of iteration iter. Only processors with
+ * write = 1 write their design (one copy of each layer). The file is written
+ * to <filename>.tmp first and renamed when complete, such that an
+ * interrupted write keeps the last checkpoint intact.
+ * Returns -1 if the file can't be written.
+ */
+int writeCheckpoint(const char *filename, Config *config, Network *network,
+                    HessianApprox *hessian, DataSet *data, int iter,
+                    int ls_iter, MyReal stepsize, MyReal gnorm, int write,
+                    MPI_Comm comm);
+
+/**
+ * Read the state from a checkpoint file, the counterpart of
+ * writeCheckpoint(). The batch selection of the data set is advanced, and the
+ * neighbouring layers are communicated.
+ * Returns -1 if the file can't be read or doesn't match the configuration.
+ */
+int readCheckpoint(const char *filename, Config *config, Network *network,
+                   HessianApprox *hessian, DataSet *data, int *iter_ptr,
+                   int *ls_iter_ptr, MyReal *stepsize_ptr, MyReal *gnorm_ptr,
+                   MPI_Comm comm);
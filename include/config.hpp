@@ -21,6 +21,18 @@ enum hessiantype { BFGS_SERIAL, LBFGS, IDENTITY };
 /* Available stepsize selection methods */
 enum stepsizetype { FIXED, BACKTRACKINGLS, ONEOVERK };
 
+/* Available validation methods */
+enum validationtype { XBRAID, FORWARD };
+
+/* Available random number generators for the initial design */
+enum rngtype { RNG_SERIAL, RNG_COUNTER };
+
+/* Available precisions for storing primal states */
+enum precisiontype { PREC_DOUBLE, PREC_FLOAT, PREC_BFLOAT16 };
+
+/* Available basis functions in time for the hidden weights */
+enum basistype { BASIS_LINEAR, BASIS_CUBIC };
+
 class Config {
  private:
   /* Linked list for reading config options */
@@ -43,6 +55,8 @@ class Config {
   const char *fval_labels;
   const char *weightsopenfile;
   const char *weightsclassificationfile;
+  const char *modelfile_in;
+  const char *modelfile_out;
 
   int ntraining;
   int nvalidation;
@@ -59,6 +73,12 @@ class Config {
   MyReal weights_open_init;
   MyReal weights_init;
   MyReal weights_class_init;
+  int weights_rng;
+  MyReal pruning;
+  int pruning_iter;
+  int lowrank;
+  int weights_nbasis;
+  int weights_basis;
 
   /* XBraid */
   int braid_cfactor0;
@@ -68,16 +88,27 @@ class Config {
   int braid_maxiter;
   MyReal braid_abstol;
   MyReal braid_abstoladj;
+  MyReal braid_adaptivetol;
+  int braid_oneshot;
   int braid_printlevel;
   int braid_accesslevel;
   int braid_setskip;
   int braid_fmg;
   int braid_nrelax;
   int braid_nrelax0;
+  int braid_batchcoarsen;
+  int braid_channelcoarsen;
+  int braid_shell;
+  int braid_checkpointstride;
+  int braid_checkpointprecision;
+  int braid_checkpointcheck;
 
   /* Optimization */
   int batch_type;
   int nbatch;
+  int nmicrobatches;
+  int ndatagroups;
+  int nchannelsplit;
   MyReal gamma_tik;
   MyReal gamma_ddt;
   MyReal gamma_class;
@@ -87,9 +118,17 @@ class Config {
   MyReal gtol;
   int ls_maxiter;
   MyReal ls_factor;
+  int ls_nparallel;
   int hessianapprox_type;
   int lbfgs_stages;
   int validationlevel;
+  int validation_type;
+  int validation_chunksize;
+
+  /* Checkpoint / restart of the optimization */
+  int checkpoint_interval;
+  const char *checkpoint_file;
+  int restart;
 
   /* Constructor sets default values */
   Config();
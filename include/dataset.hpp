@@ -13,16 +13,40 @@ class DataSet {
 
   MyReal **examples; /* Array of Feature vectors (dim: nelements x nfeatures) */
   MyReal **labels;   /* Array of Label vectors (dim: nelements x nlabels) */
+  int nslicestored;  /* Number of slices stored (0: all elements are stored) */
 
-  int nbatch;    /* Size of the batch */
-  int *batchIDs; /* Array of batch indicees */
+  int nbatchglobal; /* Size of the batch over all data groups */
+  int *batchIDs;    /* Array of batch indicees (dim: nbatchglobal) */
 
-  int MPIsize; /* Size of the global communicator */
-  int MPIrank; /* Processors rank */
+  /* With several data groups, each group processes a slice [batchfirst,
+   * batchfirst+nbatch) of the batch */
+  int nbatch;     /* Size of the slice of this data group */
+  int batchfirst; /* Position of the slice in the batch */
+
+  /* The batch can be split into chunks (micro-batches) that are processed one
+   * after the other. The current chunk is the part [chunkfirst,
+   * chunkfirst+nchunk) of the batch. */
+  int chunksize;  /* Maximum number of batch elements per chunk */
+  int chunkfirst; /* Position of the current chunk in the batch */
+  int nchunk;     /* Number of elements in the current chunk */
+
+  int MPIsize; /* Size of the communicator along the layers */
+  int MPIrank; /* Processors rank along the layers */
+
+  MPI_Comm datacomm; /* Communicator across the data groups */
+  int datarank;      /* Index of this processor's data group */
+
+  MPI_Comm channelcomm; /* Processors that split the channels of the layers */
+  int channelrank;      /* Rank in the channel group (0: draws the batch) */
 
   int *availIDs; /* Auxilliary: holding available batchIDs when generating a
                     batch */
   int navail; /* Auxilliary: holding number of currently available batchIDs */
+  int nselected; /* Number of stochastic batches drawn so far */
+
+  /* Draw a new stochastic batch (first processor of first data group and
+   * channel group only) */
+  void drawBatch();
 
  public:
   /* Default constructor */
@@ -31,28 +55,79 @@ class DataSet {
   /* Destructor */
   ~DataSet();
 
+  /* Comm is the communicator along the layers, DataComm connects the
+   * processors of the same layer range in different data groups. The batch
+   * is split evenly between the data groups. */
   void initialize(int nElements, int nFeatures, int nLabels, int nBatch,
-                  MPI_Comm Comm);
+                  MPI_Comm Comm, MPI_Comm DataComm);
 
-  /* Return the batch size*/
+  /* Set the channel group of the processors that split the layers' channels
+   * (see Network::setChannelComm()). Only its first processor draws the
+   * stochastic batches, the others receive them. */
+  void setChannelComm(MPI_Comm ChannelComm);
+
+  /* Split the batch into nslices slices and process the slice islice from
+   * now on. The chunk size is kept, the first chunk is selected. */
+  void splitBatch(int nslices, int islice);
+
+  /* Return the size of the current chunk of the batch (this is the batch
+   * size of the data group, if the batch is not split into chunks) */
   int getnBatch();
 
-  /* Return the feature vector of a certain batchID. If not stored on this
-   * processor, return NULL */
+  /* Return the size of the batch over all data groups */
+  int getnBatchGlobal();
+
+  /* Return the maximum chunk size */
+  int getnBatchMax();
+
+  /* Return the size of the slice of this data group, and the position of
+   * the current chunk in it */
+  int getnSlice();
+  int getChunkFirst();
+
+  /* Return the number of chunks of the batch */
+  int getnChunks();
+
+  /* Split the batch into chunks of (at most) ChunkSize elements and select
+   * the first chunk. ChunkSize <= 0 uses the full batch as one chunk. */
+  void setChunkSize(int ChunkSize);
+
+  /* Select the chunk ichunk of the batch as the current one */
+  void selectChunk(int ichunk);
+
+  /* Return the global element ID of a certain batchID in the current chunk.
+   * If not stored on this processor, return -1 */
+  int getBatchID(int id);
+
+  /* Return the feature vector of a certain batchID in the current chunk. If
+   * not stored on this processor, return NULL */
   MyReal *getExample(int id);
 
-  /* Return the label vector of a certain batchID. If not stored on this
-   * processor, return NULL */
+  /* Return the label vector of a certain batchID in the current chunk. If not
+   * stored on this processor, return NULL */
   MyReal *getLabel(int id);
 
+  /* Store only the elements of slice islice of nslices slices of the batch,
+   * in addition to the slices stored before. By default, all elements are
+   * stored. Only valid for deterministic batches, call before readData(). */
+  void storeSlice(int nslices, int islice);
+
   /* Read data from file */
   void readData(const char *datafolder, const char *examplefile,
                 const char *labelfile);
 
   /* Select the current batch from all available IDs, either deterministic or
-   * stochastic */
+   * stochastic. A stochastic batch is chosen by the first data group. */
   void selectBatch(int batch_type, MPI_Comm comm);
 
+  /* Return the number of stochastic batches drawn so far */
+  int getnSelected();
+
+  /* Advance the random batch selection to the state after nSelected
+   * batches, as on restart. No batch is sent, the next selectBatch() call
+   * draws and distributes batch nSelected+1. */
+  void skipBatches(int nSelected);
+
   /* print current batch to screen */
   void printBatch();
 };
\ No newline at end of file
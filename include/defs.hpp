@@ -1,4 +1,8 @@
+#ifdef SERIAL
+#include "mpi_serial.hpp"
+#else
 #include <mpi.h>
+#endif
 #pragma once
 
 /*
@@ -9,4 +13,9 @@
 // typedef float MyReal;
 // #define MPI_MyReal MPI_FLOAT
 typedef double MyReal;
-#define MPI_MyReal MPI_DOUBLE
\ No newline at end of file
+#define MPI_MyReal MPI_DOUBLE
+
+/* Layout of the binary model files, see Network::writeModel() */
+#define MODEL_MAGIC 0x4C504D4F44450001LL /* File identifier + version */
+#define MODEL_NHEADER 5     /* Entries of the file header */
+#define MODEL_NLAYERDESC 10 /* Entries of the description of each layer */
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include "defs.hpp"
 #include "linalg.hpp"
+#include "util.hpp"
 
 #pragma once
 
@@ -22,6 +23,17 @@ class HessianApprox {
    * Update the BFGS memory (like s, y, rho, H0...)
    */
   virtual void updateMemory(int k, MyReal *design, MyReal *gradient) = 0;
+
+  /**
+   * Write (read) the memory to (from) a checkpoint file, starting at the file
+   * offset, which is advanced past the memory. designtype places the local
+   * design in the global one (see MPI_CreateFileType()). Only processors
+   * with write = 1 write. Reading returns -1 if the memory doesn't match the file.
+   */
+  virtual void writeMemory(MPI_File fh, MPI_Offset *offset,
+                           MPI_Datatype designtype, int write);
+  virtual int readMemory(MPI_File fh, MPI_Offset *offset,
+                         MPI_Datatype designtype);
 };
 
 class L_BFGS : public HessianApprox {
@@ -44,6 +56,11 @@ class L_BFGS : public HessianApprox {
   void computeAscentDir(int k, MyReal *gradient, MyReal *ascentdir);
 
   void updateMemory(int k, MyReal *design, MyReal *gradient);
+
+  /* Stores H0, rho and the vectors of the memory in global ordering */
+  void writeMemory(MPI_File fh, MPI_Offset *offset, MPI_Datatype designtype,
+                   int write);
+  int readMemory(MPI_File fh, MPI_Offset *offset, MPI_Datatype designtype);
 };
 
 class BFGS : public HessianApprox {
@@ -69,6 +86,12 @@ class BFGS : public HessianApprox {
   void computeAscentDir(int k, MyReal *gradient, MyReal *ascentdir);
 
   void updateMemory(int k, MyReal *design, MyReal *gradient);
+
+  /* Stores the local Hessian blocks, hence the layer distribution must not
+   * change on restart */
+  void writeMemory(MPI_File fh, MPI_Offset *offset, MPI_Datatype designtype,
+                   int write);
+  int readMemory(MPI_File fh, MPI_Offset *offset, MPI_Datatype designtype);
 };
 
 /**
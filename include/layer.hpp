@@ -8,6 +8,10 @@
 
 #pragma once
 
+/* Bits of a sparsity pattern stored in each MyReal entry of a buffer (exact
+ * in single precision as well) */
+#define PATTERN_BITS 16
+
 /**
  * Abstract base class for the network layers
  * Subclasses implement
@@ -40,6 +44,57 @@ class Layer {
   MyReal *update;     /* Auxilliary for computing fwd update */
   MyReal *update_bar; /* Auxilliary for computing bwd update */
 
+  /* The output channels (rows for dense, convolutions for convolutional
+   * layers) can be split between the processors of a channel group. Each one
+   * computes the range [channelfirst, channellast), the results are gathered
+   * in the full state on all processors of the group. The weights of the
+   * output channels are split as well, each processor only stores its own
+   * rows. The remaining design variables (bias, factor V of low-rank layers)
+   * are shared: all processors of the group hold a copy, the first one
+   * updates them. */
+  int nrows;            /* Number of output channels that can be split */
+  int rowsize;          /* Number of weights of each output channel */
+  MPI_Comm channelcomm; /* Channel group (MPI_COMM_NULL: no split) */
+  int channelfirst;     /* First output channel of this processor */
+  int channellast;      /* Last output channel (+1) of this processor */
+  int *channelcounts;   /* Number of state entries of each processor */
+  int *channeldispls;   /* Position of these entries in the state */
+  int *batchcounts;     /* Auxilliary for gathering a batch of states */
+  int *batchdispls;
+  MyReal *channelbuffer; /* Auxilliary for the communication of a batch */
+  int nchannelbuffer;    /* Size of the channelbuffer */
+  MyReal *channelsum;  /* Where applyBWD() puts the contributions that are
+                          summed up over the group (NULL: no split) */
+  MyReal *channelbias; /* Auxilliary for summing up the bias gradient */
+  MyReal *shared;      /* Shared design variables (all of them without split) */
+  MyReal *shared_bar;  /* Derivative of the shared design variables */
+  int sharedowner; /* Flag: the shared design variables of this processor
+                      count for the regularization */
+
+  /* Split the output channels, each one holds channelsize state entries */
+  void splitChannels(MPI_Comm comm, int channelsize);
+
+  /* Return the channelbuffer with room for at least size entries */
+  MyReal *getChannelBuffer(int size);
+
+  /* Gather the output channels of a batch of nbatch states from all
+   * processors, with a single collective. If nsum > 0, the nsum entries of
+   * sum are summed up over the processors in the same collective. */
+  void gatherChannels(MyReal **data, int nbatch, MyReal *sum, int nsum);
+
+  /* Design of another layer with the same layout (e.g. an opening layer,
+   * which is never split), at the positions of the local weights and the
+   * shared design variables of this layer */
+  void getAlignedDesign(Layer *layer, MyReal **split_ptr, MyReal **shared_ptr);
+
+  /* Number of entries of each example that applyBWD() puts into channelsum */
+  virtual int getnChannelSum();
+
+  /* Finish applyBWD() of one example, given the contributions of all
+   * processors summed up in sum */
+  virtual void applyBWDSum(MyReal *state, MyReal *state_bar, MyReal *sum,
+                           int compute_gradient);
+
  public:
   /* Available layer types */
   enum layertype {
@@ -49,7 +104,9 @@ class Layer {
     CLASSIFICATION = 3,
     OPENCONV = 4,
     OPENCONVMNIST = 5,
-    CONVOLUTION = 6
+    CONVOLUTION = 6,
+    SPARSEDENSE = 7,
+    LOWRANK = 8
   };
 
   Layer();
@@ -62,9 +119,16 @@ class Layer {
   /* Set time step size */
   void setDt(MyReal DT);
 
-  /* Set design and gradient memory location */
+  /* Set design and gradient memory location. The local design variables are
+   * the weights of the local output channels (getnDesignSplit()), followed
+   * by the shared ones (getnDesignShared()). */
   void setMemory(MyReal *design_memloc, MyReal *gradient_memloc);
 
+  /* Same, with separate locations for the weights of the local output
+   * channels and for the shared design variables */
+  void setMemory(MyReal *split_memloc, MyReal *split_gradient_memloc,
+                 MyReal *shared_memloc, MyReal *shared_gradient_memloc);
+
   /* Some Get..() functions */
   MyReal getDt();
   MyReal getGammaTik();
@@ -87,12 +151,33 @@ class Layer {
   int getnWeights();
   int getnDesign();
 
+  /* Number of local design variables: the weights of the local output
+   * channels (0 without split), and the shared ones. */
+  int getnDesignSplit();
+  int getnDesignShared();
+  int getnDesignLocal();
+
+  /* Position of the weights of the local output channels in the design of
+   * the layer */
+  int getSplitOffset();
+
   int getnConv();
   int getCSize();
 
   /* Get the layer index (i.e. the time step) */
   int getIndex();
 
+  /* Split the output channels between the processors of a channel group.
+   * Only hidden layers support this, other layers ignore it. Call it before
+   * setMemory(). */
+  virtual void setChannelComm(MPI_Comm comm);
+
+  /* Set the local gradient to zero */
+  void resetGradient();
+
+  /* Scale the local design variables */
+  void scaleDesign(MyReal factor);
+
   /* Prints to screen */
   void print_data(MyReal *data_Out);
 
@@ -103,12 +188,15 @@ class Layer {
   /**
    * Pack weights and bias into a buffer
    */
-  void packDesign(MyReal *buffer, int size);
+  virtual void packDesign(MyReal *buffer, int size);
 
   /**
    * Unpack weights and bias from a buffer
    */
-  void unpackDesign(MyReal *buffer);
+  virtual void unpackDesign(MyReal *buffer);
+
+  /* Return the number of entries packed by packDesign() */
+  virtual int getnPacked();
 
   /**
    * Evaluate Tikhonov Regularization
@@ -158,6 +246,16 @@ class Layer {
   virtual void applyBWD(MyReal *state, MyReal *state_bar,
                         int compute_gradient) = 0;
 
+  /**
+   * Forward (backward) propagation of a batch of nbatch examples. With split
+   * channels, applyFWD() and applyBWD() only compute the local output
+   * channels, these combine the results of the channel group with one
+   * collective per batch.
+   */
+  virtual void applyFWDBatch(MyReal **state, int nbatch);
+  virtual void applyBWDBatch(MyReal **state, MyReal **state_bar, int nbatch,
+                             int compute_gradient);
+
   /* ReLu Activation and derivative */
   MyReal ReLu_act(MyReal x);
   MyReal dReLu_act(MyReal x);
@@ -178,11 +276,114 @@ class Layer {
  * if not openlayer: requires dimI = dimO !
  */
 class DenseLayer : public Layer {
+ protected:
+  /* With split channels, the update of state_bar is summed up */
+  int getnChannelSum();
+  void applyBWDSum(MyReal *state, MyReal *state_bar, MyReal *sum,
+                   int compute_gradient);
+
+  /* Apply the weights of output channel io to the state (without bias) */
+  virtual MyReal applyRow(int io, MyReal *state);
+
+  /* Derivative of applyRow(), given the derivative update_bar of its
+   * result: adds to state_bar and, if compute_gradient, to weights_bar */
+  virtual void applyRowBar(int io, MyReal *state, MyReal *state_bar,
+                           MyReal update_bar, int compute_gradient);
+
  public:
   DenseLayer(int idx, int dimI, int dimO, MyReal deltaT, int activation,
              MyReal gammatik, MyReal gammaddt);
   ~DenseLayer();
 
+  void setChannelComm(MPI_Comm comm);
+
+  void applyFWD(MyReal *state);
+
+  void applyBWD(MyReal *state, MyReal *state_bar, int compute_gradient);
+};
+
+/**
+ * Dense layer with a fixed sparsity pattern of the weight matrix, e.g. after
+ * magnitude pruning. The weights keep the dense layout in the design vector,
+ * the pattern of the nonzero weights is stored in CSR format (row pointers
+ * and column indices). The row kernels of the forward, adjoint and gradient
+ * computation only visit the nonzero weights, packDesign() only packs those.
+ * As long as no pattern is set, the layer behaves like a DenseLayer.
+ */
+class SparseDenseLayer : public DenseLayer {
+ protected:
+  int nnz;     /* Number of nonzero weights (-1: no pattern set) */
+  int *rowptr; /* Position of each row in colidx (dim: dimO + 1) */
+  int *colidx; /* Column of each nonzero weight (dim: nnz) */
+
+  /* Row kernels on the nonzero weights */
+  MyReal applyRow(int io, MyReal *state);
+  void applyRowBar(int io, MyReal *state, MyReal *state_bar,
+                   MyReal update_bar, int compute_gradient);
+
+ public:
+  SparseDenseLayer(int idx, int dimI, int dimO, MyReal deltaT, int activation,
+                   MyReal gammatik, MyReal gammaddt);
+  ~SparseDenseLayer();
+
+  /* Number of weights of the local output channels */
+  int getnWeightsLocal();
+
+  /* Number of nonzero weights of the local output channels
+   * (getnWeightsLocal() if no pattern is set) */
+  int getnNonzeros();
+
+  /* Set the sparsity pattern to the nonzero weights */
+  void setPattern();
+
+  /* Magnitude pruning: Set the given fraction of the weights with smallest
+   * magnitude to zero. Doesn't change the pattern. */
+  void pruneWeights(MyReal fraction);
+
+  /* Set the entries of a weight vector (e.g. the gradient) outside the
+   * pattern to zero */
+  void applyPattern(MyReal *vec);
+
+  /* Pack (unpack) the pattern as a bit mask of PATTERN_BITS bits per entry.
+   * getnPattern() returns the size of the mask, 0 if no pattern is set. */
+  int getnPattern();
+  void packPattern(MyReal *buffer);
+  void unpackPattern(MyReal *buffer);
+
+  /* Pack only the nonzero weights and the bias */
+  void packDesign(MyReal *buffer, int size);
+  void unpackDesign(MyReal *buffer);
+  int getnPacked();
+};
+
+/**
+ * Layer using a factorized weight matrix W = U V^T of rank r, where U is
+ * dimO x r and V is dimI x r (both stored row-major, U first).
+ * Layer transformation: y = y + dt * sigma(U (V^T y) + b)
+ * Design variables are the factors and the bias, (dimI + dimO) * r + 1
+ * instead of dimI * dimO + 1. The Tikhonov and DDT regularization act on
+ * these design variables, i.e. on the factors rather than on W.
+ */
+class LowRankDenseLayer : public Layer {
+ protected:
+  int rank;         /* Rank r of the weight matrix */
+  MyReal *proj;     /* Auxilliary: projected state V^T y */
+  MyReal *proj_bar; /* Auxilliary: derivative of the projected state */
+
+  /* With split channels, the derivative of the projection is summed up */
+  int getnChannelSum();
+  void applyBWDSum(MyReal *state, MyReal *state_bar, MyReal *sum,
+                   int compute_gradient);
+
+ public:
+  LowRankDenseLayer(int idx, int dimI, int dimO, int Rank, MyReal deltaT,
+                    int Activ, MyReal gammatik, MyReal gammaddt);
+  ~LowRankDenseLayer();
+
+  int getRank();
+
+  void setChannelComm(MPI_Comm comm);
+
   void applyFWD(MyReal *state);
 
   void applyBWD(MyReal *state, MyReal *state_bar, int compute_gradient);
@@ -200,6 +401,9 @@ class OpenDenseLayer : public DenseLayer {
   OpenDenseLayer(int dimI, int dimO, int activation, MyReal gammatik);
   ~OpenDenseLayer();
 
+  /* No split of the opening layer */
+  void setChannelComm(MPI_Comm comm);
+
   void setExample(MyReal *example_ptr);
 
   void applyFWD(MyReal *state);
@@ -286,15 +490,32 @@ class ConvLayer : public Layer {
   int img_size;
   int img_size_sqrt;
 
+  /* update_bar of each example of a batch, for split channels */
+  MyReal *update_batch;
+  MyReal **update_batch_ptr;
+  int nupdate_batch;
+
+  /* The two parts of applyBWD(): Compute update_bar of the local output
+   * channels, then the derivatives using the full update_bar */
+  void computeUpdateBar(MyReal *state, MyReal *state_bar, MyReal *ubar);
+  void applyUpdateBar(MyReal *state, MyReal *state_bar, MyReal *ubar,
+                      int compute_gradient);
+
  public:
   ConvLayer(int idx, int dimI, int dimO, int csize_in, int nconv_in,
             MyReal deltaT, int Activ, MyReal Gammatik, MyReal Gammaddt);
   ~ConvLayer();
 
+  void setChannelComm(MPI_Comm comm);
+
   void applyFWD(MyReal *state);
 
   void applyBWD(MyReal *state, MyReal *state_bar, int compute_gradient);
 
+  /* With split channels, update_bar and state_bar are gathered */
+  void applyBWDBatch(MyReal **state, MyReal **state_bar, int nbatch,
+                     int compute_gradient);
+
   inline MyReal apply_conv(
       MyReal *state,    // state vector to apply convolution to
       int output_conv,  // output convolution
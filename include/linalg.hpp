@@ -1,5 +1,4 @@
 #include <math.h>
-#include <mpi.h>
 #include <stdio.h>
 #include "defs.hpp"
 #pragma once
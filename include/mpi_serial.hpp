@@ -0,0 +1,71 @@
+#include <string.h>
+#include <sys/time.h>
+#pragma once
+
+/*
+ * Serial replacement of the few MPI routines used by the layers, for building
+ * the inference library without MPI (compile with -DSERIAL). Every
+ * communicator holds the calling process only, so the collectives reduce to
+ * copies.
+ */
+
+typedef int MPI_Comm;
+typedef int MPI_Datatype;
+typedef int MPI_Op;
+
+#define MPI_COMM_NULL 0
+#define MPI_COMM_SELF 1
+#define MPI_COMM_WORLD 2
+
+/* The value of a datatype is its size in bytes */
+#define MPI_DATATYPE_NULL 0
+#define MPI_INT ((int)sizeof(int))
+#define MPI_FLOAT ((int)sizeof(float))
+#define MPI_DOUBLE ((int)sizeof(double))
+
+#define MPI_SUM 0
+#define MPI_MAX 1
+#define MPI_IN_PLACE ((void *)1)
+
+#define MPI_SUCCESS 0
+
+inline int MPI_Comm_rank(MPI_Comm comm, int *rank) {
+  *rank = 0;
+  return MPI_SUCCESS;
+}
+
+inline int MPI_Comm_size(MPI_Comm comm, int *size) {
+  *size = 1;
+  return MPI_SUCCESS;
+}
+
+inline int MPI_Allreduce(const void *sendbuf, void *recvbuf, int count,
+                         MPI_Datatype datatype, MPI_Op op, MPI_Comm comm) {
+  if (sendbuf != MPI_IN_PLACE) memcpy(recvbuf, sendbuf, count * datatype);
+  return MPI_SUCCESS;
+}
+
+inline int MPI_Allgatherv(const void *sendbuf, int sendcount,
+                          MPI_Datatype sendtype, void *recvbuf,
+                          const int *recvcounts, const int *displs,
+                          MPI_Datatype recvtype, MPI_Comm comm) {
+  if (sendbuf != MPI_IN_PLACE) {
+    memcpy((char *)recvbuf + displs[0] * recvtype, sendbuf,
+           sendcount * sendtype);
+  }
+  return MPI_SUCCESS;
+}
+
+/* The result is undefined on the first (here: only) process */
+inline int MPI_Exscan(const void *sendbuf, void *recvbuf, int count,
+                      MPI_Datatype datatype, MPI_Op op, MPI_Comm comm) {
+  return MPI_SUCCESS;
+}
+
+inline int MPI_Finalize() { return MPI_SUCCESS; }
+
+inline double MPI_Wtime() {
+  struct timeval time;
+  gettimeofday(&time, NULL);
+  return time.tv_sec + 1e-6 * time.tv_usec;
+}
@@ -33,8 +33,17 @@ class Network {
 
   int ndesign_global;   /* Global number of design vars  */
   int ndesign_local;    /* Number of design vars of this local network block  */
+  int nreplica; /* Number of replicated shared design vars, stored behind the
+                   local ones (see setChannelComm()) */
   int ndesign_layermax; /* Max. number of design variables of all hidden layers
                          */
+  long long designoffset; /* Global index of the first local design variable */
+
+  int design_version; /* Counter, increased whenever the design is modified */
+
+  MyReal regul_local; /* Regularization of the local layers, except for the
+                         DDT term between the first one and layer_left */
+  int regul_version;  /* Design version of regul_local */
 
   MyReal *design;   /* Local vector of design variables*/
   MyReal *gradient; /* Local Gradient */
@@ -46,6 +55,79 @@ class Network {
   MPI_Comm comm; /* MPI communicator */
   int mpirank;   /* rank of this processor */
 
+  /* Split of the output channels of the hidden layers (see setChannelComm()).
+   * The local design consists of npieces contiguous pieces of the global
+   * design. */
+  MPI_Comm channelcomm;    /* Channel group (MPI_COMM_NULL: no split) */
+  int sharedowner;         /* Flag: this processor owns the shared design */
+  int npieces;             /* Number of pieces of the local design */
+  long long *pieceoffsets; /* Global index of each piece */
+  int *piecesizes;         /* Size of each piece */
+  MPI_Datatype designtype; /* File type of the local design */
+  MPI_Datatype sharedtype; /* Shared design vars in the local design */
+
+  /* Persistent communication of the neighbouring layers */
+  MyReal *sendlast;  /* Buffer for the last layer, sent to the right */
+  MyReal *recvlast;  /* Buffer for the last layer of the left neighbour */
+  MyReal *sendfirst; /* Buffer for the first layer, sent to the left */
+  MyReal *recvfirst; /* Buffer for the first layer of the right neighbour */
+  MPI_Request neighbourreqs[4]; /* Persistent send and receive requests */
+  int nneighbourreqs;           /* Number of requests (-1: not created yet) */
+  int neighbours_pending;       /* Flag: communication started, not completed */
+
+  /* Local design variables that are not pruned (see pruneDesign()) */
+  int nunpruned;          /* Number of them (-1: nothing pruned) */
+  int *unprunedidx;       /* Their position in the local design */
+  MyReal *unprunedbuffer; /* Auxilliary for communicating them */
+
+  /* Basis representation of the hidden weights in time: The design of hidden
+   * layer i is the linear combination sum_k phi_k(t_i) c_k of nbasis
+   * coefficient vectors c_k, shared by all hidden layers. The coefficients,
+   * together with the design of the opening and the classification layer,
+   * are the variables of the optimization. They are distributed in blocks
+   * over the processors, and all processors hold a copy of all of them.
+   * The neighbouring layers are evaluated from the coefficients as well,
+   * so they are not communicated. */
+  int nbasis;          /* Number of basis functions (0: independent layers) */
+  int basis_degree;    /* Degree of the B-splines */
+  int ndesign_open;    /* Number of design variables of the opening layer */
+  int ndesign_hidden;  /* Number of design variables of each hidden layer */
+  int ncoeffs_global;  /* Global number of coefficients */
+  int *coeffcounts;    /* Number of coefficients of each processor */
+  int *coeffdispls;    /* Index of the first coefficient of each processor */
+  MyReal *coeffs;      /* All coefficients */
+  MyReal *coeffs_grad; /* Gradient with respect to all coefficients */
+  MyReal *coeffs_tmp;  /* Auxilliary for projecting the gradient */
+  MyReal *phi;         /* Auxilliary for evaluating the basis functions */
+  MPI_Datatype coefftype; /* File type of the local coefficients */
+
+  /* Free the persistent requests and buffers of the neighbour communication.
+   * They are created again at the next communication. */
+  void freeNeighbourRequests();
+
+  /* Append a piece of the global design to the local one */
+  void addPiece(long long offset, int size);
+
+  /* Distribute the design of the local layers, given in block on the first
+   * processor of the channel group, into the local pieces of all processors
+   * of the group */
+  void MPI_ScatterPieces(MyReal *block);
+
+  /* Evaluate regul_local, it doesn't need the neighbouring layers */
+  void evalRegulLocal();
+
+  /* Evaluate the basis functions at the time of a hidden layer, phi needs
+   * room for nbasis + basis_degree values. */
+  void evalBasis(int ilayer, MyReal *phi);
+
+  /* Evaluate the design of a layer with the given index from the
+   * coefficients */
+  void evalLayerFromCoefficients(int ilayer, Layer *layer);
+
+  /* Project a local design-sized vector onto the coefficients of the local
+   * layers (transpose of the evaluation of the design) */
+  void projectLayers(MyReal *vec, MyReal *projected);
+
  public:
   Network(MPI_Comm comm);
 
@@ -82,6 +164,10 @@ class Network {
   /* Return a pointer to the gradient vector */
   MyReal *getGradient();
 
+  /* Return the current design version. It is increased after each design
+   * update, so that quantities derived from the design can be invalidated. */
+  int getDesignVersion();
+
   /* Get ID of first and last layer on this processor */
   int getStartLayerID();
   int getEndLayerID();
@@ -91,6 +177,13 @@ class Network {
   int getnDesignLocal();
   int getnDesignGlobal();
 
+  /* Return the global index of the first design variable of the local
+   * layers */
+  long long getDesignOffset();
+
+  /* Return the file type of the local design, for MPI_WriteVectorView() */
+  MPI_Datatype getDesignType();
+
   /* Return ndesign_layermax */
   int getnDesignLayermax();
 
@@ -103,10 +196,26 @@ class Network {
    */
   Layer *getLayer(int layerindex);
 
+  /**
+   * Split the output channels of the hidden layers between the processors of
+   * a channel group, call it before createLayerBlock(). Each processor stores
+   * the weights of its own output channels. The remaining design variables
+   * (bias, opening and classification layer) belong to the first processor
+   * of the group, the others hold a replica of them, which is updated with
+   * the neighbouring layers in MPI_CommunicateNeighboursStart(). The local
+   * design (getDesign(), getnDesignLocal()) only includes the own variables.
+   */
+  void setChannelComm(MPI_Comm channelcomm);
+
+  /* Return the channel group (MPI_COMM_NULL: no split) */
+  MPI_Comm getChannelComm();
+
   /*
-   * Sets the design vector of all layers to random values, scaled by the given factors
+   * Sets the design vector of all layers to random values, scaled by the given factors.
+   * The random numbers are generated on the first processor and scattered
+   * (RNG_SERIAL), or by each processor for its own part (RNG_COUNTER).
    */
-void setDesignRandom(MyReal factor_open, MyReal factor_hidden, MyReal factor_classification);
+void setDesignRandom(MyReal factor_open, MyReal factor_hidden, MyReal factor_classification, int rng);
 
 
 /* 
@@ -115,6 +224,77 @@ void setDesignRandom(MyReal factor_open, MyReal factor_hidden, MyReal factor_cla
  */
 void setDesignFromFile(const char* datafolder, const char* openingfilename, const char* hiddenfilename, const char* classificationfilename);
 
+  /*
+   * Write the network into a binary model file: A header (number of layers,
+   * channels and design variables, dt), a table describing all layers (type,
+   * activation, dimensions, position of the design) and the global design
+   * vector. The file is written collectively with MPI-IO by all processors
+   * of filecomm, each one writes its own layers if write = 1.
+   * Returns -1 if the file can't be written.
+   */
+  int writeModel(const char *filename, int write, MPI_Comm filecomm);
+
+  /*
+   * Read the design of the local layers from a binary model file written by
+   * writeModel(), with any layer distribution. Returns -1 if the file can't
+   * be read or its layers don't match the network.
+   */
+  int readModel(const char *filename, MPI_Comm filecomm);
+
+  /*
+   * Magnitude pruning of the hidden dense layers (SparseDenseLayer): Sets the
+   * given fraction of the smallest weights of each layer to zero and fixes
+   * the sparsity pattern of all layers, including the neighbouring copies.
+   * Returns the global fraction of pruned hidden weights.
+   */
+  MyReal pruneDesign(MyReal fraction);
+
+  /* Set the entries of a local design-sized vector (e.g. the gradient or a
+   * search direction) that belong to pruned weights to zero */
+  void applyPattern(MyReal *vec);
+
+  /* Sum up a local design-sized vector (e.g. the gradient) over comm after
+   * pruneDesign(). Only the entries of the remaining weights are
+   * communicated, the pruned ones are set to zero. */
+  void MPI_AllreduceUnpruned(MyReal *vec, MPI_Comm comm);
+
+  /*
+   * Represent the hidden weights by nbasis B-splines of the given degree in
+   * time (see config option weights_nbasis). The coefficients are fitted to
+   * the current design in the least-squares sense, and the design is set
+   * to the fitted one.
+   */
+  void setBasis(int nbasis, int degree);
+
+  /* Return the number of basis functions in time (0: no basis) */
+  int getnBasis();
+
+  /* Return pointers to the local part of the coefficients and of their
+   * gradient */
+  MyReal *getCoefficients();
+  MyReal *getCoefficientsGradient();
+
+  /* Return the number of coefficients (local on this processor or global) */
+  int getnCoefficientsLocal();
+  int getnCoefficientsGlobal();
+
+  /* Return the global index of the first local coefficient */
+  long long getCoefficientsOffset();
+
+  /* Return the file type of the local coefficients */
+  MPI_Datatype getCoefficientsType();
+
+  /* Gather the coefficients of all processors and evaluate the design of the
+   * local and the neighbouring layers. Call it after the local coefficients
+   * have changed, before MPI_CommunicateNeighbours(), which then only
+   * updates the design version. */
+  void setDesignFromCoefficients();
+
+  /* Project the gradient of the local layers onto the coefficients and sum
+   * it up over all processors into the local part of the coefficient
+   * gradient. */
+  void projectGradient();
+
   /*
    * Return a newly constructed layer. The time-step index decides if it is
    * an openinglayer (-1), a hidden layer, or a classification layer
@@ -124,14 +304,40 @@ void setDesignFromFile(const char* datafolder, const char* openingfilename, cons
   Layer *createLayer(int index, Config *config);
 
   /* Replace the layer with one that is received from the left neighbouring
-   * processor */
+   * processor. This is called after each design update, hence it also
+   * increases the design version. */
   void MPI_CommunicateNeighbours();
 
+  /* Split version of MPI_CommunicateNeighbours(): Start() packs the local
+   * boundary layers and starts the persistent requests, Complete() waits for
+   * them and unpacks the neighbouring layers. Between the two calls, the
+   * neighbouring layers must not be used and the design of the boundary
+   * layers must not change. Complete() does nothing if nothing is pending. */
+  void MPI_CommunicateNeighboursStart();
+  void MPI_CommunicateNeighboursComplete();
+
+  /**
+   * Return the Tikhonov and DDT regularization of the local layers. The part
+   * that doesn't need the neighbouring layers is evaluated while they are
+   * communicated (see MPI_CommunicateNeighboursStart()).
+   */
+  MyReal evalRegularization();
+
   /**
    * Applies the classification and evaluates loss/accuracy
    */
   void evalClassification(DataSet *data, MyReal **state, int output);
 
+  /**
+   * Forward-only propagation of all elements of the data set through the
+   * network, bypassing XBraid. Elements are pipelined in chunks (see
+   * DataSet::selectChunk): each processor applies its local layers to a chunk
+   * and sends the resulting states to its right neighbour, while proceeding
+   * with the next chunk. Only the processor holding the classification layer
+   * evaluates loss and accuracy.
+   */
+  void evalForward(DataSet *data);
+
   /**
    * On classification layer: derivative of evalClassification
    */
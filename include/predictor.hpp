@@ -0,0 +1,148 @@
+#include <math.h>
+#include <stdio.h>
+#include "defs.hpp"
+#include "layer.hpp"
+#pragma once
+
+/* Binary model file with int8 weights of the hidden dense layers */
+#define MODEL_MAGIC_INT8 0x4C504D4F44510001LL /* File identifier + version */
+
+/* Number of examples a thread propagates together through each layer */
+#define PREDICT_BLOCK 16
+
+/* Criteria for leaving the network early, see Predictor::setEarlyExit() */
+enum exittype { EXIT_NONE, EXIT_UPDATE, EXIT_CONFIDENCE };
+
+/**
+ * Batched inference with a trained network, without XBraid and without MPI
+ * communication. The network is loaded from a binary model file (see
+ * Network::writeModel()). predict() propagates each example of a batch
+ * through the chain of Layer::applyFWD() calls, the examples of a batch are
+ * distributed to OpenMP threads in blocks of PREDICT_BLOCK examples. Each
+ * thread owns its own set of layer objects (holding the auxilliary vectors of
+ * applyFWD), all of them share the weights.
+ *
+ * After quantize(), the hidden dense layers are evaluated with int8 weights
+ * and states, W ~ wscale * Wq and y ~ yscale * yq, by an int8 GEMM of the
+ * block with int32 accumulation. The residual update
+ * y += dt * sigma(W y + b) stays in floating point.
+ *
+ * With early exit, the state of an example is checked after every few hidden
+ * layers. Once the check is met, the example is classified right away and
+ * removed from its block, the remaining examples of the block are propagated
+ * further.
+ */
+class Predictor {
+ protected:
+  int nlayers;   /* Number of layers, including opening and classification */
+  int nchannels; /* Width of the network */
+  int nfeatures; /* Number of features per example */
+  int nclasses;  /* Number of classes */
+  MyReal dt;     /* Time step size of the hidden layers */
+
+  long long *layerdesc; /* Description of the layers, as in the model file */
+
+  int ndesign;      /* Number of design variables */
+  MyReal *design;   /* Weights and biases of all layers */
+  MyReal *gradient; /* Gradient memory required by the layers (unused) */
+
+  int nthreads;    /* Number of threads used in predict() */
+  Layer ***layers; /* Layers of each thread (dim: nthreads x nlayers) */
+  MyReal **states; /* States of a block of examples of each thread
+                      (dim: nthreads x PREDICT_BLOCK*nchannels) */
+
+  /* Int8 quantization */
+  signed char **qweights; /* Int8 weights of each layer (NULL: float layer) */
+  MyReal *wscale;         /* Scale of the weights of each layer */
+  MyReal *yscale;         /* Scale of the states entering each layer */
+  signed char **qstates;  /* Quantized states of each thread */
+  int **accums;           /* Int32 result of the GEMM of each thread */
+
+  /* Early exit */
+  int exitcriterion;    /* Criterion for leaving early (enum element) */
+  MyReal exitthreshold; /* Threshold of the criterion */
+  int exitinterval;     /* Check after every exitinterval-th hidden layer */
+  MyReal **prevstates;  /* States before the last layer of each thread */
+  int **exitslots;      /* Index of the example in each slot of the block */
+  long long nlayers_applied; /* Layers (and checks) applied since reset */
+  long long nexamples;       /* Examples predicted since reset */
+
+  /* Create a layer from its description in the model file */
+  Layer *createLayer(long long *desc);
+
+  /* Allocate the layers and the buffers of all threads */
+  int createThreads(long long *desc);
+
+  /* Apply a quantized layer to a block of nblock states of thread ithread */
+  void applyInt8(int ilayer, int ithread, int nblock);
+
+  /* Return 1 if the example in slot islot of thread ithread may leave the
+   * network. Its state is replaced by the logits then. */
+  int checkExit(int ithread, int islot);
+
+  /* Store class and probabilities of an example, given its logits */
+  void classify(const MyReal *logits, int iex, int *classes,
+                MyReal *probabilities);
+
+  /* Delete the layers and the design */
+  void clear();
+
+ public:
+  Predictor();
+  ~Predictor();
+
+  /* Load the network from a binary model file (written by
+   * Network::writeModel() or by save()). Returns -1 on failure. */
+  int load(const char *filename);
+
+  /* Write the network into a binary model file, with int8 weights if it is
+   * quantized. Returns -1 on failure. */
+  int save(const char *filename);
+
+  /**
+   * Post-training quantization of the hidden dense layers to int8. The scale
+   * of each layer's weights is max|W|/127. The scale of the states entering
+   * it is max|y|/127, calibrated by propagating the n examples (dim: n x
+   * nfeatures) in floating point. Pruned and low-rank layers stay in
+   * floating point, with a warning.
+   */
+  void quantize(const MyReal *calibration, int n);
+
+  /* Return 1 if the network is quantized */
+  int isQuantized();
+
+  /* Get the dimensions of the loaded network */
+  int getnFeatures();
+  int getnClasses();
+  int getnLayers();
+
+  /* Set the number of threads used in predict() (default: all available) */
+  void setnThreads(int nThreads);
+
+  /**
+   * Enable early exit: After every interval-th hidden layer, an example leaves
+   * the network if
+   *   EXIT_UPDATE:     the last update is small, |y_k+1 - y_k| <= threshold
+   *                    * |y_k|, or
+   *   EXIT_CONFIDENCE: the classification layer, applied to the
+   *                    intermediate state, predicts a class with probability
+   *                    >= threshold.
+   * EXIT_NONE (default) propagates all examples through all layers.
+   */
+  void setEarlyExit(int criterion, MyReal threshold, int interval);
+
+  /* Average number of layers applied per example since the last reset,
+   * including the classification layers applied by EXIT_CONFIDENCE checks */
+  MyReal getAverageLayers();
+  void resetStatistics();
+
+  /**
+   * Predict the classes of n examples, stored contiguously in batch
+   * (dim: n x nfeatures).
+   * Out: classes       - predicted class of each example (dim: n)
+   *      probabilities - class probabilities of each example (dim: n x
+   *                      nclasses), not computed if NULL
+   */
+  void predict(const MyReal *batch, int n, int *classes,
+               MyReal *probabilities);
+};
@@ -1,11 +1,12 @@
-#include <mpi.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "defs.hpp"
 #pragma once
 
 /**
- * Read data from file
+ * Read data from file. Rows with a NULL pointer are skipped, reading stops
+ * after the last row that is stored.
  */
 void read_matrix(char *filename, MyReal **var, int dimx, int dimy);
 
@@ -19,6 +20,9 @@ void read_vector(char *filename, MyReal *var, int dimy);
  */
 void write_vector(char *filename, MyReal *var, int dimN);
 
+/* Parallel vector communication and file I/O, not in the serial build */
+#ifndef SERIAL
+
 /**
  * Gather a local vector of size localsendcount into global recvbuffer at root
  */
@@ -30,3 +34,53 @@ void MPI_GatherVector(MyReal *sendbuffer, int localsendcount,
  */
 void MPI_ScatterVector(MyReal *sendbuffer, MyReal *recvbuffer,
                        int localrecvcount, int rootprocessID, MPI_Comm comm);
+
+/**
+ * Collectively write the local part of a distributed vector to a binary file,
+ * opened on all processors of the file's communicator. The global vector
+ * starts at the byte offset, the local part at its global index localoffset.
+ * Processors with write = 0 take part in the call without writing.
+ */
+void MPI_WriteVector(MPI_File fh, MPI_Offset offset, MyReal *localvec,
+                     int nlocal, long long localoffset, int write);
+
+/**
+ * Collectively read the local part of a distributed vector from a binary
+ * file, the counterpart of MPI_WriteVector.
+ */
+void MPI_ReadVector(MPI_File fh, MPI_Offset offset, MyReal *localvec,
+                    int nlocal, long long localoffset);
+
+/**
+ * Create the file type of a local vector that is scattered over npieces
+ * contiguous pieces of the global vector: piece i starts at global index
+ * offsets[i] (increasing) and holds sizes[i] entries.
+ */
+void MPI_CreateFileType(int npieces, long long *offsets, int *sizes,
+                        MPI_Datatype *filetype);
+
+/**
+ * Same as MPI_WriteVector and MPI_ReadVector, for a local vector that is
+ * placed in the global vector by a file type from MPI_CreateFileType.
+ */
+void MPI_WriteVectorView(MPI_File fh, MPI_Offset offset, MyReal *localvec,
+                         int nlocal, MPI_Datatype filetype, int write);
+void MPI_ReadVectorView(MPI_File fh, MPI_Offset offset, MyReal *localvec,
+                        int nlocal, MPI_Datatype filetype);
+
+#endif
+
+/**
+ * Counter-based random number in [0,1): Philox-2x32-10 applied to the counter,
+ * keyed by the seed. The same counter and seed always give the same number,
+ * independent of the order or the processor that generates it.
+ */
+MyReal random_counter(uint64_t counter, uint32_t seed);
+
+/**
+ * Evaluate the nbasis B-splines of the given degree on the clamped uniform
+ * knot vector of [0,1] at s in [0,1] (Cox-de Boor recursion), phi must have
+ * room for nbasis + degree values. Degree 1 gives the hat functions of
+ * piecewise linear interpolation between nbasis equidistant nodes.
+ */
+void bspline_basis(int degree, int nbasis, MyReal s, MyReal *phi);
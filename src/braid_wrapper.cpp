@@ -19,6 +19,7 @@
 //
 // Download: https://arxiv.org/pdf/1812.04352.pdf
 //
+#include <assert.h>
 #include "braid_wrapper.hpp"
 
 /* ========================================================= */
@@ -29,24 +30,32 @@ myBraidVector::myBraidVector(int nChannels, int nBatch) {
   state = NULL;
   layer = NULL;
   sendflag = -1.0;
+  level = 0;
 
-  /* Allocate the state vector */
-  state = new MyReal *[nbatch];
-  for (int iex = 0; iex < nbatch; iex++) {
-    state[iex] = new MyReal[nchannels];
-    for (int ic = 0; ic < nchannels; ic++) {
-      state[iex][ic] = 0.0;
+  /* Allocate the state vector, shell vectors keep none */
+  if (nbatch > 0) {
+    state = new MyReal *[nbatch];
+    for (int iex = 0; iex < nbatch; iex++) {
+      state[iex] = new MyReal[nchannels];
+      for (int ic = 0; ic < nchannels; ic++) {
+        state[iex][ic] = 0.0;
+      }
     }
   }
 }
 
-myBraidVector::~myBraidVector() {
+myBraidVector::~myBraidVector() { freeState(); }
+
+void myBraidVector::freeState() {
   /* Deallocate the state vector */
-  for (int iex = 0; iex < nbatch; iex++) {
-    delete[] state[iex];
+  if (state != NULL) {
+    for (int iex = 0; iex < nbatch; iex++) {
+      delete[] state[iex];
+    }
+    delete[] state;
+    state = NULL;
   }
-  delete[] state;
-  state = NULL;
+  nbatch = 0;
 }
 
 int myBraidVector::getnChannels() { return nchannels; }
@@ -63,6 +72,107 @@ void myBraidVector::setLayer(Layer *layerptr) { layer = layerptr; }
 MyReal myBraidVector::getSendflag() { return sendflag; }
 void myBraidVector::setSendflag(MyReal value) { sendflag = value; }
 
+int myBraidVector::getLevel() { return level; }
+
+void myBraidVector::setLevel(int Level) { level = Level; }
+
+/* ========================================================= */
+myStoredVector::myStoredVector(int nChannels, int nBatch, int Precision) {
+  nchannels = nChannels;
+  nbatch = nBatch;
+  precision = Precision;
+  layer = NULL;
+
+  /* Allocate the storage */
+  switch (precision) {
+    case PREC_FLOAT:
+      values = new float[nbatch * nchannels];
+      break;
+    case PREC_BFLOAT16:
+      values = new uint16_t[nbatch * nchannels];
+      break;
+    default:
+      values = new MyReal[nbatch * nchannels];
+  }
+}
+
+myStoredVector::~myStoredVector() {
+  switch (precision) {
+    case PREC_FLOAT:
+      delete[](float *) values;
+      break;
+    case PREC_BFLOAT16:
+      delete[](uint16_t *) values;
+      break;
+    default:
+      delete[](MyReal *) values;
+  }
+}
+
+void myStoredVector::store(myBraidVector *u, int nBatch) {
+  int idx = 0;
+  for (int iex = 0; iex < nBatch; iex++) {
+    for (int ic = 0; ic < nchannels; ic++) {
+      MyReal value = u->getState(iex)[ic];
+      switch (precision) {
+        case PREC_FLOAT:
+          ((float *)values)[idx] = (float)value;
+          break;
+        case PREC_BFLOAT16: {
+          /* Upper half of the float, rounded to nearest even */
+          float fvalue = (float)value;
+          uint32_t bits;
+          memcpy(&bits, &fvalue, sizeof(bits));
+          bits += 0x7FFF + ((bits >> 16) & 1);
+          ((uint16_t *)values)[idx] = (uint16_t)(bits >> 16);
+          break;
+        }
+        default:
+          ((MyReal *)values)[idx] = value;
+      }
+      idx++;
+    }
+  }
+}
+
+void myStoredVector::restore(myBraidVector *u, int nBatch) {
+  int idx = 0;
+  for (int iex = 0; iex < nBatch; iex++) {
+    for (int ic = 0; ic < nchannels; ic++) {
+      switch (precision) {
+        case PREC_FLOAT:
+          u->getState(iex)[ic] = ((float *)values)[idx];
+          break;
+        case PREC_BFLOAT16: {
+          uint32_t bits = ((uint32_t)((uint16_t *)values)[idx]) << 16;
+          float fvalue;
+          memcpy(&fvalue, &bits, sizeof(fvalue));
+          u->getState(iex)[ic] = fvalue;
+          break;
+        }
+        default:
+          u->getState(iex)[ic] = ((MyReal *)values)[idx];
+      }
+      idx++;
+    }
+  }
+  u->setLayer(layer);
+}
+
+int myStoredVector::getnBytes() {
+  switch (precision) {
+    case PREC_FLOAT:
+      return nbatch * nchannels * sizeof(float);
+    case PREC_BFLOAT16:
+      return nbatch * nchannels * sizeof(uint16_t);
+    default:
+      return nbatch * nchannels * sizeof(MyReal);
+  }
+}
+
+Layer *myStoredVector::getLayer() { return layer; }
+void myStoredVector::setLayer(Layer *layerptr) { layer = layerptr; }
+
 /* ========================================================= */
 /* ========================================================= */
 /* ========================================================= */
@@ -74,6 +184,34 @@ myBraidApp::myBraidApp(DataSet *Data, Network *Network, Config *config,
   data = Data;
   objective = 0.0;
 
+  openlayer_cache = NULL;
+  openlayer_cacheIDs = NULL;
+  openlayer_cachesize = 0;
+  openlayer_cacheversion = -1;
+  openlayer_nevals = 0;
+
+  checkpoint_stride = 0;
+  checkpoint_precision = PREC_DOUBLE;
+  checkpoint_ilower = 0;
+  checkpoint_iupper = -1;
+  checkpoints = NULL;
+  references = NULL;
+  reference_keep = 0;
+  reference_use = 0;
+  restored = NULL;
+  recomputed = NULL;
+  recomputed_first = -1;
+
+  batch_coarsen = 1;
+  channel_coarsen = 1;
+  coarselayers = NULL;
+  coarseversions = NULL;
+
+  maxiter = config->braid_maxiter;
+  accesslevel = config->braid_accesslevel;
+  rnorm_first = 0.0;
+  convrate = 0.0;
+
   /* Initialize XBraid core */
   core = new BraidCore(comm, this);
 
@@ -83,7 +221,7 @@ myBraidApp::myBraidApp(DataSet *Data, Network *Network, Config *config,
   core->SetPrintLevel(config->braid_printlevel);
   core->SetCFactor(0, config->braid_cfactor0);
   core->SetCFactor(-1, config->braid_cfactor);
-  core->SetAccessLevel(config->braid_accesslevel);
+  core->SetAccessLevel(accesslevel);
   core->SetMaxIter(config->braid_maxiter);
   core->SetSkip(config->braid_setskip);
   if (config->braid_fmg) {
@@ -92,17 +230,176 @@ myBraidApp::myBraidApp(DataSet *Data, Network *Network, Config *config,
   core->SetNRelax(-1, config->braid_nrelax);
   core->SetNRelax(0, config->braid_nrelax0);
   core->SetAbsTol(config->braid_abstol);
+  if (config->braid_shell) {
+    setShell();
+  }
 }
 
 myBraidApp::~myBraidApp() {
   /* Delete the core, if drive() has been called */
   if (core->GetWarmRestart()) delete core;
+
+  /* Delete the opening layer cache */
+  freeOpenLayerCache();
+
+  /* Delete the channel-reduced layers */
+  if (coarselayers != NULL) {
+    for (int i = 0; i < network->getnLayersGlobal(); i++) {
+      if (coarselayers[i] != NULL) {
+        delete[] coarselayers[i]->getWeights();
+        delete[] coarselayers[i]->getWeightsBar();
+        delete coarselayers[i];
+      }
+    }
+    delete[] coarselayers;
+    delete[] coarseversions;
+  }
+
+  /* Delete the checkpoints */
+  if (checkpoints != NULL) {
+    int ncheckpoints = checkpoint_iupper / checkpoint_stride -
+                       checkpoint_ilower / checkpoint_stride + 2;
+    for (int i = 0; i < ncheckpoints; i++) {
+      if (checkpoints[i] != NULL) delete checkpoints[i];
+      if (references[i] != NULL) delete references[i];
+    }
+    delete[] checkpoints;
+    delete[] references;
+  }
+  if (restored != NULL) delete restored;
+  if (recomputed != NULL) {
+    for (int i = 0; i < checkpoint_stride - 1; i++) {
+      delete recomputed[i];
+    }
+    delete[] recomputed;
+  }
 }
 
 MyReal myBraidApp::getObjective() { return objective; }
 
 BraidCore *myBraidApp::getCore() { return core; }
 
+int myBraidApp::getnOpenLayerEvals() { return openlayer_nevals; }
+
+void myBraidApp::setSpatialCoarsening(int batchfactor, int channelfactor) {
+  batch_coarsen = batchfactor;
+  channel_coarsen = channelfactor;
+  if (batch_coarsen > 1 || channel_coarsen > 1) {
+    core->SetSpatialCoarsenAndRefine();
+  }
+}
+
+int myBraidApp::getnBatch(myBraidVector *u) {
+  int factor = 1;
+  for (int l = 0; l < u->getLevel(); l++) factor *= batch_coarsen;
+
+  /* Never exceed the examples allocated in u (none for a shell vector) */
+  return std::min(u->getnBatch(), (data->getnBatch() + factor - 1) / factor);
+}
+
+myBraidVector *myBraidApp::allocateVector(int level) {
+  int nchannels = network->getnChannels();
+  int nbatch = data->getnBatchMax();
+
+  /* Channels are reduced once, the batch on each level */
+  if (level > 0) {
+    nchannels = (nchannels + channel_coarsen - 1) / channel_coarsen;
+  }
+  for (int l = 0; l < level; l++) {
+    nbatch = (nbatch + batch_coarsen - 1) / batch_coarsen;
+  }
+
+  myBraidVector *u = new myBraidVector(nchannels, nbatch);
+  u->setLevel(level);
+
+  return u;
+}
+
+Layer *myBraidApp::getCoarseLayer(Layer *layer) {
+  int nlayers = network->getnLayersGlobal();
+  int nfine = layer->getDimOut();
+  int ncoarse = (nfine + channel_coarsen - 1) / channel_coarsen;
+  int index = layer->getIndex();
+
+  /* Allocate the storage at first call */
+  if (coarselayers == NULL) {
+    coarselayers = new Layer *[nlayers];
+    coarseversions = new int[nlayers];
+    for (int i = 0; i < nlayers; i++) {
+      coarselayers[i] = NULL;
+      coarseversions[i] = -1;
+    }
+  }
+  if (coarselayers[index] == NULL) {
+    coarselayers[index] =
+        new DenseLayer(index, ncoarse, ncoarse, layer->getDt(),
+                       layer->getActivation(), 0.0, 0.0);
+    int ndesign = coarselayers[index]->getnDesign();
+    coarselayers[index]->setMemory(new MyReal[ndesign], new MyReal[ndesign]);
+  }
+  Layer *coarse = coarselayers[index];
+
+  /* Restrict the weights, if the design has changed: W_c = R W P with the
+   * averaging R and the injection P of channel blocks */
+  if (coarseversions[index] != network->getDesignVersion()) {
+    MyReal *weights = layer->getWeights();
+    MyReal *cweights = coarse->getWeights();
+    vec_setZero(ncoarse * ncoarse, cweights);
+    for (int io = 0; io < nfine; io++) {
+      int jo = io / channel_coarsen;
+      int nblock = std::min(channel_coarsen, nfine - jo * channel_coarsen);
+      for (int ii = 0; ii < nfine; ii++) {
+        cweights[jo * ncoarse + ii / channel_coarsen] +=
+            weights[io * nfine + ii] / nblock;
+      }
+    }
+    coarse->getBias()[0] = layer->getBias()[0];
+    coarseversions[index] = network->getDesignVersion();
+  }
+
+  return coarse;
+}
+
+/* Callbacks for braid's C interface, forwarding to the app */
+static braid_Int myBraidApp_SInit(braid_App app, braid_Real t,
+                                  braid_Vector *u_ptr) {
+  return ((myBraidApp *)(BraidApp *)app)->SInit(t, u_ptr);
+}
+
+static braid_Int myBraidApp_SClone(braid_App app, braid_Vector u_,
+                                   braid_Vector *v_ptr) {
+  return ((myBraidApp *)(BraidApp *)app)->SClone(u_, v_ptr);
+}
+
+static braid_Int myBraidApp_SFree(braid_App app, braid_Vector u_) {
+  return ((myBraidApp *)(BraidApp *)app)->SFree(u_);
+}
+
+void myBraidApp::setShell() {
+  braid_SetShell(core->GetCore(), myBraidApp_SInit, myBraidApp_SClone,
+                 myBraidApp_SFree);
+}
+
+void myBraidApp::setMaxIter(int maxIter) {
+  maxiter = maxIter;
+  core->SetMaxIter(maxiter);
+}
+
+int myBraidApp::setTolerance(MyReal tol) {
+  int niter = maxiter;
+
+  /* Estimate the number of iterations from the previous run */
+  if (convrate > 0.0 && convrate < 1.0 && rnorm_first > tol) {
+    niter = 1 + (int)ceil(log(tol / rnorm_first) / log(convrate));
+    niter = std::min(std::max(niter, 1), maxiter);
+  }
+
+  core->SetAbsTol(tol);
+  core->SetMaxIter(niter);
+
+  return niter;
+}
+
 void myBraidApp::GetGridDistribution(int *ilower_ptr, int *iupper_ptr) {
   core->GetDistribution(ilower_ptr, iupper_ptr);
 }
@@ -113,6 +410,62 @@ braid_Int myBraidApp::GetTimeStepIndex(MyReal t) {
   return ts;
 }
 
+void myBraidApp::freeOpenLayerCache() {
+  if (openlayer_cache == NULL) return;
+
+  for (int islice = 0; islice < openlayer_cachesize; islice++) {
+    delete[] openlayer_cache[islice];
+  }
+  delete[] openlayer_cache;
+  delete[] openlayer_cacheIDs;
+  openlayer_cache = NULL;
+  openlayer_cacheIDs = NULL;
+  openlayer_cachesize = 0;
+}
+
+void myBraidApp::applyOpenLayer(myBraidVector *u) {
+  Layer *openlayer = network->getLayer(-1);
+  int nchannels = network->getnChannels();
+  int nbatch = data->getnBatch();
+  int chunkfirst = data->getChunkFirst();
+
+  /* Allocate the cache for the slice at first call, and again if the slice
+   * has grown (the line search may split the batch differently) */
+  if (openlayer_cachesize < data->getnSlice()) {
+    freeOpenLayerCache();
+    openlayer_cachesize = data->getnSlice();
+    openlayer_cache = new MyReal *[openlayer_cachesize];
+    openlayer_cacheIDs = new int[openlayer_cachesize];
+    for (int islice = 0; islice < openlayer_cachesize; islice++) {
+      openlayer_cache[islice] = new MyReal[nchannels];
+      openlayer_cacheIDs[islice] = -1;
+    }
+  }
+
+  /* Invalidate the cache, if the opening layer weights have changed */
+  if (openlayer->getnDesign() > 0 &&
+      openlayer_cacheversion != network->getDesignVersion()) {
+    for (int islice = 0; islice < openlayer_cachesize; islice++) {
+      openlayer_cacheIDs[islice] = -1;
+    }
+    openlayer_cacheversion = network->getDesignVersion();
+  }
+
+  for (int iex = 0; iex < nbatch; iex++) {
+    /* Recompute the opening layer output, if the example has changed */
+    int islice = chunkfirst + iex;
+    if (openlayer_cacheIDs[islice] != data->getBatchID(iex)) {
+      openlayer->setExample(data->getExample(iex));
+      openlayer->applyFWD(openlayer_cache[islice]);
+      openlayer_cacheIDs[islice] = data->getBatchID(iex);
+      openlayer_nevals++;
+    }
+
+    /* Copy the opening layer output into the state */
+    vec_copy(nchannels, openlayer_cache[islice], u->getState(iex));
+  }
+}
+
 braid_Int myBraidApp::Step(braid_Vector u_, braid_Vector ustop_,
                            braid_Vector fstop_, BraidStepStatus &pstatus) {
   int ts_stop;
@@ -120,25 +473,31 @@ braid_Int myBraidApp::Step(braid_Vector u_, braid_Vector ustop_,
   MyReal deltaT;
 
   myBraidVector *u = (myBraidVector *)u_;
-  int nbatch = data->getnBatch();
+  int nbatch = getnBatch(u);
+
+  /* Braid steps only vectors that carry a state */
+  assert(u->getState() != NULL);
 
   /* Get the time-step size and current time index*/
   pstatus.GetTstartTstop(&tstart, &tstop);
   ts_stop = GetTimeStepIndex(tstop);
   deltaT = tstop - tstart;
 
+  /* On coarse levels with reduced channels, apply the reduced layer */
+  Layer *layer = u->getLayer();
+  if (u->getnChannels() < network->getnChannels()) {
+    layer = getCoarseLayer(layer);
+  }
+
   /* Set time step size */
-  u->getLayer()->setDt(deltaT);
+  layer->setDt(deltaT);
 
   // printf("%d: step %d,%f -> %d, %f layer %d using %1.14e state %1.14e, %d\n",
   // app->myid, tstart, ts_stop, tstop, u->layer->getIndex(),
   // u->layer->getWeights()[3], u->state[1][1], u->layer->getnDesign());
 
   /* apply the layer for all examples */
-  for (int iex = 0; iex < nbatch; iex++) {
-    /* Apply the layer */
-    u->getLayer()->applyFWD(u->getState(iex));
-  }
+  layer->applyFWDBatch(u->getState(), nbatch);
 
   /* Free the layer, if it has just been send to this processor */
   if (u->getSendflag() > 0.0) {
@@ -182,6 +541,7 @@ braid_Int myBraidApp::Clone(braid_Vector u_, braid_Vector *v_ptr) {
   }
   v->setLayer(u->getLayer());
   v->setSendflag(u->getSendflag());
+  v->setLevel(u->getLevel());
 
   /* Set the return pointer */
   *v_ptr = (braid_Vector)v;
@@ -191,23 +551,13 @@ braid_Int myBraidApp::Clone(braid_Vector u_, braid_Vector *v_ptr) {
 
 braid_Int myBraidApp::Init(braid_Real t, braid_Vector *u_ptr) {
   int nchannels = network->getnChannels();
-  int nbatch = data->getnBatch();
 
-  myBraidVector *u = new myBraidVector(nchannels, nbatch);
+  /* Allocate for the largest chunk of the batch */
+  myBraidVector *u = new myBraidVector(nchannels, data->getnBatchMax());
 
   /* Apply the opening layer */
   if (t == 0) {
-    Layer *openlayer = network->getLayer(-1);
-    // printf("%d: Init %f: layer %d using %1.14e state %1.14e, %d\n",
-    // app->myid, t, openlayer->getIndex(), openlayer->getWeights()[3],
-    // u->state[1][1], openlayer->getnDesign());
-    for (int iex = 0; iex < nbatch; iex++) {
-      /* set example */
-      openlayer->setExample(data->getExample(iex));
-
-      /* Apply the layer */
-      openlayer->applyFWD(u->getState(iex));
-    }
+    applyOpenLayer(u);
   }
 
   /* Set the layer pointer */
@@ -229,13 +579,46 @@ braid_Int myBraidApp::Free(braid_Vector u_) {
   return 0;
 }
 
+braid_Int myBraidApp::SInit(braid_Real t, braid_Vector *u_ptr) {
+  myBraidVector *u = new myBraidVector(network->getnChannels(), 0);
+
+  /* Set the layer pointer */
+  if (t >= 0) {
+    u->setLayer(network->getLayer(GetTimeStepIndex(t)));
+  }
+
+  *u_ptr = (braid_Vector)u;
+
+  return 0;
+}
+
+braid_Int myBraidApp::SClone(braid_Vector u_, braid_Vector *v_ptr) {
+  myBraidVector *u = (myBraidVector *)u_;
+  myBraidVector *v = new myBraidVector(u->getnChannels(), 0);
+
+  v->setLayer(u->getLayer());
+  v->setSendflag(u->getSendflag());
+  v->setLevel(u->getLevel());
+
+  *v_ptr = (braid_Vector)v;
+
+  return 0;
+}
+
+braid_Int myBraidApp::SFree(braid_Vector u_) {
+  myBraidVector *u = (myBraidVector *)u_;
+  u->freeState();
+
+  return 0;
+}
+
 braid_Int myBraidApp::Sum(braid_Real alpha, braid_Vector x_, braid_Real beta,
                           braid_Vector y_) {
   myBraidVector *x = (myBraidVector *)x_;
   myBraidVector *y = (myBraidVector *)y_;
 
-  int nchannels = network->getnChannels();
-  int nbatch = data->getnBatch();
+  int nchannels = y->getnChannels();
+  int nbatch = getnBatch(y);
 
   for (int iex = 0; iex < nbatch; iex++) {
     for (int ic = 0; ic < nchannels; ic++) {
@@ -249,8 +632,8 @@ braid_Int myBraidApp::Sum(braid_Real alpha, braid_Vector x_, braid_Real beta,
 
 braid_Int myBraidApp::SpatialNorm(braid_Vector u_, braid_Real *norm_ptr) {
   myBraidVector *u = (myBraidVector *)u_;
-  int nchannels = network->getnChannels();
-  int nbatch = data->getnBatch();
+  int nchannels = u->getnChannels();
+  int nbatch = getnBatch(u);
 
   MyReal dot = 0.0;
   for (int iex = 0; iex < nbatch; iex++) {
@@ -261,8 +644,245 @@ braid_Int myBraidApp::SpatialNorm(braid_Vector u_, braid_Real *norm_ptr) {
   return 0;
 }
 
+braid_Int myBraidApp::Coarsen(braid_Vector fu_, braid_Vector *cu_ptr,
+                              BraidCoarsenRefStatus &status) {
+  myBraidVector *fu = (myBraidVector *)fu_;
+  myBraidVector *cu = allocateVector(fu->getLevel() + 1);
+  int nfine = fu->getnChannels();
+  int ncoarse = cu->getnChannels();
+  int nbatch = getnBatch(fu);
+
+  /* Share the layer, but leave freeing a received layer to the fine vector */
+  cu->setLayer(fu->getLayer());
+  cu->setSendflag(0.0);
+
+  /* Average each group of examples and, if reduced, each block of channels */
+  for (int iex = 0; iex < nbatch; iex++) {
+    int jex = iex / batch_coarsen;
+    int ngroup = std::min(batch_coarsen, nbatch - jex * batch_coarsen);
+    for (int ic = 0; ic < nfine; ic++) {
+      int jc = ic, nblock = 1;
+      if (ncoarse < nfine) {
+        jc = ic / channel_coarsen;
+        nblock = std::min(channel_coarsen, nfine - jc * channel_coarsen);
+      }
+      cu->getState(jex)[jc] += fu->getState(iex)[ic] / (ngroup * nblock);
+    }
+  }
+
+  *cu_ptr = (braid_Vector)cu;
+
+  return 0;
+}
+
+braid_Int myBraidApp::Refine(braid_Vector cu_, braid_Vector *fu_ptr,
+                             BraidCoarsenRefStatus &status) {
+  myBraidVector *cu = (myBraidVector *)cu_;
+  myBraidVector *fu = allocateVector(cu->getLevel() - 1);
+  int nfine = fu->getnChannels();
+  int ncoarse = cu->getnChannels();
+  int nbatch = getnBatch(fu);
+
+  /* Share the layer, but leave freeing a received layer to the coarse vector */
+  fu->setLayer(cu->getLayer());
+  fu->setSendflag(0.0);
+
+  /* Copy each coarse value to all examples and channels it represents */
+  for (int iex = 0; iex < nbatch; iex++) {
+    for (int ic = 0; ic < nfine; ic++) {
+      int jc = ncoarse < nfine ? ic / channel_coarsen : ic;
+      fu->getState(iex)[ic] = cu->getState(iex / batch_coarsen)[jc];
+    }
+  }
+
+  *fu_ptr = (braid_Vector)fu;
+
+  return 0;
+}
+
+void myBraidApp::setCheckpointing(int stride, int precision) {
+  checkpoint_stride = stride;
+  checkpoint_precision = precision;
+
+  /* Braid keeps the C-points, all states are accessed after drive() */
+  core->SetStorage(-1);
+  if (accesslevel < 1) {
+    accesslevel = 1;
+    core->SetAccessLevel(accesslevel);
+  }
+}
+
+void myBraidApp::setCheckpointReference(int keep, int use) {
+  reference_keep = keep;
+  reference_use = use;
+
+  /* The recomputed states depend on the restored checkpoint */
+  recomputed_first = -1;
+
+  /* Free the copies that are no longer kept */
+  if (!keep && references != NULL) {
+    int ncheckpoints = checkpoint_iupper / checkpoint_stride -
+                       checkpoint_ilower / checkpoint_stride + 2;
+    for (int i = 0; i < ncheckpoints; i++) {
+      if (references[i] != NULL) delete references[i];
+      references[i] = NULL;
+    }
+  }
+}
+
+myBraidVector *myBraidApp::getStoredVector(int ts) {
+  braid_BaseVector ubase;
+
+  _braid_UGetVectorRef(core->GetCore(), 0, ts, &ubase);
+  if (ubase == NULL) return NULL;
+  return (myBraidVector *)ubase->userVector;
+}
+
+myBraidVector *myBraidApp::getState(int ts) {
+  myBraidVector *u;
+  int nchannels = network->getnChannels();
+  int nbatch = data->getnBatch();
+
+  /* All states are stored by braid */
+  if (checkpoint_stride == 0) return getStoredVector(ts);
+
+  if (ts < checkpoint_ilower || ts > checkpoint_iupper) return NULL;
+
+  /* Get the closest checkpoint, kept either by braid or by Access() */
+  int first = (ts / checkpoint_stride) * checkpoint_stride;
+  if (first < checkpoint_ilower) first = checkpoint_ilower;
+  u = getStoredVector(first);
+  if (u == NULL) {
+    /* Restore the checkpoint in full precision */
+    if (restored == NULL) {
+      restored = new myBraidVector(nchannels, data->getnBatchMax());
+    }
+    u = restored;
+    int icheck = first / checkpoint_stride -
+                 checkpoint_ilower / checkpoint_stride +
+                 (first > checkpoint_ilower);
+    if (reference_use) {
+      references[icheck]->restore(u, nbatch);
+    } else {
+      checkpoints[icheck]->restore(u, nbatch);
+    }
+  }
+  if (ts == first) return u;
+
+  /* Recompute the states up to the next checkpoint, if not done yet */
+  if (recomputed_first != first) {
+    if (recomputed == NULL) {
+      recomputed = new myBraidVector *[checkpoint_stride - 1];
+      for (int i = 0; i < checkpoint_stride - 1; i++) {
+        recomputed[i] = new myBraidVector(nchannels, data->getnBatchMax());
+      }
+    }
+    int last = (first / checkpoint_stride + 1) * checkpoint_stride - 1;
+    if (last > checkpoint_iupper) last = checkpoint_iupper;
+    for (int its = first; its < last; its++) {
+      myBraidVector *v = recomputed[its - first];
+      for (int iex = 0; iex < nbatch; iex++) {
+        vec_copy(nchannels, u->getState(iex), v->getState(iex));
+      }
+
+      /* Same step as in Step(), using braid's time grid */
+      Layer *layer = network->getLayer(its);
+      layer->setDt(tstart + ((MyReal)(its + 1) / ntime) * (tstop - tstart) -
+                   (tstart + ((MyReal)its / ntime) * (tstop - tstart)));
+      layer->applyFWDBatch(v->getState(), nbatch);
+      v->setLayer(network->getLayer(its + 1));
+      u = v;
+    }
+    recomputed_first = first;
+  }
+
+  return recomputed[ts - first - 1];
+}
+
+void myBraidApp::getCheckpointMemory(MyReal *stored_ptr, MyReal *full_ptr) {
+  int ilower, iupper;
+  MyReal nbytes = network->getnChannels() * data->getnBatchMax() *
+                  sizeof(MyReal);
+
+  /* Number of local time points */
+  GetGridDistribution(&ilower, &iupper);
+  *full_ptr = (iupper - ilower + 1) * nbytes;
+  if (checkpoint_stride == 0) {
+    *stored_ptr = *full_ptr;
+    return;
+  }
+
+  /* C-points stored by braid, restored and recomputed states */
+  int ncpoints = 0;
+  for (int its = ilower; its <= iupper; its++) {
+    if (getStoredVector(its) != NULL) ncpoints++;
+  }
+  *stored_ptr = ncpoints * nbytes;
+  if (restored != NULL) *stored_ptr += nbytes;
+  if (recomputed != NULL) *stored_ptr += (checkpoint_stride - 1) * nbytes;
+
+  /* Own checkpoints */
+  if (checkpoints != NULL) {
+    int ncheckpoints = checkpoint_iupper / checkpoint_stride -
+                       checkpoint_ilower / checkpoint_stride + 2;
+    for (int i = 0; i < ncheckpoints; i++) {
+      if (checkpoints[i] != NULL) *stored_ptr += checkpoints[i]->getnBytes();
+    }
+  }
+}
+
 braid_Int myBraidApp::Access(braid_Vector u_, BraidAccessStatus &astatus) {
-  printf("my_Access: To be implemented...\n");
+  myBraidVector *u = (myBraidVector *)u_;
+  int nchannels = network->getnChannels();
+  int nbatch = data->getnBatch();
+  MyReal t;
+  int level;
+
+  /* Only the checkpoints of the adjoint need the access routine */
+  if (checkpoint_stride == 0) return 0;
+
+  /* Allocate the checkpoints at first call */
+  if (checkpoints == NULL) {
+    GetGridDistribution(&checkpoint_ilower, &checkpoint_iupper);
+    int ncheckpoints = checkpoint_iupper / checkpoint_stride -
+                       checkpoint_ilower / checkpoint_stride + 2;
+    checkpoints = new myStoredVector *[ncheckpoints];
+    references = new myStoredVector *[ncheckpoints];
+    for (int i = 0; i < ncheckpoints; i++) {
+      checkpoints[i] = NULL;
+      references[i] = NULL;
+    }
+  }
+
+  /* Previously recomputed states are outdated */
+  recomputed_first = -1;
+
+  /* Copy the state, if it is a checkpoint that braid doesn't store. The
+   * stored C-points are looked up rather than assumed at multiples of the
+   * coarsening factor, so any stride works with braid's grid layout. */
+  astatus.GetLevel(&level);
+  astatus.GetT(&t);
+  int ts = GetTimeStepIndex(t);
+  if (level > 0 || getStoredVector(ts) != NULL) return 0;
+  if (ts % checkpoint_stride != 0 && ts != checkpoint_ilower) return 0;
+
+  int icheck = ts / checkpoint_stride - checkpoint_ilower / checkpoint_stride +
+               (ts > checkpoint_ilower);
+  if (checkpoints[icheck] == NULL) {
+    checkpoints[icheck] = new myStoredVector(nchannels, data->getnBatchMax(),
+                                             checkpoint_precision);
+  }
+  checkpoints[icheck]->store(u, nbatch);
+  checkpoints[icheck]->setLayer(network->getLayer(ts));
+
+  if (reference_keep) {
+    if (references[icheck] == NULL) {
+      references[icheck] =
+          new myStoredVector(nchannels, data->getnBatchMax(), PREC_DOUBLE);
+    }
+    references[icheck]->store(u, nbatch);
+    references[icheck]->setLayer(network->getLayer(ts));
+  }
 
   return 0;
 }
@@ -272,10 +892,13 @@ braid_Int myBraidApp::BufSize(braid_Int *size_ptr, BraidBufferStatus &bstatus) {
   int nbatch = data->getnBatch();
 
   /* Gather number of variables */
-  int nuvector = nchannels * nbatch;
+  int nuvector = 1 + nchannels * nbatch;
   int nlayerinfo = 12;
   int nlayerdesign = network->getnDesignLayermax();
 
+  /* Sparse layers add their pattern */
+  nlayerdesign += 1 + (nlayerdesign + PATTERN_BITS - 1) / PATTERN_BITS;
+
   /* Set the size */
   *size_ptr = (nuvector + nlayerinfo + nlayerdesign) * sizeof(MyReal);
 
@@ -285,23 +908,23 @@ braid_Int myBraidApp::BufSize(braid_Int *size_ptr, BraidBufferStatus &bstatus) {
 braid_Int myBraidApp::BufPack(braid_Vector u_, void *buffer,
                               BraidBufferStatus &bstatus) {
   int size;
-  int nchannels = network->getnChannels();
-  int nbatch = data->getnBatch();
   MyReal *dbuffer = (MyReal *)buffer;
   myBraidVector *u = (myBraidVector *)u_;
+  int nchannels = u->getnChannels();
+  int nbatch = getnBatch(u);
 
-  /* Store network state */
+  /* Store grid level and network state */
   int idx = 0;
+  dbuffer[idx] = u->getLevel();
+  idx++;
   for (int iex = 0; iex < nbatch; iex++) {
     for (int ic = 0; ic < nchannels; ic++) {
       dbuffer[idx] = u->getState(iex)[ic];
       idx++;
     }
   }
-  size = nchannels * nbatch * sizeof(MyReal);
+  size = (1 + nchannels * nbatch) * sizeof(MyReal);
 
-  int nweights = u->getLayer()->getnWeights();
-  int nbias = u->getLayer()->getDimBias();
 
   dbuffer[idx] = u->getLayer()->getType();
   idx++;
@@ -327,17 +950,20 @@ braid_Int myBraidApp::BufPack(braid_Vector u_, void *buffer,
   idx++;
   dbuffer[idx] = u->getLayer()->getCSize();
   idx++;
-  for (int i = 0; i < nweights; i++) {
-    dbuffer[idx] = u->getLayer()->getWeights()[i];
-    idx++;
-    // dbuffer[idx] = u->layer->getWeightsBar()[i];  idx++;
-  }
-  for (int i = 0; i < nbias; i++) {
-    dbuffer[idx] = u->getLayer()->getBias()[i];
+
+  /* Sparse layers send their pattern, followed by the nonzero weights only */
+  SparseDenseLayer *sparse = dynamic_cast<SparseDenseLayer *>(u->getLayer());
+  if (sparse != NULL) {
+    int npattern = sparse->getnPattern();
+    dbuffer[idx] = npattern;
     idx++;
-    // dbuffer[idx] = u->layer->getBiasBar()[i];  idx++;
+    if (npattern > 0) sparse->packPattern(&(dbuffer[idx]));
+    idx += npattern;
   }
-  size += (12 + (nweights + nbias)) * sizeof(MyReal);
+  int npacked = u->getLayer()->getnPacked();
+  u->getLayer()->packDesign(&(dbuffer[idx]), npacked);
+  idx += npacked;
+  size = idx * sizeof(MyReal);
 
   bstatus.SetSize(size);
 
@@ -349,14 +975,15 @@ braid_Int myBraidApp::BufUnpack(void *buffer, braid_Vector *u_ptr,
   Layer *tmplayer = 0;
   MyReal *dbuffer = (MyReal *)buffer;
 
-  int nchannels = network->getnChannels();
-  int nbatch = data->getnBatch();
-
-  /* Allocate a new vector */
-  myBraidVector *u = new myBraidVector(nchannels, nbatch);
+  /* Allocate a new vector on the grid level of the sent one */
+  int idx = 0;
+  int level = dbuffer[idx];
+  idx++;
+  myBraidVector *u = allocateVector(level);
+  int nchannels = u->getnChannels();
+  int nbatch = getnBatch(u);
 
   /* Unpack the buffer */
-  int idx = 0;
   for (int iex = 0; iex < nbatch; iex++) {
     for (int ic = 0; ic < nchannels; ic++) {
       u->getState(iex)[ic] = dbuffer[idx];
@@ -373,13 +1000,13 @@ braid_Int myBraidApp::BufUnpack(void *buffer, braid_Vector *u_ptr,
   idx++;
   int dimOut = dbuffer[idx];
   idx++;
-  int dimBias = dbuffer[idx];
+  /* Skip dimBias, it follows from the layer type */
   idx++;
   int nweights = dbuffer[idx];
   idx++;
   int activ = dbuffer[idx];
   idx++;
-  int nDesign = dbuffer[idx];
+  /* Skip nDesign, it follows from the layer */
   idx++;
   int gammatik = dbuffer[idx];
   idx++;
@@ -402,6 +1029,15 @@ braid_Int myBraidApp::BufUnpack(void *buffer, braid_Vector *u_ptr,
       tmplayer =
           new DenseLayer(index, dimIn, dimOut, 1.0, activ, gammatik, gammaddt);
       break;
+    case Layer::SPARSEDENSE:
+      tmplayer = new SparseDenseLayer(index, dimIn, dimOut, 1.0, activ,
+                                      gammatik, gammaddt);
+      break;
+    case Layer::LOWRANK:
+      tmplayer = new LowRankDenseLayer(index, dimIn, dimOut,
+                                       nweights / (dimIn + dimOut), 1.0, activ,
+                                       gammatik, gammaddt);
+      break;
     case Layer::CLASSIFICATION:
       tmplayer = new ClassificationLayer(index, dimIn, dimOut, gammatik);
       break;
@@ -419,19 +1055,23 @@ braid_Int myBraidApp::BufUnpack(void *buffer, braid_Vector *u_ptr,
       printf("\n\n ERROR while unpacking a buffer: Layertype unknown!!\n\n");
   }
 
-  /* Allocate design and gradient */
-  MyReal *design = new MyReal[nDesign];
-  MyReal *gradient = new MyReal[nDesign];
-  tmplayer->setMemory(design, gradient);
-  /* Set the weights */
-  for (int i = 0; i < nweights; i++) {
-    tmplayer->getWeights()[i] = dbuffer[idx];
-    idx++;
+  /* Allocate design and gradient, the sender belongs to the same processor
+   * of the channel group */
+  if (network->getChannelComm() != MPI_COMM_NULL) {
+    tmplayer->setChannelComm(network->getChannelComm());
   }
-  for (int i = 0; i < dimBias; i++) {
-    tmplayer->getBias()[i] = dbuffer[idx];
+  MyReal *design = new MyReal[tmplayer->getnDesignLocal()];
+  MyReal *gradient = new MyReal[tmplayer->getnDesignLocal()];
+  tmplayer->setMemory(design, gradient);
+  /* Set the pattern of sparse layers, and the weights */
+  SparseDenseLayer *sparse = dynamic_cast<SparseDenseLayer *>(tmplayer);
+  if (sparse != NULL) {
+    int npattern = dbuffer[idx];
     idx++;
+    if (npattern > 0) sparse->unpackPattern(&(dbuffer[idx]));
+    idx += npattern;
   }
+  tmplayer->unpackDesign(&(dbuffer[idx]));
   u->setLayer(tmplayer);
   u->setSendflag(1.0);
 
@@ -441,8 +1081,6 @@ braid_Int myBraidApp::BufUnpack(void *buffer, braid_Vector *u_ptr,
 }
 
 braid_Int myBraidApp::SetInitialCondition() {
-  Layer *openlayer = network->getLayer(-1);
-  int nbatch = data->getnBatch();
   braid_BaseVector ubase;
   myBraidVector *u;
 
@@ -458,13 +1096,7 @@ braid_Int myBraidApp::SetInitialCondition() {
       u = (myBraidVector *)ubase->userVector;
 
       /* Apply opening layer */
-      for (int iex = 0; iex < nbatch; iex++) {
-        /* set example */
-        openlayer->setExample(data->getExample(iex));
-
-        /* Apply the layer */
-        openlayer->applyFWD(u->getState(iex));
-      }
+      applyOpenLayer(u);
     }
   }
 
@@ -474,52 +1106,36 @@ braid_Int myBraidApp::SetInitialCondition() {
 braid_Int myBraidApp::EvaluateObjective() {
   braid_BaseVector ubase;
   myBraidVector *u;
-  Layer *layer;
   MyReal myobjective;
   MyReal regul;
 
-  /* Get range of locally stored layers */
-  int startlayerID = network->getStartLayerID();
-  int endlayerID = network->getEndLayerID();
-  if (startlayerID == 0)
-    startlayerID -=
-        1;  // this includes opening layer (id = -1) at first processor
-
-  /* Iterate over the local layers */
-  regul = 0.0;
-  for (int ilayer = startlayerID; ilayer <= endlayerID; ilayer++) {
-    /* Get the layer */
-    layer = network->getLayer(ilayer);
-
-    /* Tikhonov - Regularization*/
-    regul += layer->evalTikh();
-
-    /* DDT - Regularization on intermediate layers */
-    regul +=
-        layer->evalRegulDDT(network->getLayer(ilayer - 1), network->getDT());
-
-    /* At last layer: Classification and Loss evaluation */
-    if (ilayer == network->getnLayersGlobal() - 2) {
-      _braid_UGetLast(core->GetCore(), &ubase);
-      u = (myBraidVector *)ubase->userVector;
-      network->evalClassification(data, u->getState(), 0);
-    }
-    // printf("%d: layerid %d using %1.14e, tik %1.14e, ddt %1.14e, loss
-    // %1.14e\n", app->myid, layer->getIndex(), layer->getWeights()[0],
-    // regultik, regulddt, loss_loc);
+  /* Tikhonov and DDT regularization of the local layers */
+  regul = network->evalRegularization();
+
+  /* At last layer: Classification and Loss evaluation */
+  if (network->getEndLayerID() == network->getnLayersGlobal() - 2) {
+    _braid_UGetLast(core->GetCore(), &ubase);
+    u = (myBraidVector *)ubase->userVector;
+    network->evalClassification(data, u->getState(), 0);
+  }
+
+  /* Sum up the regularization of the split layers over the channel group */
+  if (network->getChannelComm() != MPI_COMM_NULL) {
+    MPI_Allreduce(MPI_IN_PLACE, &regul, 1, MPI_MyReal, MPI_SUM,
+                  network->getChannelComm());
   }
 
   /* Collect objective function from all processors */
   myobjective = network->getLoss() + regul;
   objective = 0.0;
-  MPI_Allreduce(&myobjective, &objective, 1, MPI_MyReal, MPI_SUM,
-                MPI_COMM_WORLD);
+  MPI_Allreduce(&myobjective, &objective, 1, MPI_MyReal, MPI_SUM, comm_t);
 
   return 0;
 }
 
 MyReal myBraidApp::run() {
   int nreq = -1;
+  int niter, nfirst = 1;
   MyReal norm;
 
   SetInitialCondition();
@@ -527,20 +1143,82 @@ MyReal myBraidApp::run() {
   EvaluateObjective();
   core->GetRNorms(&nreq, &norm);
 
+  /* Observed residual reduction per iteration */
+  core->GetNumIter(&niter);
+  core->GetRNorms(&nfirst, &rnorm_first);
+  convrate = 0.0;
+  if (niter > 1 && rnorm_first > 0.0 && norm > 0.0) {
+    convrate = pow(norm / rnorm_first, 1.0 / (niter - 1));
+  }
+
   return norm;
 }
 
+void myBraidApp::resetGrid() {
+  braid_BaseVector ubase;
+  myBraidVector *u;
+  int ilower, iupper;
+
+  /* Without warm restart, braid sets the initial guess in drive() */
+  if (!core->GetWarmRestart()) return;
+
+  GetGridDistribution(&ilower, &iupper);
+  for (int its = ilower; its <= iupper; its++) {
+    _braid_UGetVectorRef(core->GetCore(), 0, its, &ubase);
+    if (ubase == NULL) continue;
+    u = (myBraidVector *)ubase->userVector;
+    if (u->getState() == NULL) continue;  // shell vector
+    for (int iex = 0; iex < u->getnBatch(); iex++) {
+      vec_setZero(u->getnChannels(), u->getState(iex));
+    }
+  }
+}
+
+void myBraidApp::runChunked(MyReal *loss_ptr, MyReal *accuracy_ptr) {
+  MyReal loss = 0.0;
+  MyReal ncorrect = 0.0;
+  int nelements = 0;
+
+  for (int ichunk = 0; ichunk < data->getnChunks(); ichunk++) {
+    /* Set the chunk as current batch and propagate it */
+    data->selectChunk(ichunk);
+    if (data->getnChunks() > 1) resetGrid();
+    run();
+
+    /* Accumulate loss and number of correctly classified elements */
+    loss += network->getLoss() * data->getnBatch();
+    ncorrect += network->getAccuracy() / 100.0 * data->getnBatch();
+    nelements += data->getnBatch();
+  }
+
+  *loss_ptr = loss / nelements;
+  *accuracy_ptr = 100.0 * ncorrect / nelements;
+}
+
 /* ========================================================= */
 /* ========================================================= */
 /* ========================================================= */
 myAdjointBraidApp::myAdjointBraidApp(DataSet *Data, Network *Network,
-                                     Config *config, BraidCore *Primalcoreptr,
+                                     Config *config, myBraidApp *Primalapp,
                                      MPI_Comm comm)
     : myBraidApp(Data, Network, config, comm) {
-  primalcore = Primalcoreptr;
+  primalapp = Primalapp;
+  primalcore = primalapp->getCore();
+
+  if (config->braid_checkpointstride > 0) {
+    /* Store checkpoints only, recompute the primal points in between */
+    primalapp->setCheckpointing(config->braid_checkpointstride,
+                                config->braid_checkpointprecision);
+  } else if (config->braid_checkpointprecision != PREC_DOUBLE) {
+    /* Store all points, those that braid doesn't keep in reduced precision */
+    primalapp->setCheckpointing(1, config->braid_checkpointprecision);
+  } else {
+    /* Store all primal points */
+    primalcore->SetStorage(0);
+  }
 
-  /* Store all primal points */
-  primalcore->SetStorage(0);
+  /* Adjoint tolerance */
+  core->SetAbsTol(config->braid_abstoladj);
 
   /* Revert processor ranks for solving adjoint with xbraid */
   core->SetRevertedRanks(1);
@@ -560,13 +1238,14 @@ braid_Int myAdjointBraidApp::Step(braid_Vector u_, braid_Vector ustop_,
   int level, compute_gradient;
   MyReal tstart, tstop;
   MyReal deltaT;
-  int finegrid = 0;
   int primaltimestep;
-  braid_BaseVector ubaseprimal;
   myBraidVector *uprimal;
 
-  int nbatch = data->getnBatch();
   myBraidVector *u = (myBraidVector *)u_;
+  int nbatch = getnBatch(u);
+
+  /* Braid steps only vectors that carry a state */
+  assert(u->getState() != NULL);
 
   /* Update gradient only on the finest grid */
   pstatus.GetLevel(&level);
@@ -581,21 +1260,16 @@ braid_Int myAdjointBraidApp::Step(braid_Vector u_, braid_Vector ustop_,
   deltaT = tstop - tstart;
   primaltimestep = GetPrimalIndex(ts_stop);
 
-  /* Get the primal vector from the primal core */
-  _braid_UGetVectorRef(primalcore->GetCore(), finegrid, primaltimestep,
-                       &ubaseprimal);
-  uprimal = (myBraidVector *)ubaseprimal->userVector;
+  /* Get the primal vector from the primal app */
+  uprimal = primalapp->getState(primaltimestep);
 
   /* Reset gradient before the update */
-  if (compute_gradient) 
-      vec_setZero(uprimal->getLayer()->getnDesign(), uprimal->getLayer()->getWeightsBar());
+  if (compute_gradient) uprimal->getLayer()->resetGradient();
 
   /* Take one step backwards, updates adjoint state and gradient, if desired. */
   uprimal->getLayer()->setDt(deltaT);
-  for (int iex = 0; iex < nbatch; iex++) {
-    uprimal->getLayer()->applyBWD(uprimal->getState(iex), u->getState(iex),
-                                  compute_gradient);
-  }
+  uprimal->getLayer()->applyBWDBatch(uprimal->getState(), u->getState(),
+                                     nbatch, compute_gradient);
 
   // printf("%d: level %d step_adj %d->%d using layer %d,%1.14e, primal %1.14e,
   // adj %1.14e, grad[0] %1.14e, %d\n", app->myid, level, ts_stop,
@@ -621,7 +1295,6 @@ braid_Int myAdjointBraidApp::Step(braid_Vector u_, braid_Vector ustop_,
 
 braid_Int myAdjointBraidApp::Init(braid_Real t, braid_Vector *u_ptr) {
   int nchannels = network->getnChannels();
-  int nbatch = data->getnBatch();
 
   braid_BaseVector ubaseprimal;
   myBraidVector *uprimal;
@@ -629,8 +1302,8 @@ braid_Int myAdjointBraidApp::Init(braid_Real t, braid_Vector *u_ptr) {
   // printf("%d: Init %d (primaltimestep %d)\n", app->myid, ilayer,
   // primaltimestep);
 
-  /* Allocate the adjoint vector and set to zero */
-  myBraidVector *u = new myBraidVector(nchannels, nbatch);
+  /* Allocate the adjoint vector for the largest chunk and set to zero */
+  myBraidVector *u = new myBraidVector(nchannels, data->getnBatchMax());
 
   /* Adjoint initial (i.e. terminal) condition is derivative of classification
    * layer */
@@ -640,7 +1313,7 @@ braid_Int myAdjointBraidApp::Init(braid_Real t, braid_Vector *u_ptr) {
     uprimal = (myBraidVector *)ubaseprimal->userVector;
 
     /* Reset the gradient before updating it */
-    vec_setZero(uprimal->getLayer()->getnDesign(), uprimal->getLayer()->getWeightsBar());
+    uprimal->getLayer()->resetGradient();
 
     /* Derivative of classification */
     network->evalClassification_diff(data, uprimal->getState(), u->getState(),
@@ -660,6 +1333,14 @@ braid_Int myAdjointBraidApp::Init(braid_Real t, braid_Vector *u_ptr) {
   return 0;
 }
 
+braid_Int myAdjointBraidApp::SInit(braid_Real t, braid_Vector *u_ptr) {
+  myBraidVector *u = new myBraidVector(network->getnChannels(), 0);
+
+  *u_ptr = (braid_Vector)u;
+
+  return 0;
+}
+
 braid_Int myAdjointBraidApp::BufSize(braid_Int *size_ptr,
                                      BraidBufferStatus &bstatus) {
   int nchannels = network->getnChannels();
@@ -672,10 +1353,10 @@ braid_Int myAdjointBraidApp::BufSize(braid_Int *size_ptr,
 braid_Int myAdjointBraidApp::BufPack(braid_Vector u_, void *buffer,
                                      BraidBufferStatus &bstatus) {
   int size;
-  int nchannels = network->getnChannels();
-  int nbatch = data->getnBatch();
   MyReal *dbuffer = (MyReal *)buffer;
   myBraidVector *u = (myBraidVector *)u_;
+  int nchannels = u->getnChannels();
+  int nbatch = getnBatch(u);
 
   /* Store network state */
   int idx = 0;
@@ -694,11 +1375,11 @@ braid_Int myAdjointBraidApp::BufPack(braid_Vector u_, void *buffer,
 braid_Int myAdjointBraidApp::BufUnpack(void *buffer, braid_Vector *u_ptr,
                                        BraidBufferStatus &bstatus) {
   int nchannels = network->getnChannels();
-  int nbatch = data->getnBatch();
   MyReal *dbuffer = (MyReal *)buffer;
 
   /* Allocate the vector */
-  myBraidVector *u = new myBraidVector(nchannels, nbatch);
+  myBraidVector *u = new myBraidVector(nchannels, data->getnBatchMax());
+  int nbatch = getnBatch(u);
 
   /* Unpack the buffer */
   int idx = 0;
@@ -740,7 +1421,7 @@ braid_Int myAdjointBraidApp::SetInitialCondition() {
       uadjoint = (myBraidVector *)ubaseadjoint->userVector;
 
       /* Reset the gradient before updating it */
-      vec_setZero(uprimal->getLayer()->getnDesign(), uprimal->getLayer()->getWeightsBar());
+      uprimal->getLayer()->resetGradient();
 
       // printf("%d: objective_diff at ilayer %d using %1.14e primal %1.14e\n",
       // app->myid, uprimal->layer->getIndex(), uprimal->layer->getWeights()[0],
@@ -772,7 +1453,7 @@ braid_Int myAdjointBraidApp::EvaluateObjective() {
     uadjoint = (myBraidVector *)ubase->userVector;
 
     /* Reset the gradient */
-    vec_setZero(openlayer->getnDesign(), openlayer->getWeightsBar());
+    openlayer->resetGradient();
 
     /* Apply opening layer backwards for all examples */
     for (int iex = 0; iex < nbatch; iex++) {
@@ -0,0 +1,201 @@
+// Copyright
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Underlying paper:
+//
+// Layer-Parallel Training of Deep Residual Neural Networks
+// S. Guenther, L. Ruthotto, J.B. Schroder, E.C. Czr, and N.R. Gauger
+//
+// Download: https://arxiv.org/pdf/1812.04352.pdf
+//
+#include "checkpoint.hpp"
+
+#define CHECKPOINT_MAGIC 0x4C50434B50540002LL /* File identifier + version */
+#define CHECKPOINT_NCHECK 9   /* Header entries that must match on restart */
+#define CHECKPOINT_NHEADER 12
+
+/* Fill the header entries that must match on restart */
+static void checkpointHeader(long long *header, Config *config,
+                             Network *network) {
+  header[0] = CHECKPOINT_MAGIC;
+  header[1] = sizeof(MyReal);
+  header[2] = config->nlayers;
+  header[3] = config->nchannels;
+  header[4] = config->network_type;
+  header[5] = network->getnDesignGlobal();
+  header[6] = config->hessianapprox_type;
+  header[7] = config->lbfgs_stages;
+  header[8] = -1;
+  if (network->getnBasis() > 0) {
+    header[5] = network->getnCoefficientsGlobal();
+    header[8] = config->weights_basis;
+  }
+}
+
+/* The design of the optimization: the design of the network, or the
+ * coefficients of its basis in time */
+static void checkpointDesign(Network *network, MyReal **design_ptr,
+                             MyReal **gradient_ptr, long long *ndesign_ptr,
+                             MPI_Datatype *designtype_ptr,
+                             int *ndesign_local_ptr) {
+  if (network->getnBasis() > 0) {
+    *design_ptr = network->getCoefficients();
+    *gradient_ptr = network->getCoefficientsGradient();
+    *ndesign_ptr = network->getnCoefficientsGlobal();
+    *designtype_ptr = network->getCoefficientsType();
+    *ndesign_local_ptr = network->getnCoefficientsLocal();
+  } else {
+    *design_ptr = network->getDesign();
+    *gradient_ptr = network->getGradient();
+    *ndesign_ptr = network->getnDesignGlobal();
+    *designtype_ptr = network->getDesignType();
+    *ndesign_local_ptr = network->getnDesignLocal();
+  }
+}
+
+int writeCheckpoint(const char *filename, Config *config, Network *network,
+                    HessianApprox *hessian, DataSet *data, int iter,
+                    int ls_iter, MyReal stepsize, MyReal gnorm, int write,
+                    MPI_Comm comm) {
+  MPI_File fh;
+  MPI_Status status;
+  MPI_Offset offset;
+  char tmpname[255];
+  long long header[CHECKPOINT_NHEADER];
+  MyReal scalars[2];
+  int myid, err;
+  MPI_Comm_rank(comm, &myid);
+
+  MyReal *design, *gradient;
+  long long ndesign;
+  MPI_Datatype designtype;
+  int ndesign_local;
+  checkpointDesign(network, &design, &gradient, &ndesign, &designtype,
+                   &ndesign_local);
+
+  sprintf(tmpname, "%s.tmp", filename);
+  err = MPI_File_open(comm, tmpname, MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                      MPI_INFO_NULL, &fh);
+  if (err != MPI_SUCCESS) {
+    if (myid == 0) printf("ERROR: Can't open checkpoint file %s!\n", tmpname);
+    return -1;
+  }
+  MPI_File_set_size(fh, 0);
+
+  /* Header, written by the first processor */
+  checkpointHeader(header, config, network);
+  header[9] = iter;
+  header[10] = ls_iter;
+  header[11] = data->getnSelected();
+  scalars[0] = stepsize;
+  scalars[1] = gnorm;
+  MPI_File_write_at_all(fh, 0, header, (myid == 0) ? CHECKPOINT_NHEADER : 0,
+                        MPI_LONG_LONG, &status);
+  offset = CHECKPOINT_NHEADER * sizeof(long long);
+  MPI_WriteVector(fh, offset, scalars, 2, 0, myid == 0);
+  offset += 2 * sizeof(MyReal);
+
+  /* Design and gradient */
+  MPI_WriteVectorView(fh, offset, design, ndesign_local, designtype, write);
+  offset += ndesign * sizeof(MyReal);
+  MPI_WriteVectorView(fh, offset, gradient, ndesign_local, designtype, write);
+  offset += ndesign * sizeof(MyReal);
+
+  /* Memory of the Hessian approximation */
+  hessian->writeMemory(fh, &offset, designtype, write);
+
+  MPI_File_close(&fh);
+
+  /* Replace the previous checkpoint */
+  err = 0;
+  if (myid == 0) err = rename(tmpname, filename);
+  MPI_Bcast(&err, 1, MPI_INT, 0, comm);
+  if (err) {
+    if (myid == 0) printf("ERROR: Can't rename %s to %s!\n", tmpname, filename);
+    return -1;
+  }
+
+  return 0;
+}
+
+int readCheckpoint(const char *filename, Config *config, Network *network,
+                   HessianApprox *hessian, DataSet *data, int *iter_ptr,
+                   int *ls_iter_ptr, MyReal *stepsize_ptr, MyReal *gnorm_ptr,
+                   MPI_Comm comm) {
+  MPI_File fh;
+  MPI_Status status;
+  MPI_Offset offset;
+  long long header[CHECKPOINT_NHEADER];
+  long long expected[CHECKPOINT_NHEADER];
+  MyReal scalars[2];
+  int myid, err;
+  MPI_Comm_rank(comm, &myid);
+
+  MyReal *design, *gradient;
+  long long ndesign;
+  MPI_Datatype designtype;
+  int ndesign_local;
+  checkpointDesign(network, &design, &gradient, &ndesign, &designtype,
+                   &ndesign_local);
+
+  err = MPI_File_open(comm, (char *)filename, MPI_MODE_RDONLY, MPI_INFO_NULL,
+                      &fh);
+  if (err != MPI_SUCCESS) {
+    if (myid == 0) printf("ERROR: Can't open checkpoint file %s!\n", filename);
+    return -1;
+  }
+
+  /* Check that the checkpoint belongs to this configuration */
+  MPI_File_read_at_all(fh, 0, header, CHECKPOINT_NHEADER, MPI_LONG_LONG,
+                       &status);
+  checkpointHeader(expected, config, network);
+  for (int i = 0; i < CHECKPOINT_NCHECK; i++) {
+    /* The L-BFGS stages only matter for L-BFGS */
+    if (i == 7 && config->hessianapprox_type != LBFGS) continue;
+    if (header[i] != expected[i]) {
+      if (myid == 0)
+        printf("ERROR: Checkpoint %s doesn't match the configuration!\n",
+               filename);
+      MPI_File_close(&fh);
+      return -1;
+    }
+  }
+  offset = CHECKPOINT_NHEADER * sizeof(long long);
+  MPI_ReadVector(fh, offset, scalars, 2, 0);
+  offset += 2 * sizeof(MyReal);
+
+  /* Design and gradient */
+  MPI_ReadVectorView(fh, offset, design, ndesign_local, designtype);
+  offset += ndesign * sizeof(MyReal);
+  MPI_ReadVectorView(fh, offset, gradient, ndesign_local, designtype);
+  offset += ndesign * sizeof(MyReal);
+
+  /* Memory of the Hessian approximation */
+  err = hessian->readMemory(fh, &offset, designtype);
+  MPI_Allreduce(MPI_IN_PLACE, &err, 1, MPI_INT, MPI_MIN, comm);
+  MPI_File_close(&fh);
+  if (err) return -1;
+
+  *iter_ptr = header[9];
+  *ls_iter_ptr = header[10];
+  data->skipBatches(header[11]);
+  *stepsize_ptr = scalars[0];
+  *gnorm_ptr = scalars[1];
+
+  /* Communicate the neighbours across processors */
+  if (network->getnBasis() > 0) network->setDesignFromCoefficients();
+  network->MPI_CommunicateNeighbours();
+
+  return 0;
+}
@@ -36,6 +36,8 @@ Config::Config() {
   fval_labels = "NONE";
   weightsopenfile = "NONE";
   weightsclassificationfile = "NONE";
+  modelfile_in = "NONE";
+  modelfile_out = "NONE";
 
   ntraining = 5000;
   nvalidation = 200;
@@ -52,6 +54,12 @@ Config::Config() {
   weights_open_init = 0.001;
   weights_init = 0.0;
   weights_class_init = 0.001;
+  weights_rng = RNG_SERIAL;
+  pruning = 0.0;
+  pruning_iter = 0;
+  lowrank = 0;
+  weights_nbasis = 0;
+  weights_basis = BASIS_LINEAR;
 
   /* XBraid */
   braid_cfactor0 = 4;
@@ -61,16 +69,27 @@ Config::Config() {
   braid_maxiter = 3;
   braid_abstol = 1e-10;
   braid_abstoladj = 1e-06;
+  braid_adaptivetol = 0.0;
+  braid_oneshot = 0;
   braid_printlevel = 1;
   braid_accesslevel = 0;
   braid_setskip = 0;
   braid_fmg = 0;
   braid_nrelax0 = 1;
+  braid_batchcoarsen = 1;
+  braid_channelcoarsen = 1;
+  braid_shell = 0;
   braid_nrelax = 1;
+  braid_checkpointstride = 0;
+  braid_checkpointprecision = PREC_DOUBLE;
+  braid_checkpointcheck = 0;
 
   /* Optimization */
   batch_type = DETERMINISTIC;
   nbatch = ntraining;  // full batch
+  nmicrobatches = 1;
+  ndatagroups = 1;
+  nchannelsplit = 1;
   gamma_tik = 1e-07;
   gamma_ddt = 1e-07;
   gamma_class = 1e-07;
@@ -80,9 +99,17 @@ Config::Config() {
   gtol = 1e-08;
   ls_maxiter = 20;
   ls_factor = 0.5;
+  ls_nparallel = 1;
   hessianapprox_type = LBFGS;
   lbfgs_stages = 20;
   validationlevel = 1;
+  validation_type = XBRAID;
+  validation_chunksize = 100;
+
+  /* Checkpoint / restart */
+  checkpoint_interval = 0;
+  checkpoint_file = "checkpoint.bin";
+  restart = 0;
 }
 
 Config::~Config() {}
@@ -123,6 +150,10 @@ int Config::readFromFile(char *configfilename) {
     }
     if (strcmp(co->key, "weightsclassificationfile") == 0) {
       weightsclassificationfile = co->value;
+    } else if (strcmp(co->key, "modelfile_in") == 0) {
+      modelfile_in = co->value;
+    } else if (strcmp(co->key, "modelfile_out") == 0) {
+      modelfile_out = co->value;
     } else if (strcmp(co->key, "nlayers") == 0) {
       nlayers = atoi(co->value);
 
@@ -169,6 +200,18 @@ int Config::readFromFile(char *configfilename) {
       braid_abstol = atof(co->value);
     } else if (strcmp(co->key, "braid_adjtol") == 0) {
       braid_abstoladj = atof(co->value);
+    } else if (strcmp(co->key, "braid_adaptivetol") == 0) {
+      braid_adaptivetol = atof(co->value);
+      if (braid_adaptivetol < 0.0) {
+        printf("Invalid braid_adaptivetol! Choose a non-negative factor!");
+        return -1;
+      }
+    } else if (strcmp(co->key, "braid_oneshot") == 0) {
+      braid_oneshot = atoi(co->value);
+      if (braid_oneshot < 0) {
+        printf("Invalid braid_oneshot! Choose a non-negative number of cycles!");
+        return -1;
+      }
     } else if (strcmp(co->key, "braid_printlevel") == 0) {
       braid_printlevel = atoi(co->value);
     } else if (strcmp(co->key, "braid_accesslevel") == 0) {
@@ -181,6 +224,45 @@ int Config::readFromFile(char *configfilename) {
       braid_nrelax = atoi(co->value);
     } else if (strcmp(co->key, "braid_nrelax0") == 0) {
       braid_nrelax0 = atoi(co->value);
+    } else if (strcmp(co->key, "braid_batchcoarsen") == 0) {
+      braid_batchcoarsen = atoi(co->value);
+      if (braid_batchcoarsen < 1) {
+        printf("Invalid braid_batchcoarsen! Choose a factor of at least one!");
+        return -1;
+      }
+    } else if (strcmp(co->key, "braid_channelcoarsen") == 0) {
+      braid_channelcoarsen = atoi(co->value);
+      if (braid_channelcoarsen < 1) {
+        printf("Invalid braid_channelcoarsen! Choose a factor of at least one!");
+        return -1;
+      }
+    } else if (strcmp(co->key, "braid_shell") == 0) {
+      braid_shell = atoi(co->value);
+    } else if (strcmp(co->key, "braid_checkpointstride") == 0) {
+      braid_checkpointstride = atoi(co->value);
+      if (braid_checkpointstride < 0) {
+        printf("ERROR: braid_checkpointstride must not be negative!\n");
+        return -1;
+      }
+    } else if (strcmp(co->key, "braid_checkpointprecision") == 0) {
+      if (strcmp(co->value, "double") == 0) {
+        braid_checkpointprecision = PREC_DOUBLE;
+      } else if (strcmp(co->value, "float") == 0) {
+        braid_checkpointprecision = PREC_FLOAT;
+      } else if (strcmp(co->value, "bfloat16") == 0) {
+        braid_checkpointprecision = PREC_BFLOAT16;
+      } else {
+        printf(
+            "Invalid checkpoint precision! Should be either 'double', "
+            "'float' or 'bfloat16'!");
+        return -1;
+      }
+    } else if (strcmp(co->key, "braid_checkpointcheck") == 0) {
+      braid_checkpointcheck = atoi(co->value);
+      if (braid_checkpointcheck < 0) {
+        printf("ERROR: braid_checkpointcheck must not be negative!\n");
+        return -1;
+      }
     } else if (strcmp(co->key, "batch_type") == 0) {
       if (strcmp(co->value, "deterministic") == 0) {
         batch_type = DETERMINISTIC;
@@ -194,6 +276,24 @@ int Config::readFromFile(char *configfilename) {
       }
     } else if (strcmp(co->key, "nbatch") == 0) {
       nbatch = atoi(co->value);
+    } else if (strcmp(co->key, "nmicrobatches") == 0) {
+      nmicrobatches = atoi(co->value);
+      if (nmicrobatches < 1) {
+        printf("Invalid nmicrobatches! Choose at least one micro-batch!");
+        return -1;
+      }
+    } else if (strcmp(co->key, "ndatagroups") == 0) {
+      ndatagroups = atoi(co->value);
+      if (ndatagroups < 1) {
+        printf("Invalid ndatagroups! Choose at least one data group!");
+        return -1;
+      }
+    } else if (strcmp(co->key, "nchannelsplit") == 0) {
+      nchannelsplit = atoi(co->value);
+      if (nchannelsplit < 1) {
+        printf("Invalid nchannelsplit! Choose at least one processor!");
+        return -1;
+      }
     } else if (strcmp(co->key, "gamma_tik") == 0) {
       gamma_tik = atof(co->value);
     } else if (strcmp(co->key, "gamma_ddt") == 0) {
@@ -223,6 +323,12 @@ int Config::readFromFile(char *configfilename) {
       ls_maxiter = atoi(co->value);
     } else if (strcmp(co->key, "ls_factor") == 0) {
       ls_factor = atof(co->value);
+    } else if (strcmp(co->key, "ls_nparallel") == 0) {
+      ls_nparallel = atoi(co->value);
+      if (ls_nparallel < 1) {
+        printf("Invalid ls_nparallel! Evaluate at least one stepsize!");
+        return -1;
+      }
     } else if (strcmp(co->key, "weights_open_init") == 0) {
       weights_open_init = atof(co->value);
     } else if (strcmp(co->key, "type_openlayer") == 0) {
@@ -239,6 +345,46 @@ int Config::readFromFile(char *configfilename) {
       weights_init = atof(co->value);
     } else if (strcmp(co->key, "weights_class_init") == 0) {
       weights_class_init = atof(co->value);
+    } else if (strcmp(co->key, "weights_rng") == 0) {
+      if (strcmp(co->value, "serial") == 0) {
+        weights_rng = RNG_SERIAL;
+      } else if (strcmp(co->value, "counter") == 0) {
+        weights_rng = RNG_COUNTER;
+      } else {
+        printf("Invalid weights_rng! Should be either 'serial' or "
+               "'counter'!");
+        return -1;
+      }
+    } else if (strcmp(co->key, "pruning") == 0) {
+      pruning = atof(co->value);
+      if (pruning < 0.0 || pruning >= 1.0) {
+        printf("Invalid pruning! Choose a fraction in [0,1)!");
+        return -1;
+      }
+    } else if (strcmp(co->key, "pruning_iter") == 0) {
+      pruning_iter = atoi(co->value);
+    } else if (strcmp(co->key, "lowrank") == 0) {
+      lowrank = atoi(co->value);
+      if (lowrank < 0) {
+        printf("Invalid lowrank! Choose a rank >= 0!");
+        return -1;
+      }
+    } else if (strcmp(co->key, "weights_nbasis") == 0) {
+      weights_nbasis = atoi(co->value);
+      if (weights_nbasis < 0) {
+        printf("Invalid weights_nbasis! Choose a number >= 0!");
+        return -1;
+      }
+    } else if (strcmp(co->key, "weights_basis") == 0) {
+      if (strcmp(co->value, "linear") == 0) {
+        weights_basis = BASIS_LINEAR;
+      } else if (strcmp(co->value, "cubic") == 0) {
+        weights_basis = BASIS_CUBIC;
+      } else {
+        printf("Invalid weights_basis! Should be either 'linear' or "
+               "'cubic'!");
+        return -1;
+      }
     } else if (strcmp(co->key, "hessian_approx") == 0) {
       if (strcmp(co->value, "BFGS") == 0) {
         hessianapprox_type = BFGS_SERIAL;
@@ -254,6 +400,24 @@ int Config::readFromFile(char *configfilename) {
       lbfgs_stages = atoi(co->value);
     } else if (strcmp(co->key, "validationlevel") == 0) {
       validationlevel = atoi(co->value);
+    } else if (strcmp(co->key, "validation_type") == 0) {
+      if (strcmp(co->value, "xbraid") == 0) {
+        validation_type = XBRAID;
+      } else if (strcmp(co->value, "forward") == 0) {
+        validation_type = FORWARD;
+      } else {
+        printf("Invalid validation type! Should be either 'xbraid' or "
+               "'forward'!");
+        return -1;
+      }
+    } else if (strcmp(co->key, "validation_chunksize") == 0) {
+      validation_chunksize = atoi(co->value);
+    } else if (strcmp(co->key, "checkpoint_interval") == 0) {
+      checkpoint_interval = atoi(co->value);
+    } else if (strcmp(co->key, "checkpoint_file") == 0) {
+      checkpoint_file = co->value;
+    } else if (strcmp(co->key, "restart") == 0) {
+      restart = atoi(co->value);
     }
     if (co->prev != NULL) {
       co = co->prev;
@@ -314,7 +478,8 @@ Config::config_option *Config::parsefile(char *path) {
 
 int Config::writeToFile(FILE *outfile) {
   const char *activname, *networktypename, *hessetypename, *optimtypename,
-      *stepsizetypename;
+      *stepsizetypename, *validationtypename, *precisionname, *rngname,
+      *basisname;
 
   /* Get names of some int options */
   switch (activation) {
@@ -376,6 +541,49 @@ int Config::writeToFile(FILE *outfile) {
     default:
       stepsizetypename = "invalid!";
   }
+  switch (validation_type) {
+    case XBRAID:
+      validationtypename = "xbraid";
+      break;
+    case FORWARD:
+      validationtypename = "forward";
+      break;
+    default:
+      validationtypename = "invalid!";
+  }
+  switch (braid_checkpointprecision) {
+    case PREC_DOUBLE:
+      precisionname = "double";
+      break;
+    case PREC_FLOAT:
+      precisionname = "float";
+      break;
+    case PREC_BFLOAT16:
+      precisionname = "bfloat16";
+      break;
+    default:
+      precisionname = "invalid!";
+  }
+  switch (weights_rng) {
+    case RNG_SERIAL:
+      rngname = "serial";
+      break;
+    case RNG_COUNTER:
+      rngname = "counter";
+      break;
+    default:
+      rngname = "invalid!";
+  }
+  switch (weights_basis) {
+    case BASIS_LINEAR:
+      basisname = "linear";
+      break;
+    case BASIS_CUBIC:
+      basisname = "cubic";
+      break;
+    default:
+      basisname = "invalid!";
+  }
 
   /* print config option */
   fprintf(outfile, "# Problem setup: datafolder           %s \n", datafolder);
@@ -384,6 +592,9 @@ int Config::writeToFile(FILE *outfile) {
           ftrain_labels);
   fprintf(outfile, "#                validation examples  %s \n", fval_ex);
   fprintf(outfile, "#                validation labels    %s \n", fval_labels);
+  fprintf(outfile, "#                model file (in)      %s \n", modelfile_in);
+  fprintf(outfile, "#                model file (out)     %s \n",
+          modelfile_out);
   fprintf(outfile, "#                ntraining            %d \n", ntraining);
   fprintf(outfile, "#                nvalidation          %d \n", nvalidation);
   fprintf(outfile, "#                nfeatures            %d \n", nfeatures);
@@ -396,6 +607,12 @@ int Config::writeToFile(FILE *outfile) {
   fprintf(outfile, "#                Activation           %s \n", activname);
   fprintf(outfile, "#                openlayer type       %d \n",
           openlayer_type);
+  fprintf(outfile, "#                pruning              %f \n", pruning);
+  fprintf(outfile, "#                pruning iter         %d \n", pruning_iter);
+  fprintf(outfile, "#                lowrank              %d \n", lowrank);
+  fprintf(outfile, "#                weights nbasis       %d \n",
+          weights_nbasis);
+  fprintf(outfile, "#                weights basis        %s \n", basisname);
   fprintf(outfile, "# XBraid setup:  max levels           %d \n",
           braid_maxlevels);
   fprintf(outfile, "#                min coarse           %d \n",
@@ -410,6 +627,10 @@ int Config::writeToFile(FILE *outfile) {
           braid_abstol);
   fprintf(outfile, "#                abs. toladj          %1.e \n",
           braid_abstoladj);
+  fprintf(outfile, "#                adaptive tol         %1.e \n",
+          braid_adaptivetol);
+  fprintf(outfile, "#                one-shot cycles      %d \n",
+          braid_oneshot);
   fprintf(outfile, "#                print level          %d \n",
           braid_printlevel);
   fprintf(outfile, "#                access level         %d \n",
@@ -420,9 +641,25 @@ int Config::writeToFile(FILE *outfile) {
   fprintf(outfile, "#                nrelax (level 0)     %d \n",
           braid_nrelax0);
   fprintf(outfile, "#                nrelax               %d \n", braid_nrelax);
+  fprintf(outfile, "#                batch coarsening     %d \n",
+          braid_batchcoarsen);
+  fprintf(outfile, "#                channel coarsening   %d \n",
+          braid_channelcoarsen);
+  fprintf(outfile, "#                shell vectors        %d \n", braid_shell);
+  fprintf(outfile, "#                checkpoint stride    %d \n",
+          braid_checkpointstride);
+  fprintf(outfile, "#                checkpoint precision %s \n",
+          precisionname);
+  fprintf(outfile, "#                checkpoint check     %d \n",
+          braid_checkpointcheck);
   fprintf(outfile, "# Optimization:  optimization type    %s \n",
           optimtypename);
   fprintf(outfile, "#                nbatch               %d \n", nbatch);
+  fprintf(outfile, "#                nmicrobatches        %d \n",
+          nmicrobatches);
+  fprintf(outfile, "#                ndatagroups          %d \n", ndatagroups);
+  fprintf(outfile, "#                nchannelsplit        %d \n",
+          nchannelsplit);
   fprintf(outfile, "#                gamma_tik            %1.e \n", gamma_tik);
   fprintf(outfile, "#                gamma_ddt            %1.e \n", gamma_ddt);
   fprintf(outfile, "#                gamma_class          %1.e \n",
@@ -435,16 +672,27 @@ int Config::writeToFile(FILE *outfile) {
   fprintf(outfile, "#                gtol                 %1.e \n", gtol);
   fprintf(outfile, "#                max. ls iter         %d \n", ls_maxiter);
   fprintf(outfile, "#                ls factor            %f \n", ls_factor);
+  fprintf(outfile, "#                ls parallel steps    %d \n", ls_nparallel);
   fprintf(outfile, "#                weights_init         %f \n", weights_init);
   fprintf(outfile, "#                weights_open_init    %f \n",
           weights_open_init);
   fprintf(outfile, "#                weights_class_init   %f \n",
           weights_class_init);
+  fprintf(outfile, "#                weights_rng          %s \n", rngname);
   fprintf(outfile, "#                hessianapprox_type   %s \n",
           hessetypename);
   fprintf(outfile, "#                lbfgs_stages         %d \n", lbfgs_stages);
   fprintf(outfile, "#                validationlevel      %d \n",
           validationlevel);
+  fprintf(outfile, "#                validation type      %s \n",
+          validationtypename);
+  fprintf(outfile, "#                validation chunksize %d \n",
+          validation_chunksize);
+  fprintf(outfile, "# Checkpoint:    interval             %d \n",
+          checkpoint_interval);
+  fprintf(outfile, "#                file                 %s \n",
+          checkpoint_file);
+  fprintf(outfile, "#                restart              %d \n", restart);
   fprintf(outfile, "\n");
 
   return 0;
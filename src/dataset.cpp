@@ -25,51 +25,68 @@ DataSet::DataSet() {
   nelements = 0;
   nfeatures = 0;
   nlabels = 0;
+  nbatchglobal = 0;
   nbatch = 0;
+  batchfirst = 0;
+  chunksize = 0;
+  chunkfirst = 0;
+  nchunk = 0;
   MPIsize = 0;
   MPIrank = 0;
+  datacomm = MPI_COMM_NULL;
+  datarank = 0;
+  channelcomm = MPI_COMM_NULL;
+  channelrank = 0;
   navail = 0;
+  nselected = 0;
 
   examples = NULL;
   labels = NULL;
+  nslicestored = 0;
   batchIDs = NULL;
   availIDs = NULL;
 }
 
 void DataSet::initialize(int nElements, int nFeatures, int nLabels, int nBatch,
-                         MPI_Comm comm) {
+                         MPI_Comm comm, MPI_Comm DataComm) {
+  int ndatagroups;
+
   nelements = nElements;
   nfeatures = nFeatures;
   nlabels = nLabels;
-  nbatch = nBatch;
+  nbatchglobal = nBatch;
   navail = nelements;
 
   MPI_Comm_rank(comm, &MPIrank);
   MPI_Comm_size(comm, &MPIsize);
+  datacomm = DataComm;
+  MPI_Comm_rank(datacomm, &datarank);
+  MPI_Comm_size(datacomm, &ndatagroups);
 
   /* Sanity check */
-  if (nbatch > nelements) nbatch = nelements;
+  if (nbatchglobal > nelements) nbatchglobal = nelements;
+
+  /* Slice of the batch for this data group, don't split it into chunks */
+  chunksize = nbatchglobal;
+  splitBatch(ndatagroups, datarank);
+  chunksize = nbatch;
 
-  /* Allocate feature vectors on first processor */
+  /* Feature vectors on first processor and label vectors on last processor,
+   * allocated by storeSlice() or readData() */
   if (MPIrank == 0) {
     examples = new MyReal *[nelements];
-    for (int ielem = 0; ielem < nelements; ielem++) {
-      examples[ielem] = new MyReal[nfeatures];
-    }
+    for (int ielem = 0; ielem < nelements; ielem++) examples[ielem] = NULL;
   }
-  /* Allocate label vectors on last processor */
   if (MPIrank == MPIsize - 1) {
     labels = new MyReal *[nelements];
-    for (int ielem = 0; ielem < nelements; ielem++) {
-      labels[ielem] = new MyReal[nlabels];
-    }
+    for (int ielem = 0; ielem < nelements; ielem++) labels[ielem] = NULL;
   }
 
   /* Allocate and initialize availIDs and batchIDs on first and last processor
    */
   if (MPIrank == 0 || MPIrank == MPIsize - 1) {
     availIDs = new int[nelements];  // all elements
-    batchIDs = new int[nbatch];
+    batchIDs = new int[nbatchglobal];
 
     /* Initialize available ID with identity */
     for (int idx = 0; idx < nelements; idx++) {
@@ -77,7 +94,7 @@ void DataSet::initialize(int nElements, int nFeatures, int nLabels, int nBatch,
     }
 
     /* Initialize the batch with identity */
-    for (int idx = 0; idx < nbatch; idx++) {
+    for (int idx = 0; idx < nbatchglobal; idx++) {
       batchIDs[idx] = idx;
     }
   }
@@ -87,7 +104,7 @@ DataSet::~DataSet() {
   /* Deallocate feature vectors on first processor */
   if (examples != NULL) {
     for (int ielem = 0; ielem < nelements; ielem++) {
-      delete[] examples[ielem];
+      if (examples[ielem] != NULL) delete[] examples[ielem];
     }
     delete[] examples;
   }
@@ -95,7 +112,7 @@ DataSet::~DataSet() {
   /* Deallocate label vectors on last processor */
   if (labels != NULL) {
     for (int ielem = 0; ielem < nelements; ielem++) {
-      delete[] labels[ielem];
+      if (labels[ielem] != NULL) delete[] labels[ielem];
     }
     delete[] labels;
   }
@@ -104,24 +121,91 @@ DataSet::~DataSet() {
   if (batchIDs != NULL) delete[] batchIDs;
 }
 
-int DataSet::getnBatch() { return nbatch; }
+void DataSet::setChannelComm(MPI_Comm ChannelComm) {
+  channelcomm = ChannelComm;
+  MPI_Comm_rank(channelcomm, &channelrank);
+}
+
+void DataSet::splitBatch(int nslices, int islice) {
+  batchfirst = (islice * nbatchglobal) / nslices;
+  nbatch = ((islice + 1) * nbatchglobal) / nslices - batchfirst;
+
+  selectChunk(0);
+}
+
+int DataSet::getnBatch() { return nchunk; }
+
+int DataSet::getnBatchGlobal() { return nbatchglobal; }
+
+int DataSet::getnBatchMax() { return chunksize; }
+
+int DataSet::getnSlice() { return nbatch; }
+
+int DataSet::getChunkFirst() { return chunkfirst; }
+
+int DataSet::getnChunks() { return (nbatch + chunksize - 1) / chunksize; }
+
+void DataSet::setChunkSize(int ChunkSize) {
+  chunksize = ChunkSize;
+  if (chunksize <= 0 || chunksize > nbatch) chunksize = nbatch;
+
+  selectChunk(0);
+}
+
+void DataSet::selectChunk(int ichunk) {
+  chunkfirst = ichunk * chunksize;
+  nchunk = chunksize;
+
+  /* The last chunk might be smaller */
+  if (chunkfirst + nchunk > nbatch) nchunk = nbatch - chunkfirst;
+}
+
+int DataSet::getBatchID(int id) {
+  if (batchIDs == NULL) return -1;
+
+  return batchIDs[batchfirst + chunkfirst + id];
+}
 
 MyReal *DataSet::getExample(int id) {
   if (examples == NULL) return NULL;
 
-  return examples[batchIDs[id]];
+  return examples[batchIDs[batchfirst + chunkfirst + id]];
 }
 
 MyReal *DataSet::getLabel(int id) {
   if (labels == NULL) return NULL;
 
-  return labels[batchIDs[id]];
+  return labels[batchIDs[batchfirst + chunkfirst + id]];
+}
+
+void DataSet::storeSlice(int nslices, int islice) {
+  int first = (islice * nbatchglobal) / nslices;
+  int last = ((islice + 1) * nbatchglobal) / nslices;
+
+  /* A deterministic batch holds the elements in order */
+  for (int ielem = first; ielem < last; ielem++) {
+    if (examples != NULL && examples[ielem] == NULL) {
+      examples[ielem] = new MyReal[nfeatures];
+    }
+    if (labels != NULL && labels[ielem] == NULL) {
+      labels[ielem] = new MyReal[nlabels];
+    }
+  }
+  nslicestored++;
 }
 
 void DataSet::readData(const char *datafolder, const char *examplefile,
                        const char *labelfile) {
   char examplefilename[255], labelfilename[255];
 
+  /* Store all elements, if no slice is selected */
+  if (nslicestored == 0) {
+    for (int ielem = 0; ielem < nelements; ielem++) {
+      if (examples != NULL) examples[ielem] = new MyReal[nfeatures];
+      if (labels != NULL) labels[ielem] = new MyReal[nlabels];
+    }
+  }
+
   /* Set the file names  */
   sprintf(examplefilename, "%s/%s", datafolder, examplefile);
   sprintf(labelfilename, "%s/%s", datafolder, labelfile);
@@ -135,9 +219,29 @@ void DataSet::readData(const char *datafolder, const char *examplefile,
     read_matrix(labelfilename, labels, nelements, nlabels);
 }
 
-void DataSet::selectBatch(int batch_type, MPI_Comm comm) {
+void DataSet::drawBatch() {
   int irand, rand_range;
   int tmp;
+
+  /* Fill the batchID vector with randomly generated integer */
+  rand_range = navail - 1;
+  for (int ibatch = 0; ibatch < nbatchglobal; ibatch++) {
+    /* Generate a new random index in [0,range] */
+    irand = (int)((((double)rand()) / (double)RAND_MAX) * rand_range);
+
+    /* Set the batchID */
+    batchIDs[ibatch] = availIDs[irand];
+
+    /* Remove the ID from available IDs (by swapping it with the last
+     * available id and reducing the range) */
+    tmp = availIDs[irand];
+    availIDs[irand] = availIDs[rand_range];
+    availIDs[rand_range] = tmp;
+    rand_range--;
+  }
+}
+
+void DataSet::selectBatch(int batch_type, MPI_Comm comm) {
   MPI_Request sendreq, recvreq;
   MPI_Status status;
 
@@ -148,34 +252,31 @@ void DataSet::selectBatch(int batch_type, MPI_Comm comm) {
 
     case STOCHASTIC:
 
-      /* Randomly choose a batch on first processor, send to last processor */
+      /* Randomly choose a batch on first processor of the first data group
+       * and channel group, send to the rest of the channel group, to the
+       * other data groups and to last processor */
+      nselected++;
       if (MPIrank == 0) {
-        /* Fill the batchID vector with randomly generated integer */
-        rand_range = navail - 1;
-        for (int ibatch = 0; ibatch < nbatch; ibatch++) {
-          /* Generate a new random index in [0,range] */
-          irand = (int)((((double)rand()) / (double)RAND_MAX) * rand_range);
-
-          /* Set the batchID */
-          batchIDs[ibatch] = availIDs[irand];
-
-          /* Remove the ID from available IDs (by swapping it with the last
-           * available id and reducing the range) */
-          tmp = availIDs[irand];
-          availIDs[irand] = availIDs[rand_range];
-          availIDs[rand_range] = tmp;
-          rand_range--;
+        if (datarank == 0) {
+          if (channelrank == 0) drawBatch();
+          if (channelcomm != MPI_COMM_NULL) {
+            MPI_Bcast(batchIDs, nbatchglobal, MPI_INT, 0, channelcomm);
+          }
         }
 
+        /* Send to the other data groups */
+        MPI_Bcast(batchIDs, nbatchglobal, MPI_INT, 0, datacomm);
+
         /* Send to the last processor */
         int receiver = MPIsize - 1;
-        MPI_Isend(batchIDs, nbatch, MPI_INT, receiver, 0, comm, &sendreq);
+        MPI_Isend(batchIDs, nbatchglobal, MPI_INT, receiver, 0, comm,
+                  &sendreq);
       }
 
       /* Receive the batch IDs on last processor */
       if (MPIrank == MPIsize - 1) {
         int source = 0;
-        MPI_Irecv(batchIDs, nbatch, MPI_INT, source, 0, comm, &recvreq);
+        MPI_Irecv(batchIDs, nbatchglobal, MPI_INT, source, 0, comm, &recvreq);
       }
 
       /* Wait to finish communication */
@@ -186,12 +287,23 @@ void DataSet::selectBatch(int batch_type, MPI_Comm comm) {
   }
 }
 
+int DataSet::getnSelected() { return nselected; }
+
+void DataSet::skipBatches(int nSelected) {
+  /* Repeat the draws, such that rand() and the available IDs are in the same
+   * state as after nSelected calls of selectBatch() */
+  if (MPIrank == 0 && datarank == 0 && channelrank == 0) {
+    for (int i = nselected; i < nSelected; i++) drawBatch();
+  }
+  nselected = nSelected;
+}
+
 void DataSet::printBatch() {
   if (batchIDs != NULL)  // only first and last processor
   {
     printf("%d:\n", MPIrank);
     for (int ibatch = 0; ibatch < nbatch; ibatch++) {
-      printf("%d, %04d\n", ibatch, batchIDs[ibatch]);
+      printf("%d, %04d\n", batchfirst + ibatch, batchIDs[batchfirst + ibatch]);
     }
   }
 }
@@ -27,6 +27,14 @@ HessianApprox::HessianApprox(MPI_Comm comm) {
 }
 HessianApprox::~HessianApprox() {}
 
+void HessianApprox::writeMemory(MPI_File fh, MPI_Offset *offset,
+                                MPI_Datatype designtype, int write) {}
+
+int HessianApprox::readMemory(MPI_File fh, MPI_Offset *offset,
+                              MPI_Datatype designtype) {
+  return 0;
+}
+
 L_BFGS::L_BFGS(MPI_Comm comm, int N, int stages) : HessianApprox(comm) {
   dimN = N;
   M = stages;
@@ -153,6 +161,62 @@ void L_BFGS::updateMemory(int iter, MyReal *design, MyReal *gradient) {
   vec_copy(dimN, gradient, gradient_old);
 }
 
+void L_BFGS::writeMemory(MPI_File fh, MPI_Offset *offset,
+                         MPI_Datatype designtype, int write) {
+  long long nlocal = dimN;
+  long long nglobal;
+  int rank;
+  MPI_Allreduce(&nlocal, &nglobal, 1, MPI_LONG_LONG, MPI_SUM, MPIcomm);
+  MPI_Comm_rank(MPIcomm, &rank);
+
+  /* H0 and rho are the same on all processors, the first one writes them */
+  MyReal *scalars = new MyReal[M + 1];
+  scalars[0] = H0;
+  for (int imem = 0; imem < M; imem++) scalars[imem + 1] = rho[imem];
+  MPI_WriteVector(fh, *offset, scalars, M + 1, 0, write && rank == 0);
+  *offset += (M + 1) * sizeof(MyReal);
+  delete[] scalars;
+
+  /* Distributed vectors */
+  MPI_WriteVectorView(fh, *offset, design_old, dimN, designtype, write);
+  *offset += nglobal * sizeof(MyReal);
+  MPI_WriteVectorView(fh, *offset, gradient_old, dimN, designtype, write);
+  *offset += nglobal * sizeof(MyReal);
+  for (int imem = 0; imem < M; imem++) {
+    MPI_WriteVectorView(fh, *offset, s[imem], dimN, designtype, write);
+    *offset += nglobal * sizeof(MyReal);
+    MPI_WriteVectorView(fh, *offset, y[imem], dimN, designtype, write);
+    *offset += nglobal * sizeof(MyReal);
+  }
+}
+
+int L_BFGS::readMemory(MPI_File fh, MPI_Offset *offset,
+                       MPI_Datatype designtype) {
+  long long nlocal = dimN;
+  long long nglobal;
+  MPI_Allreduce(&nlocal, &nglobal, 1, MPI_LONG_LONG, MPI_SUM, MPIcomm);
+
+  MyReal *scalars = new MyReal[M + 1];
+  MPI_ReadVector(fh, *offset, scalars, M + 1, 0);
+  *offset += (M + 1) * sizeof(MyReal);
+  H0 = scalars[0];
+  for (int imem = 0; imem < M; imem++) rho[imem] = scalars[imem + 1];
+  delete[] scalars;
+
+  MPI_ReadVectorView(fh, *offset, design_old, dimN, designtype);
+  *offset += nglobal * sizeof(MyReal);
+  MPI_ReadVectorView(fh, *offset, gradient_old, dimN, designtype);
+  *offset += nglobal * sizeof(MyReal);
+  for (int imem = 0; imem < M; imem++) {
+    MPI_ReadVectorView(fh, *offset, s[imem], dimN, designtype);
+    *offset += nglobal * sizeof(MyReal);
+    MPI_ReadVectorView(fh, *offset, y[imem], dimN, designtype);
+    *offset += nglobal * sizeof(MyReal);
+  }
+
+  return 0;
+}
+
 BFGS::BFGS(MPI_Comm comm, int N) : HessianApprox(comm) {
   dimN = N;
 
@@ -265,6 +329,68 @@ void BFGS::computeAscentDir(int iter, MyReal *gradient, MyReal *ascentdir) {
   matvec(dimN, Hessian, gradient, ascentdir);
 }
 
+void BFGS::writeMemory(MPI_File fh, MPI_Offset *offset,
+                       MPI_Datatype designtype, int write) {
+  MPI_Status status;
+  int rank;
+  long long nlocal = dimN;
+  long long nglobal, nblock, blockoffset, nblockglobal;
+  MPI_Allreduce(&nlocal, &nglobal, 1, MPI_LONG_LONG, MPI_SUM, MPIcomm);
+
+  /* Position of the local Hessian block among the blocks of all processors */
+  nblock = nlocal * nlocal;
+  blockoffset = 0;
+  MPI_Exscan(&nblock, &blockoffset, 1, MPI_LONG_LONG, MPI_SUM, MPIcomm);
+  MPI_Comm_rank(MPIcomm, &rank);
+  if (rank == 0) blockoffset = 0;
+  MPI_Allreduce(&nblock, &nblockglobal, 1, MPI_LONG_LONG, MPI_SUM, MPIcomm);
+
+  /* Total size of the blocks, to detect a changed layer distribution */
+  MPI_File_write_at_all(fh, *offset, &nblockglobal,
+                        (write && rank == 0) ? 1 : 0, MPI_LONG_LONG,
+                        &status);
+  *offset += sizeof(long long);
+  MPI_WriteVector(fh, *offset, Hessian, dimN * dimN, blockoffset, write);
+  *offset += nblockglobal * sizeof(MyReal);
+
+  MPI_WriteVectorView(fh, *offset, design_old, dimN, designtype, write);
+  *offset += nglobal * sizeof(MyReal);
+  MPI_WriteVectorView(fh, *offset, gradient_old, dimN, designtype, write);
+  *offset += nglobal * sizeof(MyReal);
+}
+
+int BFGS::readMemory(MPI_File fh, MPI_Offset *offset,
+                       MPI_Datatype designtype) {
+  MPI_Status status;
+  int rank;
+  long long nlocal = dimN;
+  long long nglobal, nblock, blockoffset, nblockglobal, nblockfile;
+  MPI_Allreduce(&nlocal, &nglobal, 1, MPI_LONG_LONG, MPI_SUM, MPIcomm);
+
+  nblock = nlocal * nlocal;
+  blockoffset = 0;
+  MPI_Exscan(&nblock, &blockoffset, 1, MPI_LONG_LONG, MPI_SUM, MPIcomm);
+  MPI_Comm_rank(MPIcomm, &rank);
+  if (rank == 0) blockoffset = 0;
+  MPI_Allreduce(&nblock, &nblockglobal, 1, MPI_LONG_LONG, MPI_SUM, MPIcomm);
+
+  MPI_File_read_at_all(fh, *offset, &nblockfile, 1, MPI_LONG_LONG, &status);
+  *offset += sizeof(long long);
+  if (nblockfile != nblockglobal) {
+    printf("ERROR: BFGS restart needs the same layer distribution!\n");
+    return -1;
+  }
+  MPI_ReadVector(fh, *offset, Hessian, dimN * dimN, blockoffset);
+  *offset += nblockglobal * sizeof(MyReal);
+
+  MPI_ReadVectorView(fh, *offset, design_old, dimN, designtype);
+  *offset += nglobal * sizeof(MyReal);
+  MPI_ReadVectorView(fh, *offset, gradient_old, dimN, designtype);
+  *offset += nglobal * sizeof(MyReal);
+
+  return 0;
+}
+
 Identity::Identity(MPI_Comm comm, int N) : HessianApprox(comm) { dimN = N; }
 
 Identity::~Identity() {}
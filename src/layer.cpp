@@ -45,6 +45,23 @@ Layer::Layer() {
   gamma_ddt = 0.0;
   update = NULL;
   update_bar = NULL;
+
+  nrows = 0;
+  rowsize = 0;
+  channelcomm = MPI_COMM_NULL;
+  channelfirst = 0;
+  channellast = 0;
+  channelcounts = NULL;
+  channeldispls = NULL;
+  batchcounts = NULL;
+  batchdispls = NULL;
+  channelbuffer = NULL;
+  nchannelbuffer = 0;
+  channelsum = NULL;
+  channelbias = NULL;
+  shared = NULL;
+  shared_bar = NULL;
+  sharedowner = 1;
 }
 
 Layer::Layer(int idx, int Type, int dimI, int dimO, int dimB, int dimW,
@@ -64,11 +81,21 @@ Layer::Layer(int idx, int Type, int dimI, int dimO, int dimB, int dimW,
 
   update = new MyReal[dimO];
   update_bar = new MyReal[dimO];
+
+  /* Compute all output channels */
+  channellast = dimO;
 }
 
 Layer::~Layer() {
   delete[] update;
   delete[] update_bar;
+
+  if (channelcounts != NULL) delete[] channelcounts;
+  if (channeldispls != NULL) delete[] channeldispls;
+  if (batchcounts != NULL) delete[] batchcounts;
+  if (batchdispls != NULL) delete[] batchdispls;
+  if (channelbuffer != NULL) delete[] channelbuffer;
+  if (channelbias != NULL) delete[] channelbias;
 }
 
 void Layer::setDt(MyReal DT) { dt = DT; }
@@ -76,13 +103,26 @@ void Layer::setDt(MyReal DT) { dt = DT; }
 MyReal Layer::getDt() { return dt; }
 
 void Layer::setMemory(MyReal *design_memloc, MyReal *gradient_memloc) {
-  /* Set design and gradient memory locations */
-  weights = design_memloc;
-  weights_bar = gradient_memloc;
+  int nsplit = getnDesignSplit();
+  setMemory(design_memloc, gradient_memloc, design_memloc + nsplit,
+            gradient_memloc + nsplit);
+}
 
-  /* Bias memory locations is a shift by number of weights */
-  bias = design_memloc + nweights;
-  bias_bar = gradient_memloc + nweights;
+void Layer::setMemory(MyReal *split_memloc, MyReal *split_gradient_memloc,
+                      MyReal *shared_memloc, MyReal *shared_gradient_memloc) {
+  /* Without split, the weights are the first shared design variables */
+  if (channelcomm == MPI_COMM_NULL) {
+    split_memloc = shared_memloc;
+    split_gradient_memloc = shared_gradient_memloc;
+  }
+  weights = split_memloc;
+  weights_bar = split_gradient_memloc;
+  shared = shared_memloc;
+  shared_bar = shared_gradient_memloc;
+
+  /* Bias is the end of the shared design variables */
+  bias = shared + getnDesignShared() - dim_Bias;
+  bias_bar = shared_bar + getnDesignShared() - dim_Bias;
 }
 
 MyReal Layer::getGammaTik() { return gamma_tik; }
@@ -105,11 +145,160 @@ int Layer::getDimBias() { return dim_Bias; }
 int Layer::getnWeights() { return nweights; }
 int Layer::getnDesign() { return ndesign; }
 
+int Layer::getnDesignSplit() {
+  if (channelcomm == MPI_COMM_NULL) return 0;
+  return (channellast - channelfirst) * rowsize;
+}
+
+int Layer::getnDesignShared() {
+  if (channelcomm == MPI_COMM_NULL) return ndesign;
+  return ndesign - nrows * rowsize;
+}
+
+int Layer::getnDesignLocal() { return getnDesignSplit() + getnDesignShared(); }
+
+int Layer::getSplitOffset() { return channelfirst * rowsize; }
+
 int Layer::getnConv() { return nconv; }
 int Layer::getCSize() { return csize; }
 
 int Layer::getIndex() { return index; }
 
+void Layer::setChannelComm(MPI_Comm comm) {
+  /* Not split, the design belongs to the first processor of the group */
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  sharedowner = (rank == 0);
+}
+
+void Layer::splitChannels(MPI_Comm comm, int channelsize) {
+  int rank, size;
+
+  channelcomm = comm;
+  MPI_Comm_rank(channelcomm, &rank);
+  MPI_Comm_size(channelcomm, &size);
+
+  /* Distribute the channels evenly */
+  channelcounts = new int[size];
+  channeldispls = new int[size];
+  batchcounts = new int[size];
+  batchdispls = new int[size];
+  for (int r = 0; r < size; r++) {
+    int first = (r * nrows) / size;
+    int last = ((r + 1) * nrows) / size;
+    channelcounts[r] = (last - first) * channelsize;
+    channeldispls[r] = first * channelsize;
+  }
+  channelfirst = (rank * nrows) / size;
+  channellast = ((rank + 1) * nrows) / size;
+
+  channelbias = new MyReal[dim_Bias];
+  sharedowner = (rank == 0);
+}
+
+MyReal *Layer::getChannelBuffer(int size) {
+  if (size > nchannelbuffer) {
+    if (channelbuffer != NULL) delete[] channelbuffer;
+    channelbuffer = new MyReal[size];
+    nchannelbuffer = size;
+  }
+  return channelbuffer;
+}
+
+void Layer::gatherChannels(MyReal **data, int nbatch, MyReal *sum, int nsum) {
+  int rank, size;
+  MPI_Comm_rank(channelcomm, &rank);
+  MPI_Comm_size(channelcomm, &size);
+
+  /* Each processor contributes the local channels of all examples, followed
+   * by its nsum entries */
+  for (int r = 0; r < size; r++) {
+    batchcounts[r] = nbatch * channelcounts[r] + nsum;
+    batchdispls[r] = nbatch * channeldispls[r] + r * nsum;
+  }
+  MyReal *buffer = getChannelBuffer(nbatch * dim_Out + size * nsum);
+  MyReal *part = &(buffer[batchdispls[rank]]);
+  for (int iex = 0; iex < nbatch; iex++) {
+    vec_copy(channelcounts[rank], &(data[iex][channeldispls[rank]]),
+             &(part[iex * channelcounts[rank]]));
+  }
+  vec_copy(nsum, sum, &(part[nbatch * channelcounts[rank]]));
+
+  MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, buffer, batchcounts,
+                 batchdispls, MPI_MyReal, channelcomm);
+
+  /* Unpack the channels and sum up, in the same order on all processors */
+  vec_setZero(nsum, sum);
+  for (int r = 0; r < size; r++) {
+    part = &(buffer[batchdispls[r]]);
+    for (int iex = 0; iex < nbatch; iex++) {
+      vec_copy(channelcounts[r], &(part[iex * channelcounts[r]]),
+               &(data[iex][channeldispls[r]]));
+    }
+    vec_axpy(nsum, 1.0, &(part[nbatch * channelcounts[r]]), sum);
+  }
+}
+
+int Layer::getnChannelSum() { return 0; }
+
+void Layer::applyBWDSum(MyReal *state, MyReal *state_bar, MyReal *sum,
+                        int compute_gradient) {}
+
+void Layer::applyFWDBatch(MyReal **state, int nbatch) {
+  for (int iex = 0; iex < nbatch; iex++) {
+    applyFWD(state[iex]);
+  }
+
+  /* Gather the channels of the other processors */
+  if (channelcomm != MPI_COMM_NULL) gatherChannels(state, nbatch, NULL, 0);
+}
+
+void Layer::applyBWDBatch(MyReal **state, MyReal **state_bar, int nbatch,
+                          int compute_gradient) {
+  if (channelcomm == MPI_COMM_NULL) {
+    for (int iex = 0; iex < nbatch; iex++) {
+      applyBWD(state[iex], state_bar[iex], compute_gradient);
+    }
+    return;
+  }
+
+  /* Collect the contributions of all examples, followed by the one to the
+   * bias gradient */
+  int nsum = getnChannelSum();
+  int nbias = compute_gradient ? dim_Bias : 0;
+  MyReal *buffer = getChannelBuffer(nbatch * nsum + nbias);
+  vec_copy(nbias, bias_bar, channelbias);
+  vec_setZero(nbias, bias_bar);
+  for (int iex = 0; iex < nbatch; iex++) {
+    channelsum = &(buffer[iex * nsum]);
+    vec_setZero(nsum, channelsum);
+    applyBWD(state[iex], state_bar[iex], compute_gradient);
+  }
+  channelsum = NULL;
+  vec_copy(nbias, bias_bar, &(buffer[nbatch * nsum]));
+
+  /* Sum them up over the channel group at once */
+  MPI_Allreduce(MPI_IN_PLACE, buffer, nbatch * nsum + nbias, MPI_MyReal,
+                MPI_SUM, channelcomm);
+
+  vec_copy(nbias, channelbias, bias_bar);
+  vec_axpy(nbias, 1.0, &(buffer[nbatch * nsum]), bias_bar);
+  for (int iex = 0; iex < nbatch; iex++) {
+    applyBWDSum(state[iex], state_bar[iex], &(buffer[iex * nsum]),
+                compute_gradient);
+  }
+}
+
+void Layer::resetGradient() {
+  vec_setZero(getnDesignSplit(), weights_bar);
+  vec_setZero(getnDesignShared(), shared_bar);
+}
+
+void Layer::scaleDesign(MyReal factor) {
+  vec_scale(getnDesignSplit(), factor, weights);
+  vec_scale(getnDesignShared(), factor, shared);
+}
+
 void Layer::print_data(MyReal *data) {
   printf("DATA: ");
   for (int io = 0; io < dim_Out; io++) {
@@ -161,15 +350,15 @@ MyReal Layer::dactivation(MyReal x) {
 }
 
 void Layer::packDesign(MyReal *buffer, int size) {
-  int nweights = getnWeights();
-  int nbias = getDimBias();
+  int nsplit = getnDesignSplit();
+  int nshared = getnDesignShared();
   int idx = 0;
-  for (int i = 0; i < nweights; i++) {
-    buffer[idx] = getWeights()[i];
+  for (int i = 0; i < nsplit; i++) {
+    buffer[idx] = weights[i];
     idx++;
   }
-  for (int i = 0; i < nbias; i++) {
-    buffer[idx] = getBias()[i];
+  for (int i = 0; i < nshared; i++) {
+    buffer[idx] = shared[i];
     idx++;
   }
   /* Set the rest to zero */
@@ -179,51 +368,70 @@ void Layer::packDesign(MyReal *buffer, int size) {
   }
 }
 
+int Layer::getnPacked() { return getnDesignLocal(); }
+
 void Layer::unpackDesign(MyReal *buffer) {
-  int nweights = getnWeights();
-  int nbias = getDimBias();
+  int nsplit = getnDesignSplit();
+  int nshared = getnDesignShared();
 
   int idx = 0;
-  for (int i = 0; i < nweights; i++) {
-    getWeights()[i] = buffer[idx];
+  for (int i = 0; i < nsplit; i++) {
+    weights[i] = buffer[idx];
     idx++;
   }
-  for (int i = 0; i < nbias; i++) {
-    getBias()[i] = buffer[idx];
+  for (int i = 0; i < nshared; i++) {
+    shared[i] = buffer[idx];
     idx++;
   }
 }
 
 
 MyReal Layer::evalTikh() {
+  int nsplit = getnDesignSplit();
+  int nshared = sharedowner ? getnDesignShared() : 0;
   MyReal tik = 0.0;
-  for (int i = 0; i < nweights; i++) {
+  for (int i = 0; i < nsplit; i++) {
     tik += pow(weights[i], 2);
   }
-  for (int i = 0; i < dim_Bias; i++) {
-    tik += pow(bias[i], 2);
+  for (int i = 0; i < nshared; i++) {
+    tik += pow(shared[i], 2);
   }
 
   return gamma_tik / 2.0 * tik;
 }
 
 void Layer::evalTikh_diff(MyReal regul_bar) {
+  int nsplit = getnDesignSplit();
+  int nshared = getnDesignShared();
   regul_bar = gamma_tik * regul_bar;
 
-  /* Derivative bias term */
-  for (int i = 0; i < dim_Bias; i++) {
-    bias_bar[i] += bias[i] * regul_bar;
+  for (int i = 0; i < nshared; i++) {
+    shared_bar[i] += shared[i] * regul_bar;
   }
-  for (int i = 0; i < nweights; i++) {
+  for (int i = 0; i < nsplit; i++) {
     weights_bar[i] += weights[i] * regul_bar;
   }
 }
 
+void Layer::getAlignedDesign(Layer *layer, MyReal **split_ptr,
+                             MyReal **shared_ptr) {
+  if (layer->channelcomm == MPI_COMM_NULL) {
+    *split_ptr = layer->weights + getSplitOffset();
+    *shared_ptr = layer->weights + ndesign - getnDesignShared();
+  } else {
+    *split_ptr = layer->weights;
+    *shared_ptr = layer->shared;
+  }
+}
+
 MyReal Layer::evalRegulDDT(Layer *layer_prev, MyReal deltat) {
   if (layer_prev == NULL) return 0.0;  // this holds for opening layer
 
   MyReal diff;
   MyReal regul_ddt = 0.0;
+  MyReal *prev_split, *prev_shared;
+  int nsplit = getnDesignSplit();
+  int nshared = sharedowner ? getnDesignShared() : 0;
 
   /* Compute ddt-regularization only if dimensions match  */
   /* this excludes first intermediate layer and classification layer. */
@@ -231,12 +439,13 @@ MyReal Layer::evalRegulDDT(Layer *layer_prev, MyReal deltat) {
       layer_prev->getDimOut() == dim_Out &&
       layer_prev->getDimBias() == dim_Bias &&
       layer_prev->getnWeights() == nweights) {
-    for (int iw = 0; iw < nweights; iw++) {
-      diff = (getWeights()[iw] - layer_prev->getWeights()[iw]) / deltat;
+    getAlignedDesign(layer_prev, &prev_split, &prev_shared);
+    for (int iw = 0; iw < nsplit; iw++) {
+      diff = (weights[iw] - prev_split[iw]) / deltat;
       regul_ddt += pow(diff, 2);
     }
-    for (int ib = 0; ib < dim_Bias; ib++) {
-      diff = (getBias()[ib] - layer_prev->getBias()[ib]) / deltat;
+    for (int is = 0; is < nshared; is++) {
+      diff = (shared[is] - prev_shared[is]) / deltat;
       regul_ddt += pow(diff, 2);
     }
     regul_ddt = gamma_ddt / 2.0 * regul_ddt;
@@ -251,21 +460,25 @@ void Layer::evalRegulDDT_diff(Layer *layer_prev, Layer *layer_next,
   if (layer_next == NULL) return;
 
   MyReal diff;
+  MyReal *other_split, *other_shared;
   int regul_bar = gamma_ddt / (deltat * deltat);
+  int nsplit = getnDesignSplit();
+  int nshared = getnDesignShared();
 
   /* Left sided derivative term */
   if (layer_prev->getnDesign() == ndesign && layer_prev->getDimIn() == dim_In &&
       layer_prev->getDimOut() == dim_Out &&
       layer_prev->getDimBias() == dim_Bias &&
       layer_prev->getnWeights() == nweights) {
-    for (int ib = 0; ib < dim_Bias; ib++) {
-      diff = getBias()[ib] - layer_prev->getBias()[ib];
-      getBiasBar()[ib] += diff * regul_bar;
+    getAlignedDesign(layer_prev, &other_split, &other_shared);
+    for (int is = 0; is < nshared; is++) {
+      diff = shared[is] - other_shared[is];
+      shared_bar[is] += diff * regul_bar;
     }
 
-    for (int iw = 0; iw < nweights; iw++) {
-      diff = getWeights()[iw] - layer_prev->getWeights()[iw];
-      getWeightsBar()[iw] += diff * regul_bar;
+    for (int iw = 0; iw < nsplit; iw++) {
+      diff = weights[iw] - other_split[iw];
+      weights_bar[iw] += diff * regul_bar;
     }
   }
 
@@ -274,14 +487,15 @@ void Layer::evalRegulDDT_diff(Layer *layer_prev, Layer *layer_next,
       layer_next->getDimOut() == dim_Out &&
       layer_next->getDimBias() == dim_Bias &&
       layer_next->getnWeights() == nweights) {
-    for (int ib = 0; ib < dim_Bias; ib++) {
-      diff = getBias()[ib] - layer_next->getBias()[ib];
-      getBiasBar()[ib] += diff * regul_bar;
+    getAlignedDesign(layer_next, &other_split, &other_shared);
+    for (int is = 0; is < nshared; is++) {
+      diff = shared[is] - other_shared[is];
+      shared_bar[is] += diff * regul_bar;
     }
 
-    for (int iw = 0; iw < nweights; iw++) {
-      diff = getWeights()[iw] - layer_next->getWeights()[iw];
-      getWeightsBar()[iw] += diff * regul_bar;
+    for (int iw = 0; iw < nsplit; iw++) {
+      diff = weights[iw] - other_split[iw];
+      weights_bar[iw] += diff * regul_bar;
     }
   }
 }
@@ -293,22 +507,42 @@ void Layer::setLabel(MyReal *example_ptr) {}
 DenseLayer::DenseLayer(int idx, int dimI, int dimO, MyReal deltaT, int Activ,
                        MyReal gammatik, MyReal gammaddt)
     : Layer(idx, DENSE, dimI, dimO, 1, dimI * dimO, deltaT, Activ, gammatik,
-            gammaddt) {}
+            gammaddt) {
+  nrows = dimO;
+  rowsize = dimI;
+}
 
 DenseLayer::~DenseLayer() {}
 
+void DenseLayer::setChannelComm(MPI_Comm comm) { splitChannels(comm, 1); }
+
+MyReal DenseLayer::applyRow(int io, MyReal *state) {
+  return vecdot(dim_In, &(weights[(io - channelfirst) * dim_In]), state);
+}
+
+void DenseLayer::applyRowBar(int io, MyReal *state, MyReal *state_bar,
+                             MyReal update_bar, int compute_gradient) {
+  MyReal *row = &(weights[(io - channelfirst) * dim_In]);
+  MyReal *row_bar = &(weights_bar[(io - channelfirst) * dim_In]);
+
+  for (int ii = 0; ii < dim_In; ii++) {
+    if (compute_gradient) row_bar[ii] += state[ii] * update_bar;
+    state_bar[ii] += row[ii] * update_bar;
+  }
+}
+
 void DenseLayer::applyFWD(MyReal *state) {
   /* Affine transformation */
-  for (int io = 0; io < dim_Out; io++) {
+  for (int io = channelfirst; io < channellast; io++) {
     /* Apply weights */
-    update[io] = vecdot(dim_In, &(weights[io * dim_In]), state);
+    update[io] = applyRow(io, state);
 
     /* Add bias */
     update[io] += bias[0];
   }
 
   /* Apply step */
-  for (int io = 0; io < dim_Out; io++) {
+  for (int io = channelfirst; io < channellast; io++) {
     state[io] = state[io] + dt * activation(update[io]);
   }
 }
@@ -320,25 +554,382 @@ void DenseLayer::applyBWD(MyReal *state, MyReal *state_bar,
      contain the update. */
 
   /* Derivative of the step */
-  for (int io = 0; io < dim_Out; io++) {
+  for (int io = channelfirst; io < channellast; io++) {
     /* Recompute affine transformation */
-    update[io] = vecdot(dim_In, &(weights[io * dim_In]), state);
+    update[io] = applyRow(io, state);
     update[io] += bias[0];
 
     /* Derivative: This is the update from old time */
     update_bar[io] = dt * dactivation(update[io]) * state_bar[io];
   }
 
+  /* With split channels, the update of state_bar is summed up over the
+   * processors */
+  MyReal *state_bar_update = state_bar;
+  if (channelsum != NULL) state_bar_update = channelsum;
+
   /* Derivative of linear transformation */
-  for (int io = 0; io < dim_Out; io++) {
+  for (int io = channelfirst; io < channellast; io++) {
     /* Derivative of bias addition */
     if (compute_gradient) bias_bar[0] += update_bar[io];
 
     /* Derivative of weight application */
+    applyRowBar(io, state, state_bar_update, update_bar[io],
+                compute_gradient);
+  }
+}
+
+int DenseLayer::getnChannelSum() { return dim_In; }
+
+void DenseLayer::applyBWDSum(MyReal *state, MyReal *state_bar, MyReal *sum,
+                             int compute_gradient) {
+  vec_axpy(dim_In, 1.0, sum, state_bar);
+}
+
+SparseDenseLayer::SparseDenseLayer(int idx, int dimI, int dimO,
+                                   MyReal deltaT, int Activ, MyReal gammatik,
+                                   MyReal gammaddt)
+    : DenseLayer(idx, dimI, dimO, deltaT, Activ, gammatik, gammaddt) {
+  type = SPARSEDENSE;
+  nnz = -1;
+  rowptr = new int[dimO + 1];
+  colidx = NULL;
+}
+
+SparseDenseLayer::~SparseDenseLayer() {
+  delete[] rowptr;
+  if (colidx != NULL) delete[] colidx;
+}
+
+int SparseDenseLayer::getnWeightsLocal() {
+  return (channellast - channelfirst) * dim_In;
+}
+
+int SparseDenseLayer::getnNonzeros() {
+  return nnz < 0 ? getnWeightsLocal() : nnz;
+}
+
+void SparseDenseLayer::setPattern() {
+  int nrowslocal = channellast - channelfirst;
+  if (colidx != NULL) delete[] colidx;
+
+  /* Count the nonzeros */
+  nnz = 0;
+  for (int i = 0; i < getnWeightsLocal(); i++) {
+    if (weights[i] != 0.0) nnz++;
+  }
+
+  /* Store their position in CSR format, rows relative to channelfirst */
+  colidx = new int[nnz];
+  int k = 0;
+  for (int ir = 0; ir < nrowslocal; ir++) {
+    rowptr[ir] = k;
     for (int ii = 0; ii < dim_In; ii++) {
-      if (compute_gradient)
-        weights_bar[io * dim_In + ii] += state[ii] * update_bar[io];
-      state_bar[ii] += weights[io * dim_In + ii] * update_bar[io];
+      if (weights[ir * dim_In + ii] != 0.0) colidx[k++] = ii;
+    }
+  }
+  rowptr[nrowslocal] = k;
+}
+
+void SparseDenseLayer::pruneWeights(MyReal fraction) {
+  int nlocal = getnWeightsLocal();
+  int nprune = fraction * nweights;
+  if (nprune <= 0) return;
+
+  /* Magnitude of the nprune-th smallest weight of the layer. With split
+   * channels, the magnitudes of all processors are gathered. */
+  MyReal *magnitude = new MyReal[nweights];
+  MyReal *mine = magnitude;
+  if (channelcomm != MPI_COMM_NULL) {
+    int size;
+    MPI_Comm_size(channelcomm, &size);
+    for (int r = 0; r < size; r++) {
+      batchcounts[r] = channelcounts[r] * dim_In;
+      batchdispls[r] = channeldispls[r] * dim_In;
+    }
+    mine = &(magnitude[channelfirst * dim_In]);
+  }
+  for (int i = 0; i < nlocal; i++) mine[i] = fabs(weights[i]);
+  if (channelcomm != MPI_COMM_NULL) {
+    MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, magnitude, batchcounts,
+                   batchdispls, MPI_MyReal, channelcomm);
+  }
+  std::nth_element(magnitude, magnitude + nprune - 1, magnitude + nweights);
+  MyReal threshold = magnitude[nprune - 1];
+
+  /* Prune all weights below the threshold, and as many at the threshold as
+   * needed, the first ones in the order of the layer */
+  int nequal = nprune;
+  for (int i = 0; i < nweights; i++) {
+    if (magnitude[i] < threshold) nequal--;
+  }
+  delete[] magnitude;
+  if (channelcomm != MPI_COMM_NULL) {
+    int rank, nequal_local = 0, nequal_before = 0;
+    MPI_Comm_rank(channelcomm, &rank);
+    for (int i = 0; i < nlocal; i++) {
+      if (fabs(weights[i]) == threshold) nequal_local++;
+    }
+    MPI_Exscan(&nequal_local, &nequal_before, 1, MPI_INT, MPI_SUM,
+               channelcomm);
+    if (rank > 0) nequal -= nequal_before;
+  }
+  for (int i = 0; i < nlocal; i++) {
+    if (fabs(weights[i]) < threshold) {
+      weights[i] = 0.0;
+    } else if (fabs(weights[i]) == threshold && nequal > 0) {
+      weights[i] = 0.0;
+      nequal--;
+    }
+  }
+}
+
+void SparseDenseLayer::applyPattern(MyReal *vec) {
+  if (nnz < 0) return;
+
+  for (int ir = 0; ir < channellast - channelfirst; ir++) {
+    int k = rowptr[ir];
+    for (int ii = 0; ii < dim_In; ii++) {
+      if (k < rowptr[ir + 1] && colidx[k] == ii) {
+        k++;
+      } else {
+        vec[ir * dim_In + ii] = 0.0;
+      }
+    }
+  }
+}
+
+int SparseDenseLayer::getnPattern() {
+  if (nnz < 0) return 0;
+  return (getnWeightsLocal() + PATTERN_BITS - 1) / PATTERN_BITS;
+}
+
+void SparseDenseLayer::packPattern(MyReal *buffer) {
+  int npattern = getnPattern();
+  int *mask = new int[npattern];
+
+  for (int i = 0; i < npattern; i++) mask[i] = 0;
+  for (int ir = 0; ir < channellast - channelfirst; ir++) {
+    for (int k = rowptr[ir]; k < rowptr[ir + 1]; k++) {
+      int pos = ir * dim_In + colidx[k];
+      mask[pos / PATTERN_BITS] |= 1 << (pos % PATTERN_BITS);
+    }
+  }
+  for (int i = 0; i < npattern; i++) buffer[i] = mask[i];
+
+  delete[] mask;
+}
+
+void SparseDenseLayer::unpackPattern(MyReal *buffer) {
+  int nrowslocal = channellast - channelfirst;
+  if (colidx != NULL) delete[] colidx;
+
+  /* Count the nonzeros */
+  nnz = 0;
+  for (int pos = 0; pos < getnWeightsLocal(); pos++) {
+    int mask = (int)buffer[pos / PATTERN_BITS];
+    if (mask & (1 << (pos % PATTERN_BITS))) nnz++;
+  }
+
+  /* Store their position in CSR format */
+  colidx = new int[nnz];
+  int k = 0;
+  for (int ir = 0; ir < nrowslocal; ir++) {
+    rowptr[ir] = k;
+    for (int ii = 0; ii < dim_In; ii++) {
+      int pos = ir * dim_In + ii;
+      int mask = (int)buffer[pos / PATTERN_BITS];
+      if (mask & (1 << (pos % PATTERN_BITS))) colidx[k++] = ii;
+    }
+  }
+  rowptr[nrowslocal] = k;
+}
+
+void SparseDenseLayer::packDesign(MyReal *buffer, int size) {
+  if (nnz < 0) {
+    Layer::packDesign(buffer, size);
+    return;
+  }
+
+  int idx = 0;
+  for (int ir = 0; ir < channellast - channelfirst; ir++) {
+    for (int k = rowptr[ir]; k < rowptr[ir + 1]; k++) {
+      buffer[idx] = weights[ir * dim_In + colidx[k]];
+      idx++;
+    }
+  }
+  for (int i = 0; i < dim_Bias; i++) {
+    buffer[idx] = bias[i];
+    idx++;
+  }
+  /* Set the rest to zero */
+  for (int i = idx; i < size; i++) {
+    buffer[i] = 0.0;
+  }
+}
+
+void SparseDenseLayer::unpackDesign(MyReal *buffer) {
+  if (nnz < 0) {
+    Layer::unpackDesign(buffer);
+    return;
+  }
+
+  int idx = 0;
+  vec_setZero(getnWeightsLocal(), weights);
+  for (int ir = 0; ir < channellast - channelfirst; ir++) {
+    for (int k = rowptr[ir]; k < rowptr[ir + 1]; k++) {
+      weights[ir * dim_In + colidx[k]] = buffer[idx];
+      idx++;
+    }
+  }
+  for (int i = 0; i < dim_Bias; i++) {
+    bias[i] = buffer[idx];
+    idx++;
+  }
+}
+
+int SparseDenseLayer::getnPacked() {
+  if (nnz < 0) return getnDesignLocal();
+  return nnz + dim_Bias;
+}
+
+MyReal SparseDenseLayer::applyRow(int io, MyReal *state) {
+  if (nnz < 0) return DenseLayer::applyRow(io, state);
+
+  /* Sparse row-vector product */
+  int ir = io - channelfirst;
+  MyReal *row = &(weights[ir * dim_In]);
+  MyReal sum = 0.0;
+  for (int k = rowptr[ir]; k < rowptr[ir + 1]; k++) {
+    sum += row[colidx[k]] * state[colidx[k]];
+  }
+  return sum;
+}
+
+void SparseDenseLayer::applyRowBar(int io, MyReal *state, MyReal *state_bar,
+                                   MyReal update_bar, int compute_gradient) {
+  if (nnz < 0) {
+    DenseLayer::applyRowBar(io, state, state_bar, update_bar,
+                            compute_gradient);
+    return;
+  }
+
+  /* Only the nonzero weights */
+  int ir = io - channelfirst;
+  MyReal *row = &(weights[ir * dim_In]);
+  MyReal *row_bar = &(weights_bar[ir * dim_In]);
+  for (int k = rowptr[ir]; k < rowptr[ir + 1]; k++) {
+    int ii = colidx[k];
+    if (compute_gradient) row_bar[ii] += state[ii] * update_bar;
+    state_bar[ii] += row[ii] * update_bar;
+  }
+}
+
+LowRankDenseLayer::LowRankDenseLayer(int idx, int dimI, int dimO, int Rank,
+                                     MyReal deltaT, int Activ,
+                                     MyReal gammatik, MyReal gammaddt)
+    : Layer(idx, LOWRANK, dimI, dimO, 1, (dimI + dimO) * Rank, deltaT, Activ,
+            gammatik, gammaddt) {
+  rank = Rank;
+  proj = new MyReal[rank];
+  proj_bar = new MyReal[rank];
+
+  /* The rows of U are split, V is shared */
+  nrows = dimO;
+  rowsize = rank;
+}
+
+LowRankDenseLayer::~LowRankDenseLayer() {
+  delete[] proj;
+  delete[] proj_bar;
+}
+
+int LowRankDenseLayer::getRank() { return rank; }
+
+void LowRankDenseLayer::setChannelComm(MPI_Comm comm) {
+  splitChannels(comm, 1);
+}
+
+void LowRankDenseLayer::applyFWD(MyReal *state) {
+  MyReal *U = weights;
+  MyReal *V = bias - dim_In * rank;
+
+  /* Project the state: V^T y */
+  vec_setZero(rank, proj);
+  for (int ii = 0; ii < dim_In; ii++) {
+    for (int k = 0; k < rank; k++) {
+      proj[k] += V[ii * rank + k] * state[ii];
+    }
+  }
+
+  /* Affine transformation U (V^T y) + b */
+  for (int io = channelfirst; io < channellast; io++) {
+    update[io] = vecdot(rank, &(U[(io - channelfirst) * rank]), proj);
+    update[io] += bias[0];
+  }
+
+  /* Apply step */
+  for (int io = channelfirst; io < channellast; io++) {
+    state[io] = state[io] + dt * activation(update[io]);
+  }
+}
+
+void LowRankDenseLayer::applyBWD(MyReal *state, MyReal *state_bar,
+                                 int compute_gradient) {
+  MyReal *U = weights;
+  MyReal *V = bias - dim_In * rank;
+  MyReal *U_bar = weights_bar;
+
+  /* Recompute the projection */
+  vec_setZero(rank, proj);
+  for (int ii = 0; ii < dim_In; ii++) {
+    for (int k = 0; k < rank; k++) {
+      proj[k] += V[ii * rank + k] * state[ii];
+    }
+  }
+
+  /* Derivative of the step */
+  for (int io = channelfirst; io < channellast; io++) {
+    /* Recompute affine transformation */
+    update[io] = vecdot(rank, &(U[(io - channelfirst) * rank]), proj);
+    update[io] += bias[0];
+
+    /* Derivative: This is the update from old time */
+    update_bar[io] = dt * dactivation(update[io]) * state_bar[io];
+  }
+
+  /* Derivative of the affine transformation with U. With split channels,
+   * proj_bar only holds the contribution of the local channels. It is summed
+   * up over the processors before the derivative of the projection, which is
+   * linear in proj_bar. */
+  MyReal *pbar = proj_bar;
+  if (channelsum != NULL) pbar = channelsum;
+  vec_setZero(rank, pbar);
+  for (int io = channelfirst; io < channellast; io++) {
+    int ir = io - channelfirst;
+    if (compute_gradient) bias_bar[0] += update_bar[io];
+    for (int k = 0; k < rank; k++) {
+      if (compute_gradient) U_bar[ir * rank + k] += proj[k] * update_bar[io];
+      pbar[k] += U[ir * rank + k] * update_bar[io];
+    }
+  }
+
+  if (channelsum == NULL)
+    applyBWDSum(state, state_bar, proj_bar, compute_gradient);
+}
+
+int LowRankDenseLayer::getnChannelSum() { return rank; }
+
+void LowRankDenseLayer::applyBWDSum(MyReal *state, MyReal *state_bar,
+                                    MyReal *sum, int compute_gradient) {
+  MyReal *V = bias - dim_In * rank;
+  MyReal *V_bar = bias_bar - dim_In * rank;
+
+  /* Derivative of the projection, sum is the derivative proj_bar */
+  for (int ii = 0; ii < dim_In; ii++) {
+    for (int k = 0; k < rank; k++) {
+      if (compute_gradient) V_bar[ii * rank + k] += state[ii] * sum[k];
+      state_bar[ii] += V[ii * rank + k] * sum[k];
     }
   }
 }
@@ -351,6 +942,10 @@ OpenDenseLayer::OpenDenseLayer(int dimI, int dimO, int Activ, MyReal gammatik)
 
 OpenDenseLayer::~OpenDenseLayer() {}
 
+void OpenDenseLayer::setChannelComm(MPI_Comm comm) {
+  Layer::setChannelComm(comm);
+}
+
 void OpenDenseLayer::setExample(MyReal *example_ptr) { example = example_ptr; }
 
 void OpenDenseLayer::applyFWD(MyReal *state) {
@@ -734,11 +1329,27 @@ ConvLayer::ConvLayer(int idx, int dimI, int dimO, int csize_in, int nconv_in,
   img_size = dim_In / nconv;
   img_size_sqrt = round(sqrt(img_size));
 
+  /* Compute all convolutions */
+  channellast = nconv;
+  nrows = nconv;
+  rowsize = csize2 * nconv;
+
+  update_batch = NULL;
+  update_batch_ptr = NULL;
+  nupdate_batch = 0;
+
   // nweights = csize*csize*nconv*nconv;
   // ndesign = nweights + dimI/nconv; // must add to account for the bias
 }
 
-ConvLayer::~ConvLayer() {}
+ConvLayer::~ConvLayer() {
+  if (update_batch != NULL) {
+    delete[] update_batch;
+    delete[] update_batch_ptr;
+  }
+}
+
+void ConvLayer::setChannelComm(MPI_Comm comm) { splitChannels(comm, img_size); }
 
 /**
  * This method is designed to be used only in the applyBWD. It computes the
@@ -783,7 +1394,8 @@ MyReal ConvLayer::updateWeightDerivative(
   const int fcsize_t = fcsize_t_u - fcsize_t_l;
 
   int center_index = j * img_size_sqrt + k;
-  int input_wght_idx = output_conv * csize2 * nconv + fcsize * (csize + 1);
+  int input_wght_idx =
+      (output_conv - channelfirst) * csize2 * nconv + fcsize * (csize + 1);
 
   int offset = fcsize_t_l + img_size_sqrt * fcsize_s_l;
   int wght_idx = fcsize_t_l + csize * fcsize_s_l;
@@ -845,8 +1457,8 @@ MyReal ConvLayer::apply_conv(MyReal *state,
 
   int center_index =
       j * img_size_sqrt + k + fcsize_t_l + img_size_sqrt * fcsize_s_l;
-  int input_wght_idx = output_conv * csize2 * nconv + fcsize * (csize + 1) +
-                       fcsize_t_l + csize * fcsize_s_l;
+  int input_wght_idx = (output_conv - channelfirst) * csize2 * nconv +
+                       fcsize * (csize + 1) + fcsize_t_l + csize * fcsize_s_l;
 
   /* loop over all the images */
   for (int input_image = 0; input_image < nconv;
@@ -890,7 +1502,7 @@ MyReal ConvLayer::apply_conv_trans(MyReal *state,
 
   /* loop over all the images */
   int center_index = j * img_size_sqrt + k;
-  int input_wght_idx = output_conv * csize2 * nconv;
+  int input_wght_idx = (output_conv - channelfirst) * csize2 * nconv;
   for (int input_image = 0; input_image < nconv;
        input_image++, center_index += img_size, input_wght_idx += csize2) {
     int offset = center_index - fcsize_t_l;
@@ -918,7 +1530,7 @@ void ConvLayer::applyFWD(MyReal *state) {
   for (int io = 0; io < dim_Out; io++) update[io] = state[io];
 
   /* Affine transformation */
-  for (int i = 0; i < nconv; i++) {
+  for (int i = channelfirst; i < channellast; i++) {
     for (int j = 0; j < img_size_sqrt; j++) {
       int state_index = i * img_size + j * img_size_sqrt;
       MyReal *update_local = state + state_index;
@@ -977,15 +1589,21 @@ void ConvLayer::applyBWD(MyReal *state, MyReal *state_bar,
      computed below. Similar for the bias.
    */
 
+  computeUpdateBar(state, state_bar, update_bar);
+  applyUpdateBar(state, state_bar, update_bar, compute_gradient);
+}
+
+void ConvLayer::computeUpdateBar(MyReal *state, MyReal *state_bar,
+                                 MyReal *ubar) {
   /* Affine transformation, and derivative of time step */
 
   /* loop over number convolutions */
-  for (int i = 0; i < nconv; i++) {
+  for (int i = channelfirst; i < channellast; i++) {
     /* loop over full image */
     for (int j = 0; j < img_size_sqrt; j++) {
       int state_index = i * img_size + j * img_size_sqrt;
       MyReal *state_bar_local = state_bar + state_index;
-      MyReal *update_bar_local = update_bar + state_index;
+      MyReal *update_bar_local = ubar + state_index;
       MyReal *bias_local = bias + j * img_size_sqrt;
 
       for (int k = 0; k < img_size_sqrt;
@@ -1002,15 +1620,18 @@ void ConvLayer::applyBWD(MyReal *state, MyReal *state_bar,
       }
     }
   }
+}
 
+void ConvLayer::applyUpdateBar(MyReal *state, MyReal *state_bar, MyReal *ubar,
+                               int compute_gradient) {
   /* Loop over the output dimensions */
-  for (int i = 0; i < nconv; i++) {
+  for (int i = channelfirst; i < channellast; i++) {
     /* loop over full image */
     for (int j = 0; j < img_size_sqrt; j++) {
       int state_index = i * img_size + j * img_size_sqrt;
 
       MyReal *state_bar_local = state_bar + state_index;
-      MyReal *update_bar_local = update_bar + state_index;
+      MyReal *update_bar_local = ubar + state_index;
       MyReal *bias_bar_local = bias_bar + j * img_size_sqrt;
 
       for (int k = 0; k < img_size_sqrt;
@@ -1018,13 +1639,51 @@ void ConvLayer::applyBWD(MyReal *state, MyReal *state_bar,
         if (compute_gradient) {
           (*bias_bar_local) += (*update_bar_local);
 
-          (*state_bar_local) +=
-              updateWeightDerivative(state, update_bar, i, j, k);
+          (*state_bar_local) += updateWeightDerivative(state, ubar, i, j, k);
         } else {
-          (*state_bar_local) += apply_conv_trans(update_bar, i, j, k);
+          (*state_bar_local) += apply_conv_trans(ubar, i, j, k);
         }
       }
     }
 
   }  // end for i
 }
+
+void ConvLayer::applyBWDBatch(MyReal **state, MyReal **state_bar, int nbatch,
+                              int compute_gradient) {
+  if (channelcomm == MPI_COMM_NULL) {
+    Layer::applyBWDBatch(state, state_bar, nbatch, compute_gradient);
+    return;
+  }
+
+  /* update_bar of all examples */
+  if (nbatch > nupdate_batch) {
+    if (update_batch != NULL) {
+      delete[] update_batch;
+      delete[] update_batch_ptr;
+    }
+    update_batch = new MyReal[nbatch * dim_Out];
+    update_batch_ptr = new MyReal *[nbatch];
+    nupdate_batch = nbatch;
+  }
+  for (int iex = 0; iex < nbatch; iex++) {
+    update_batch_ptr[iex] = &(update_batch[iex * dim_Out]);
+    computeUpdateBar(state[iex], state_bar[iex], update_batch_ptr[iex]);
+  }
+
+  /* The derivative needs update_bar of all convolutions */
+  gatherChannels(update_batch_ptr, nbatch, NULL, 0);
+
+  /* Derivatives of the local convolutions. The bias gradient of the local
+   * convolutions is summed up while gathering state_bar. */
+  int nbias = compute_gradient ? dim_Bias : 0;
+  vec_copy(nbias, bias_bar, channelbias);
+  vec_setZero(nbias, bias_bar);
+  for (int iex = 0; iex < nbatch; iex++) {
+    applyUpdateBar(state[iex], state_bar[iex], update_batch_ptr[iex],
+                   compute_gradient);
+  }
+  gatherChannels(state_bar, nbatch, bias_bar, nbias);
+  vec_axpy(nbias, 1.0, channelbias, bias_bar);
+}
+
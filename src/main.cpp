@@ -26,6 +26,7 @@
 #include <sys/resource.h>
 
 #include "braid_wrapper.hpp"
+#include "checkpoint.hpp"
 #include "config.hpp"
 #include "dataset.hpp"
 #include "defs.hpp"
@@ -62,11 +63,24 @@ int main(int argc, char *argv[]) {
   /* --- Optimization --- */
   int ndesign_local;  /**< Number of local design variables on this processor */
   int ndesign_global; /**< Number of global design variables (sum of local)*/
+  MyReal *design;     /**< Local design variables of the optimization */
+  MyReal *gradient;   /**< Local gradient of the optimization */
   MyReal *ascentdir = 0; /**< Direction for design updates */
+  MyReal *gradient_acc = 0; /**< Accumulates the gradient over micro-batches */
+  MyReal *gradient_ref = 0; /**< Gradient with full precision primal states */
+  MyReal *gradient_save = 0; /**< Gradient of the reduced precision states */
+  int checkgradient = 0;  /**< Flag: check the gradient in this iteration */
+  MyReal gerr = 0.0;      /**< Relative gradient error of the checkpoints */
+  MyReal gerr_max = 0.0;  /**< Largest relative gradient error */
+  int ntrainbatch;        /**< Size of the training batch */
+  MyReal microweight;     /**< Weight of the current micro-batch */
+  MyReal valweight;       /**< Share of the validation set of this data group */
   MyReal objective;      /**< Optimization objective */
   MyReal wolfe;          /**< Holding the wolfe condition value */
   MyReal rnorm;          /**< Space-time Norm of the state variables */
   MyReal rnorm_adj;      /**< Space-time norm of the adjoint variables */
+  MyReal rnorm_micro;    /**< State norm of one micro-batch */
+  MyReal rnorm_adj_micro; /**< Adjoint norm of one micro-batch */
   MyReal gnorm;          /**< Norm of the gradient */
   MyReal ls_param;       /**< Parameter in wolfe condition test */
   MyReal stepsize;       /**< Stepsize used for design update */
@@ -75,15 +89,34 @@ int main(int argc, char *argv[]) {
   MyReal ls_stepsize;
   MyReal ls_objective, test_obj;
   int ls_iter;
+  int ls_nparallel;       /**< Number of stepsizes tested in parallel */
+  int ls_id;              /**< Index of the stepsize tested by this group */
+  int ls_best;            /**< Index of the accepted stepsize */
+  MyReal *ls_objectives = 0; /**< Objectives of the tested stepsizes */
+  MyReal braid_tol, braid_toladj; /**< Current primal and adjoint tolerance */
+  int braid_maxit, braid_maxitadj; /**< Current primal and adjoint iter cap */
+  FILE *tolfile = 0;
+  FILE *oneshotfile = 0;
+  int iter_start = 0;     /**< First optimization iteration (> 0 on restart) */
+  int designwriter;       /**< Flag: this processor writes its design to files */
+  MyReal checkpointtime;  /**< Time for writing a checkpoint */
+  int pruned = 0;         /**< Flag: hidden weights have been pruned */
+  MyReal sparsity;        /**< Fraction of pruned hidden weights */
 
   /* --- Time measurements --- */
   struct rusage r_usage;
   MyReal StartTime, StopTime, myMB, globalMB;
+  MyReal mystoredMB, myfullMB, storedMB, fullMB;
+  int openlayer_nevals;
   MyReal UsedTime = 0.0;
 
   /* Initialize MPI */
   int myid;
   int size;
+  MPI_Comm layercomm; /**< Processors of one data group, parallel in layers */
+  MPI_Comm datacomm;  /**< Processors of the same layers in all data groups */
+  MPI_Comm channelcomm; /**< Processors that split the channels of layers */
+  MPI_Comm groupcomm; /**< All processors of one data group */
   MPI_Init(&argc, &argv);
   MPI_Comm_rank(MPI_COMM_WORLD, &myid);
   MPI_Comm_size(MPI_COMM_WORLD, &size);
@@ -92,7 +125,6 @@ int main(int argc, char *argv[]) {
   config = new Config();
   trainingdata = new DataSet();
   validationdata = new DataSet();
-  network = new Network(MPI_COMM_WORLD);
 
   /* Read config file */
   if (argc != 2) {
@@ -110,34 +142,234 @@ int main(int argc, char *argv[]) {
     return 0;
   }
 
+  /* Split the processors into data groups, each one parallel in layers, and
+   * each layer split between nchannelsplit processors */
+  int nchannelsplit = config->nchannelsplit;
+  if (size % (config->ndatagroups * nchannelsplit) != 0) {
+    if (myid == MASTER_NODE) {
+      printf(
+          "ERROR: Number of processors must be a multiple of ndatagroups * "
+          "nchannelsplit!\n");
+    }
+    MPI_Finalize();
+    return 0;
+  }
+  if (config->ndatagroups % config->ls_nparallel != 0) {
+    if (myid == MASTER_NODE) {
+      printf("ERROR: ndatagroups must be a multiple of ls_nparallel!\n");
+    }
+    MPI_Finalize();
+    return 0;
+  }
+  /* Each data group needs at least one example of the batch and of the
+   * validation set. The line search splits the batch into ndatagroups /
+   * ls_nparallel slices, these are larger. */
+  if (std::min(config->nbatch, config->ntraining) < config->ndatagroups ||
+      config->nvalidation < config->ndatagroups) {
+    if (myid == MASTER_NODE) {
+      printf(
+          "ERROR: nbatch, ntraining and nvalidation must be at least "
+          "ndatagroups!\n");
+    }
+    MPI_Finalize();
+    return 0;
+  }
+  if (config->braid_channelcoarsen > 1 &&
+      (config->network_type != DENSE || config->lowrank > 0)) {
+    if (myid == MASTER_NODE) {
+      printf(
+          "ERROR: braid_channelcoarsen requires a dense network with full "
+          "weight matrices!\n");
+    }
+    MPI_Finalize();
+    return 0;
+  }
+  if (config->braid_channelcoarsen > 1 && config->pruning > 0.0) {
+    if (myid == MASTER_NODE) {
+      printf("ERROR: braid_channelcoarsen and pruning can't be combined!\n");
+    }
+    MPI_Finalize();
+    return 0;
+  }
+  if (config->braid_channelcoarsen > 1 && nchannelsplit > 1) {
+    if (myid == MASTER_NODE) {
+      printf(
+          "ERROR: braid_channelcoarsen and nchannelsplit can't be combined!\n");
+    }
+    MPI_Finalize();
+    return 0;
+  }
+  if (config->braid_checkpointcheck > 0 &&
+      ((config->braid_checkpointstride == 0 &&
+        config->braid_checkpointprecision == PREC_DOUBLE) ||
+       config->braid_oneshot > 0)) {
+    if (myid == MASTER_NODE) {
+      printf(
+          "ERROR: braid_checkpointcheck requires checkpointing of the primal "
+          "states and can't be combined with braid_oneshot!\n");
+    }
+    MPI_Finalize();
+    return 0;
+  }
+  if (config->braid_oneshot > 0 && config->braid_adaptivetol > 0.0) {
+    if (myid == MASTER_NODE) {
+      printf("ERROR: braid_oneshot and braid_adaptivetol can't be combined!\n");
+    }
+    MPI_Finalize();
+    return 0;
+  }
+  if (config->lowrank > 0 && config->pruning > 0.0) {
+    if (myid == MASTER_NODE) {
+      printf("ERROR: lowrank and pruning can't be combined!\n");
+    }
+    MPI_Finalize();
+    return 0;
+  }
+  /* Zero factors U = V = 0 have a zero gradient, they would never change */
+  if (config->lowrank > 0 && config->weights_init == 0.0 &&
+      strcmp(config->modelfile_in, "NONE") == 0 && !config->restart) {
+    if (myid == MASTER_NODE) {
+      printf(
+          "ERROR: lowrank requires weights_init > 0 (or a modelfile_in or a "
+          "restart)!\n");
+    }
+    MPI_Finalize();
+    return 0;
+  }
+  if (config->weights_nbasis > 0) {
+    int degree = (config->weights_basis == BASIS_CUBIC) ? 3 : 1;
+    if (config->weights_nbasis < degree + 1 ||
+        config->weights_nbasis > config->nlayers - 2) {
+      if (myid == MASTER_NODE) {
+        printf(
+            "ERROR: weights_nbasis must be in [%d, nlayers-2] for this "
+            "weights_basis!\n",
+            degree + 1);
+      }
+      MPI_Finalize();
+      return 0;
+    }
+    if (config->pruning > 0.0) {
+      if (myid == MASTER_NODE) {
+        printf("ERROR: weights_nbasis and pruning can't be combined!\n");
+      }
+      MPI_Finalize();
+      return 0;
+    }
+    if (nchannelsplit > 1) {
+      if (myid == MASTER_NODE) {
+        printf("ERROR: weights_nbasis and nchannelsplit can't be combined!\n");
+      }
+      MPI_Finalize();
+      return 0;
+    }
+    if (config->lowrank > 0) {
+      if (myid == MASTER_NODE) {
+        printf("ERROR: weights_nbasis and lowrank can't be combined!\n");
+      }
+      MPI_Finalize();
+      return 0;
+    }
+  }
+  int ngroup = size / config->ndatagroups;
+  int datagroup = myid / ngroup;
+  MPI_Comm_split(MPI_COMM_WORLD,
+                 (myid / ngroup) * nchannelsplit + myid % nchannelsplit, myid,
+                 &layercomm);
+  MPI_Comm_split(MPI_COMM_WORLD, myid % ngroup, myid, &datacomm);
+  MPI_Comm_split(MPI_COMM_WORLD, myid / nchannelsplit, myid, &channelcomm);
+  MPI_Comm_split(MPI_COMM_WORLD, datagroup, myid, &groupcomm);
+
+  network = new Network(layercomm);
+
   /* Initialize training and validation data */
   trainingdata->initialize(config->ntraining, config->nfeatures,
-                           config->nclasses, config->nbatch, MPI_COMM_WORLD);
+                           config->nclasses, config->nbatch, layercomm,
+                           datacomm);
+  if (nchannelsplit > 1) trainingdata->setChannelComm(channelcomm);
+  if (config->batch_type == DETERMINISTIC) {
+    /* Store the slices of this data group only, for the gradient and for the
+     * parallel line search */
+    trainingdata->storeSlice(config->ndatagroups, datagroup);
+    trainingdata->storeSlice(config->ndatagroups / config->ls_nparallel,
+                             datagroup %
+                                 (config->ndatagroups / config->ls_nparallel));
+  }
   trainingdata->readData(config->datafolder, config->ftrain_ex,
                          config->ftrain_labels);
 
   validationdata->initialize(config->nvalidation, config->nfeatures,
-                             config->nclasses, config->nvalidation,
-                             MPI_COMM_WORLD);  // full validation set!
+                             config->nclasses, config->nvalidation, layercomm,
+                             datacomm);  // full validation set!
+  validationdata->storeSlice(config->ndatagroups, datagroup);
   validationdata->readData(config->datafolder, config->fval_ex,
                            config->fval_labels);
 
+  /* Split training batch into micro-batches, validation set into chunks */
+  ntrainbatch = trainingdata->getnBatchGlobal();
+  trainingdata->setChunkSize(
+      (trainingdata->getnBatch() + config->nmicrobatches - 1) /
+      config->nmicrobatches);
+  valweight = validationdata->getnBatch() /
+              (MyReal)validationdata->getnBatchGlobal();
+  validationdata->setChunkSize(config->validation_chunksize);
+
   /* Initialize XBraid */
   primaltrainapp =
-      new myBraidApp(trainingdata, network, config, MPI_COMM_WORLD);
-  adjointtrainapp = new myAdjointBraidApp(
-      trainingdata, network, config, primaltrainapp->getCore(), MPI_COMM_WORLD);
-  primalvalapp =
-      new myBraidApp(validationdata, network, config, MPI_COMM_WORLD);
+      new myBraidApp(trainingdata, network, config, layercomm);
+  adjointtrainapp = new myAdjointBraidApp(trainingdata, network, config,
+                                          primaltrainapp, layercomm);
+  primaltrainapp->setSpatialCoarsening(config->braid_batchcoarsen,
+                                       config->braid_channelcoarsen);
+  if (config->braid_oneshot > 0) {
+    primaltrainapp->setMaxIter(1);
+    adjointtrainapp->setMaxIter(1);
+  }
+  primalvalapp = NULL;
+  if (config->validation_type == XBRAID) {
+    primalvalapp =
+        new myBraidApp(validationdata, network, config, layercomm);
+    primalvalapp->setSpatialCoarsening(config->braid_batchcoarsen,
+                                       config->braid_channelcoarsen);
+  }
   primaltrainapp->GetGridDistribution(&startlayerID, &endlayerID);
   if (startlayerID == 0) startlayerID = startlayerID - 1; // -1 is index of the opening layer
 
   /* Initialize the network  */
+  if (nchannelsplit > 1) network->setChannelComm(channelcomm);
   network->createLayerBlock(startlayerID, endlayerID, config);
-  network->setDesignRandom(config->weights_open_init, config->weights_init, config->weights_class_init);
+  network->setDesignRandom(config->weights_open_init, config->weights_init,
+                           config->weights_class_init, config->weights_rng);
   network->setDesignFromFile(config->datafolder, config->weightsopenfile, NULL, config->weightsclassificationfile);
+  if (strcmp(config->modelfile_in, "NONE") != 0) {
+    err = network->readModel(config->modelfile_in, MPI_COMM_WORLD);
+    if (err) {
+      MPI_Finalize();
+      return 0;
+    }
+  }
   ndesign_local = network->getnDesignLocal();
   ndesign_global = network->getnDesignGlobal();
+  design = network->getDesign();
+  gradient = network->getGradient();
+
+  /* With a basis in time, the optimization updates the coefficients */
+  if (config->weights_nbasis > 0) {
+    network->setBasis(config->weights_nbasis,
+                      (config->weights_basis == BASIS_CUBIC) ? 3 : 1);
+    if (myid == MASTER_NODE)
+      printf("Hidden weights represented by %d basis functions in time\n",
+             config->weights_nbasis);
+    ndesign_local = network->getnCoefficientsLocal();
+    ndesign_global = network->getnCoefficientsGlobal();
+    design = network->getCoefficients();
+    gradient = network->getCoefficientsGradient();
+  }
+
+  /* All data groups hold the same design, the first one writes it to model
+   * and checkpoint files. The processors of a channel group write their own
+   * part of it. */
+  designwriter = (datagroup == 0);
 
   /* Print some neural network information */
   printf("%d: Layer range: [%d, %d] / %d\n", myid, startlayerID, endlayerID,
@@ -149,13 +381,13 @@ int main(int argc, char *argv[]) {
   HessianApprox *hessian = NULL;
   switch (config->hessianapprox_type) {
     case BFGS_SERIAL:
-      hessian = new BFGS(MPI_COMM_WORLD, ndesign_local);
+      hessian = new BFGS(groupcomm, ndesign_local);
       break;
     case LBFGS:
-      hessian = new L_BFGS(MPI_COMM_WORLD, ndesign_local, config->lbfgs_stages);
+      hessian = new L_BFGS(groupcomm, ndesign_local, config->lbfgs_stages);
       break;
     case IDENTITY:
-      hessian = new Identity(MPI_COMM_WORLD, ndesign_local);
+      hessian = new Identity(groupcomm, ndesign_local);
       break;
     default:
       printf("Error: unexpected hessianapprox_type returned");
@@ -164,6 +396,13 @@ int main(int argc, char *argv[]) {
 
   /* Initialize optimization parameters */
   ascentdir = new MyReal[ndesign_local];
+  if (trainingdata->getnChunks() > 1) {
+    gradient_acc = new MyReal[network->getnDesignLocal()];
+  }
+  if (config->braid_checkpointcheck > 0) {
+    gradient_ref = new MyReal[network->getnDesignLocal()];
+    gradient_save = new MyReal[network->getnDesignLocal()];
+  }
   stepsize = config->getStepsize(0);
   gnorm = 0.0;
   objective = 0.0;
@@ -172,16 +411,67 @@ int main(int argc, char *argv[]) {
   ls_param = 1e-4;
   ls_iter = 0;
   ls_stepsize = stepsize;
+  ls_nparallel = config->ls_nparallel;
+  ls_id = datagroup / (config->ndatagroups / ls_nparallel);
+  ls_objectives = new MyReal[ls_nparallel];
+  braid_tol = config->braid_abstol;
+  braid_toladj = config->braid_abstoladj;
+  braid_maxit = config->braid_maxiter;
+  braid_maxitadj = config->braid_maxiter;
+
+  /* Restart from the checkpoint */
+  if (config->restart) {
+    err = readCheckpoint(config->checkpoint_file, config, network, hessian,
+                         trainingdata, &iter_start, &ls_iter, &stepsize,
+                         &gnorm, MPI_COMM_WORLD);
+    if (err) {
+      MPI_Finalize();
+      return 0;
+    }
+    if (myid == MASTER_NODE)
+      printf("Restart from %s at iteration %d\n", config->checkpoint_file,
+             iter_start);
+  }
 
-  /* Open and prepare optimization output file*/
+  /* Open and prepare optimization output file. On restart, continue the
+   * files of the previous run. */
   if (myid == MASTER_NODE) {
     sprintf(optimfilename, "%s.dat", "optim");
-    optimfile = fopen(optimfilename, "w");
-    config->writeToFile(optimfile);
-    fprintf(optimfile,
-            "#    || r ||          || r_adj ||      Objective             Loss "
-            "                 || grad ||            Stepsize  ls_iter   "
-            "Accur_train  Accur_val   Time(sec)\n");
+    if (config->restart) {
+      optimfile = fopen(optimfilename, "a");
+      fprintf(optimfile, "# Restart from %s at iteration %d\n",
+              config->checkpoint_file, iter_start);
+    } else {
+      optimfile = fopen(optimfilename, "w");
+      config->writeToFile(optimfile);
+      fprintf(optimfile,
+              "#    || r ||          || r_adj ||      Objective             "
+              "Loss                 || grad ||            Stepsize  ls_iter   "
+              "Accur_train  Accur_val   Time(sec)\n");
+    }
+
+    /* Log of the adaptive braid tolerances */
+    if (config->braid_adaptivetol > 0.0) {
+      if (config->restart) {
+        tolfile = fopen("braidtol.dat", "a");
+      } else {
+        tolfile = fopen("braidtol.dat", "w");
+        fprintf(tolfile,
+                "#    || grad ||      tol             maxiter  tol_adj         "
+                "maxiter_adj\n");
+      }
+    }
+
+    /* Log of the residuals of the one-shot cycles */
+    if (config->braid_oneshot > 0) {
+      if (config->restart) {
+        oneshotfile = fopen("oneshot.dat", "a");
+      } else {
+        oneshotfile = fopen("oneshot.dat", "w");
+        fprintf(oneshotfile,
+                "#    micro  cycle  || r ||          || r_adj ||\n");
+      }
+    }
   }
 
   /* Measure wall time */
@@ -194,47 +484,203 @@ int main(int argc, char *argv[]) {
    * The following loop represents the paper's Algorithm (2)
    *
    */
-  for (int iter = 0; iter < config->maxoptimiter; iter++) {
+  for (int iter = iter_start; iter < config->maxoptimiter; iter++) {
     /* Set up the current batch */
-    trainingdata->selectBatch(config->batch_type, MPI_COMM_WORLD);
+    trainingdata->selectBatch(config->batch_type, layercomm);
+
+    /* Finish communication of the updated neighbouring layers */
+    network->MPI_CommunicateNeighboursComplete();
+
+    /* Prune the hidden weights once, further training keeps the pattern.
+     * After a restart, this restores the pattern of the pruned design. */
+    if (config->pruning > 0.0 && !pruned && iter >= config->pruning_iter) {
+      sparsity = network->pruneDesign(config->pruning);
+      pruned = 1;
+      if (myid == MASTER_NODE) {
+        printf("Pruned %.1f%% of the hidden weights.\n", 100.0 * sparsity);
+      }
+    }
+
+    /* Adapt the braid tolerances to the gradient norm of the last iteration:
+     * Inexact states and adjoints suffice as long as the gradient is large.
+     * The iteration caps follow from the residual reduction of the last run.
+     */
+    if (config->braid_adaptivetol > 0.0) {
+      if (iter > 0) {
+        braid_tol = std::max(config->braid_abstol,
+                             config->braid_adaptivetol * gnorm);
+        braid_toladj = std::max(config->braid_abstoladj,
+                                config->braid_adaptivetol * gnorm);
+        braid_maxit = primaltrainapp->setTolerance(braid_tol);
+        braid_maxitadj = adjointtrainapp->setTolerance(braid_toladj);
+      }
+      if (myid == MASTER_NODE) {
+        fprintf(tolfile, "%03d  %1.8e  %1.8e  %3d      %1.8e  %3d\n", iter,
+                gnorm, braid_tol, braid_maxit, braid_toladj, braid_maxitadj);
+        fflush(tolfile);
+      }
+    }
 
     /** Solve state and adjoint equations (2.15) and (2.17)
      *
      *  Algorithm (2): Step 1 and 2
+     *
+     *  The batch is processed in micro-batches, and split between the data
+     *  groups. Objective, loss, accuracy and gradient are accumulated,
+     *  weighted by the micro-batch size, and summed up over the data groups.
      */
-    rnorm = primaltrainapp->run();
-    rnorm_adj = adjointtrainapp->run();
+    checkgradient = config->braid_checkpointcheck > 0 &&
+                    iter % config->braid_checkpointcheck == 0;
+    if (checkgradient) primaltrainapp->setCheckpointReference(1, 0);
+
+    objective = 0.0;
+    loss_train = 0.0;
+    accur_train = 0.0;
+    rnorm = -1.0;
+    rnorm_adj = -1.0;
+    for (int imicro = 0; imicro < trainingdata->getnChunks(); imicro++) {
+      trainingdata->selectChunk(imicro);
+      microweight = trainingdata->getnBatch() / (MyReal)ntrainbatch;
+
+      /* Each micro-batch starts from a zero initial guess */
+      if (trainingdata->getnChunks() > 1) {
+        primaltrainapp->resetGrid();
+        adjointtrainapp->resetGrid();
+      }
 
-    /* Get output */
-    objective = primaltrainapp->getObjective();
-    loss_train = network->getLoss();
-    accur_train = network->getAccuracy();
+      rnorm_micro = 0.0;
+      rnorm_adj_micro = 0.0;
+      if (config->braid_oneshot > 0) {
+        /* One-shot: Alternate single primal and adjoint braid iterations,
+         * each one starting from the iterate of the previous cycle */
+        for (int icycle = 0; icycle < config->braid_oneshot; icycle++) {
+          rnorm_micro = primaltrainapp->run();
+          rnorm_adj_micro = adjointtrainapp->run();
+          if (myid == MASTER_NODE) {
+            fprintf(oneshotfile, "%03d  %3d    %3d    %1.8e  %1.8e\n", iter,
+                    imicro, icycle, rnorm_micro, rnorm_adj_micro);
+          }
+        }
+        if (myid == MASTER_NODE) fflush(oneshotfile);
+      } else {
+        rnorm_micro = primaltrainapp->run();
+        rnorm_adj_micro = adjointtrainapp->run();
+      }
+
+      /* Report the largest residual of all micro-batches */
+      rnorm = std::max(rnorm, rnorm_micro);
+      rnorm_adj = std::max(rnorm_adj, rnorm_adj_micro);
+
+      /* Get output */
+      objective += microweight * primaltrainapp->getObjective();
+      loss_train += microweight * network->getLoss();
+      accur_train += microweight * network->getAccuracy();
+
+      /* Solve the adjoint again with the primal states in full precision */
+      if (checkgradient) {
+        vec_copy(network->getnDesignLocal(), network->getGradient(),
+                 gradient_save);
+        primaltrainapp->setCheckpointReference(1, 1);
+        adjointtrainapp->run();
+        primaltrainapp->setCheckpointReference(1, 0);
+        if (imicro == 0) vec_setZero(network->getnDesignLocal(), gradient_ref);
+        vec_axpy(network->getnDesignLocal(), microweight,
+                 network->getGradient(), gradient_ref);
+        vec_copy(network->getnDesignLocal(), gradient_save,
+                 network->getGradient());
+      }
+
+      /* Accumulate the gradient, weighted by the share of the micro-batch in
+       * the batch of all data groups */
+      if (gradient_acc != NULL) {
+        if (imicro == 0) vec_setZero(network->getnDesignLocal(), gradient_acc);
+        vec_axpy(network->getnDesignLocal(), microweight,
+                 network->getGradient(), gradient_acc);
+      } else if (microweight != 1.0) {
+        vec_scale(network->getnDesignLocal(), microweight,
+                  network->getGradient());
+      }
+    }
+    if (gradient_acc != NULL) {
+      vec_copy(network->getnDesignLocal(), gradient_acc,
+               network->getGradient());
+    }
+
+    /* Relative error of the gradient against full precision primal states */
+    if (checkgradient) {
+      primaltrainapp->setCheckpointReference(0, 0);
+      vec_copy(network->getnDesignLocal(), network->getGradient(),
+               gradient_save);
+      vec_axpy(network->getnDesignLocal(), -1.0, gradient_ref, gradient_save);
+      if (config->ndatagroups > 1) {
+        MPI_Allreduce(MPI_IN_PLACE, gradient_save, network->getnDesignLocal(),
+                      MPI_MyReal, MPI_SUM, datacomm);
+        MPI_Allreduce(MPI_IN_PLACE, gradient_ref, network->getnDesignLocal(),
+                      MPI_MyReal, MPI_SUM, datacomm);
+      }
+      gerr = vecnorm_par(network->getnDesignLocal(), gradient_save, groupcomm);
+      MyReal gnorm_ref =
+          vecnorm_par(network->getnDesignLocal(), gradient_ref, groupcomm);
+      if (gnorm_ref > 0.0) gerr /= gnorm_ref;
+      gerr_max = std::max(gerr_max, gerr);
+      if (myid == MASTER_NODE) {
+        printf("Relative gradient error of the checkpoint precision: %1.8e\n",
+               gerr);
+      }
+    }
+
+    /* Project the gradient onto the coefficients */
+    if (config->weights_nbasis > 0) network->projectGradient();
+
+    MPI_Allreduce(MPI_IN_PLACE, &objective, 1, MPI_MyReal, MPI_SUM, datacomm);
+    MPI_Allreduce(MPI_IN_PLACE, &loss_train, 1, MPI_MyReal, MPI_SUM, datacomm);
+    MPI_Allreduce(MPI_IN_PLACE, &accur_train, 1, MPI_MyReal, MPI_SUM,
+                  datacomm);
+    MPI_Allreduce(MPI_IN_PLACE, &rnorm, 1, MPI_MyReal, MPI_MAX, datacomm);
+    MPI_Allreduce(MPI_IN_PLACE, &rnorm_adj, 1, MPI_MyReal, MPI_MAX, datacomm);
+    if (config->ndatagroups > 1 && pruned) {
+      network->MPI_AllreduceUnpruned(gradient, datacomm);
+    } else if (config->ndatagroups > 1) {
+      MPI_Allreduce(MPI_IN_PLACE, gradient, ndesign_local, MPI_MyReal,
+                    MPI_SUM, datacomm);
+    }
 
     /* --- Validation data: Get accuracy --- */
     if (config->validationlevel > 0) {
-      primalvalapp->run();
-      loss_val = network->getLoss();
-      accur_val = network->getAccuracy();
+      if (config->validation_type == FORWARD) {
+        network->evalForward(validationdata);
+        loss_val = network->getLoss();
+        accur_val = network->getAccuracy();
+      } else {
+        primalvalapp->runChunked(&loss_val, &accur_val);
+      }
+      loss_val *= valweight;
+      accur_val *= valweight;
+      MPI_Allreduce(MPI_IN_PLACE, &loss_val, 1, MPI_MyReal, MPI_SUM, datacomm);
+      MPI_Allreduce(MPI_IN_PLACE, &accur_val, 1, MPI_MyReal, MPI_SUM,
+                    datacomm);
     }
 
     /* --- Optimization control and output ---*/
 
+    /* Pruned weights stay zero */
+    if (pruned) network->applyPattern(gradient);
+
     /** Compute global gradient norm
      *
      *  Algorithm (2): Step 3
      */
-    gnorm = vecnorm_par(ndesign_local, network->getGradient(), MPI_COMM_WORLD);
+    gnorm = vecnorm_par(ndesign_local, gradient, groupcomm);
 
     /* Communicate loss and accuracy. This is actually only needed for output.
      * TODO: Remove it. */
     MPI_Allreduce(&loss_train, &losstrain_out, 1, MPI_MyReal, MPI_SUM,
-                  MPI_COMM_WORLD);
-    MPI_Allreduce(&loss_val, &lossval_out, 1, MPI_MyReal, MPI_SUM,
-                  MPI_COMM_WORLD);
+                  layercomm);
+    MPI_Allreduce(&loss_val, &lossval_out, 1, MPI_MyReal, MPI_SUM, layercomm);
     MPI_Allreduce(&accur_train, &accurtrain_out, 1, MPI_MyReal, MPI_SUM,
-                  MPI_COMM_WORLD);
+                  layercomm);
     MPI_Allreduce(&accur_val, &accurval_out, 1, MPI_MyReal, MPI_SUM,
-                  MPI_COMM_WORLD);
+                  layercomm);
 
     /* Output */
     StopTime = MPI_Wtime();
@@ -282,8 +728,9 @@ int main(int argc, char *argv[]) {
      *
      *  Algorithm (2): Step 4
      */
-    hessian->updateMemory(iter, network->getDesign(), network->getGradient());
-    hessian->computeAscentDir(iter, network->getGradient(), ascentdir);
+    hessian->updateMemory(iter, design, gradient);
+    hessian->computeAscentDir(iter, gradient, ascentdir);
+    if (pruned) network->applyPattern(ascentdir);
     stepsize = config->getStepsize(iter);
 
     /** Update the design/network control parameter in negative ascent direction
@@ -291,63 +738,153 @@ int main(int argc, char *argv[]) {
      *
      *  Algorithm (2): Step 5
      */
-    vec_axpy(ndesign_local, -1.0*stepsize, ascentdir, network->getDesign());
-    network->MPI_CommunicateNeighbours();
+    vec_axpy(ndesign_local, -1.0*stepsize, ascentdir, design);
+    if (config->weights_nbasis > 0) network->setDesignFromCoefficients();
+    network->MPI_CommunicateNeighboursStart();
 
     if (config->stepsize_type == BACKTRACKINGLS) {
       /* Compute wolfe condition */
-      wolfe = vecdot_par(ndesign_local, network->getGradient(), ascentdir,
-                         MPI_COMM_WORLD);
-
-      /* Start linesearch iterations */
+      wolfe = vecdot_par(ndesign_local, gradient, ascentdir, groupcomm);
+
+      /* Start linesearch iterations. Each iteration tests the ls_nparallel
+       * stepsizes ls_stepsize * ls_factor^k, k = 0, ..., ls_nparallel-1 at
+       * once: the data groups are split into ls_nparallel sets, set k
+       * evaluates the objective for stepsize k on the full batch. */
+      trainingdata->splitBatch(config->ndatagroups / ls_nparallel,
+                               datagroup % (config->ndatagroups / ls_nparallel));
       ls_stepsize = config->getStepsize(iter);
-      stepsize = ls_stepsize;
-      for (ls_iter = 0; ls_iter < config->ls_maxiter; ls_iter++) {
+      if (ls_id > 0) {
+        stepsize = ls_stepsize * pow(config->ls_factor, ls_id);
+        vec_axpy(ndesign_local, ls_stepsize - stepsize, ascentdir, design);
+        if (config->weights_nbasis > 0) network->setDesignFromCoefficients();
+        network->MPI_CommunicateNeighboursStart();
+      }
+      ls_best = ls_nparallel - 1;
+
+      /* One-shot limits the training solves to one braid iteration, the
+       * objectives of the line search need the full solves */
+      if (config->braid_oneshot > 0) {
+        primaltrainapp->getCore()->SetMaxIter(braid_maxit);
+      }
+      for (ls_iter = 0; ls_iter < config->ls_maxiter; ls_iter += ls_nparallel) {
+        network->MPI_CommunicateNeighboursComplete();
         primaltrainapp->getCore()->SetPrintLevel(0);
-        primaltrainapp->run();
-        ls_objective = primaltrainapp->getObjective();
+        for (int k = 0; k < ls_nparallel; k++) ls_objectives[k] = 0.0;
+        for (int imicro = 0; imicro < trainingdata->getnChunks(); imicro++) {
+          trainingdata->selectChunk(imicro);
+          microweight = trainingdata->getnBatch() / (MyReal)ntrainbatch;
+          if (trainingdata->getnChunks() > 1) primaltrainapp->resetGrid();
+          primaltrainapp->run();
+          ls_objectives[ls_id] += microweight * primaltrainapp->getObjective();
+        }
+        MPI_Allreduce(MPI_IN_PLACE, ls_objectives, ls_nparallel, MPI_MyReal,
+                      MPI_SUM, datacomm);
         primaltrainapp->getCore()->SetPrintLevel(config->braid_printlevel);
 
-        test_obj = objective - ls_param * ls_stepsize * wolfe;
-        if (myid == MASTER_NODE)
-          printf("ls_iter = %d:\tls_objective = %1.14e\ttest_obj = %1.14e\n",
-                 ls_iter, ls_objective, test_obj);
-        /* Test the wolfe condition */
-        if (ls_objective <= test_obj) {
+        /* Test the wolfe condition, starting with the largest stepsize */
+        ls_best = -1;
+        for (int k = 0; k < ls_nparallel; k++) {
+          ls_objective = ls_objectives[k];
+          test_obj = objective - ls_param * ls_stepsize *
+                                     pow(config->ls_factor, k) * wolfe;
+          if (myid == MASTER_NODE)
+            printf("ls_iter = %d:\tls_objective = %1.14e\ttest_obj = %1.14e\n",
+                   ls_iter + k, ls_objective, test_obj);
+          if (ls_objective <= test_obj) {
+            ls_best = k;
+            break;
+          }
+        }
+        if (ls_best >= 0) {
           /* Success, use this new design */
           break;
         } else {
-          /* Test for line-search failure */
-          if (ls_iter == config->ls_maxiter - 1) {
+          /* Test for line-search failure, use the last stepsize within
+           * ls_maxiter */
+          if (ls_iter + ls_nparallel >= config->ls_maxiter) {
             if (myid == MASTER_NODE)
               printf("\n\n   WARNING: LINESEARCH FAILED! \n\n");
+            ls_best = std::min(ls_nparallel, config->ls_maxiter - ls_iter) - 1;
             break;
           }
 
           /* Go back part of the step */
-          vec_axpy(ndesign_local, (1.0 - config->ls_factor) * stepsize, ascentdir, network->getDesign());
-          network->MPI_CommunicateNeighbours();
-
-          /* Decrease the stepsize */
-          ls_stepsize = ls_stepsize * config->ls_factor;
-          stepsize = ls_stepsize;
+          vec_axpy(ndesign_local,
+                   (1.0 - pow(config->ls_factor, ls_nparallel)) * stepsize,
+                   ascentdir, design);
+          if (config->weights_nbasis > 0)
+            network->setDesignFromCoefficients();
+          network->MPI_CommunicateNeighboursStart();
+
+          /* Decrease the stepsizes */
+          ls_stepsize = ls_stepsize * pow(config->ls_factor, ls_nparallel);
+          stepsize = stepsize * pow(config->ls_factor, ls_nparallel);
         }
       }
+      ls_iter += ls_best;
+      if (config->braid_oneshot > 0) primaltrainapp->getCore()->SetMaxIter(1);
+
+      /* All data groups continue with the design of the accepted stepsize */
+      if (ls_nparallel > 1) {
+        stepsize = ls_stepsize * pow(config->ls_factor, ls_best);
+        network->MPI_CommunicateNeighboursComplete();
+        MPI_Bcast(design, ndesign_local, MPI_MyReal,
+                  ls_best * (config->ndatagroups / ls_nparallel), datacomm);
+        if (config->weights_nbasis > 0) network->setDesignFromCoefficients();
+        network->MPI_CommunicateNeighboursStart();
+      }
+      trainingdata->splitBatch(config->ndatagroups, datagroup);
+    }
+
+    /* Write a checkpoint of the state for the next iteration */
+    if (config->checkpoint_interval > 0 &&
+        (iter + 1) % config->checkpoint_interval == 0) {
+      checkpointtime = MPI_Wtime();
+      err = writeCheckpoint(config->checkpoint_file, config, network,
+                            hessian, trainingdata, iter + 1, ls_iter,
+                            stepsize, gnorm, designwriter, MPI_COMM_WORLD);
+      checkpointtime = MPI_Wtime() - checkpointtime;
+
+      /* Stop, if the checkpoint can't be written. All processors agree. */
+      MPI_Allreduce(MPI_IN_PLACE, &err, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+      if (err) {
+        if (myid == MASTER_NODE)
+          printf("ERROR: Writing the checkpoint failed, stop optimization!\n");
+        break;
+      }
+      if (myid == MASTER_NODE)
+        printf("Checkpoint written to %s (%.2f sec)\n",
+               config->checkpoint_file, checkpointtime);
     }
   }
 
   /* --- Run final validation and write prediction file --- */
+  network->MPI_CommunicateNeighboursComplete();
   if (config->validationlevel > -1) {
     if (myid == MASTER_NODE) printf("\n --- Run final validation ---\n");
 
-    primalvalapp->getCore()->SetPrintLevel(0);
-    primalvalapp->run();
-    loss_val = network->getLoss();
+    if (config->validation_type == FORWARD) {
+      network->evalForward(validationdata);
+      loss_val = network->getLoss();
+      accur_val = network->getAccuracy();
+    } else {
+      primalvalapp->getCore()->SetPrintLevel(0);
+      primalvalapp->runChunked(&loss_val, &accur_val);
+    }
+    loss_val *= valweight;
+    accur_val *= valweight;
+    MPI_Allreduce(MPI_IN_PLACE, &loss_val, 1, MPI_MyReal, MPI_SUM, datacomm);
+    MPI_Allreduce(MPI_IN_PLACE, &accur_val, 1, MPI_MyReal, MPI_SUM, datacomm);
 
     printf("Final validation accuracy:  %2.2f%%\n", accur_val);
   }
 
-  // write_vector("design.dat", design, ndesign);
+  /* Write the trained network */
+  if (strcmp(config->modelfile_out, "NONE") != 0) {
+    network->writeModel(config->modelfile_out, designwriter, MPI_COMM_WORLD);
+    if (myid == MASTER_NODE) printf("Modelfile: %s\n", config->modelfile_out);
+  }
+
 
   /* Print some statistics */
   StopTime = MPI_Wtime();
@@ -355,12 +892,33 @@ int main(int argc, char *argv[]) {
   getrusage(RUSAGE_SELF, &r_usage);
   myMB = (MyReal)r_usage.ru_maxrss / 1024.0;
   MPI_Allreduce(&myMB, &globalMB, 1, MPI_MyReal, MPI_SUM, MPI_COMM_WORLD);
+  primaltrainapp->getCheckpointMemory(&mystoredMB, &myfullMB);
+  MPI_Allreduce(&mystoredMB, &storedMB, 1, MPI_MyReal, MPI_SUM, MPI_COMM_WORLD);
+  MPI_Allreduce(&myfullMB, &fullMB, 1, MPI_MyReal, MPI_SUM, MPI_COMM_WORLD);
+  storedMB /= 1024.0 * 1024.0;
+  fullMB /= 1024.0 * 1024.0;
+  openlayer_nevals = primaltrainapp->getnOpenLayerEvals();
+  if (primalvalapp != NULL) {
+    openlayer_nevals += primalvalapp->getnOpenLayerEvals();
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &openlayer_nevals, 1, MPI_INT, MPI_SUM,
+                MPI_COMM_WORLD);
 
   // printf("%d; Memory Usage: %.2f MB\n",myid, myMB);
   if (myid == MASTER_NODE) {
     printf("\n");
     printf(" Used Time:        %.2f seconds\n", UsedTime);
     printf(" Global Memory:    %.2f MB\n", globalMB);
+    if (config->braid_checkpointstride > 0 ||
+        config->braid_checkpointprecision != PREC_DOUBLE) {
+      printf(" Primal storage:   %.2f MB (compression ratio %.2f)\n", storedMB,
+             fullMB / storedMB);
+      if (config->braid_checkpointcheck > 0) {
+        printf(" Gradient error:   %1.2e (max. relative, checkpoint precision)\n",
+               gerr_max);
+      }
+    }
+    printf(" Opening layer:    %d evaluations\n", openlayer_nevals);
     printf(" Processors used:  %d\n", size);
     printf("\n");
   }
@@ -370,11 +928,15 @@ int main(int argc, char *argv[]) {
 
   delete primaltrainapp;
   delete adjointtrainapp;
-  delete primalvalapp;
+  if (primalvalapp != NULL) delete primalvalapp;
 
   /* Delete optimization vars */
   delete hessian;
   delete[] ascentdir;
+  if (gradient_acc != NULL) delete[] gradient_acc;
+  if (gradient_ref != NULL) delete[] gradient_ref;
+  if (gradient_save != NULL) delete[] gradient_save;
+  delete[] ls_objectives;
 
   /* Delete training and validation examples  */
   delete trainingdata;
@@ -384,10 +946,17 @@ int main(int argc, char *argv[]) {
   if (myid == MASTER_NODE) {
     fclose(optimfile);
     printf("Optimfile: %s\n", optimfilename);
+    if (tolfile != NULL) fclose(tolfile);
+    if (oneshotfile != NULL) fclose(oneshotfile);
   }
 
   delete config;
 
+  MPI_Comm_free(&layercomm);
+  MPI_Comm_free(&datacomm);
+  MPI_Comm_free(&channelcomm);
+  MPI_Comm_free(&groupcomm);
+
   MPI_Finalize();
   return 0;
 }
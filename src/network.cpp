@@ -35,7 +35,12 @@ Network::Network(MPI_Comm Comm) {
 
   ndesign_local = 0;
   ndesign_global = 0;
+  nreplica = 0;
   ndesign_layermax = 0;
+  designoffset = 0;
+  design_version = 0;
+  regul_local = 0.0;
+  regul_version = -1;
 
   design = NULL;
   gradient = NULL;
@@ -46,6 +51,38 @@ Network::Network(MPI_Comm Comm) {
 
   comm = Comm;
   MPI_Comm_rank(comm, &mpirank);
+
+  channelcomm = MPI_COMM_NULL;
+  sharedowner = 1;
+  npieces = 0;
+  pieceoffsets = NULL;
+  piecesizes = NULL;
+  designtype = MPI_DATATYPE_NULL;
+  sharedtype = MPI_DATATYPE_NULL;
+
+  sendlast = NULL;
+  recvlast = NULL;
+  sendfirst = NULL;
+  recvfirst = NULL;
+  nneighbourreqs = -1;
+  neighbours_pending = 0;
+
+  nunpruned = -1;
+  unprunedidx = NULL;
+  unprunedbuffer = NULL;
+
+  nbasis = 0;
+  basis_degree = 0;
+  ndesign_open = 0;
+  ndesign_hidden = 0;
+  ncoeffs_global = 0;
+  coeffcounts = NULL;
+  coeffdispls = NULL;
+  coeffs = NULL;
+  coeffs_grad = NULL;
+  coeffs_tmp = NULL;
+  phi = NULL;
+  coefftype = MPI_DATATYPE_NULL;
 }
 
 void Network::createLayerBlock(int StartLayerID, int EndLayerID, Config *config) {
@@ -57,9 +94,8 @@ void Network::createLayerBlock(int StartLayerID, int EndLayerID, Config *config)
   nchannels = config->nchannels;
   dt = (config->T) / (MyReal)(config->nlayers - 2);  // nlayers-2 = nhiddenlayers
 
-  ndesign_local = 0;
   int mylayermax = 0;
-
+  long long nlayerdesign = 0;
 
   /* Create vector of layers on this processor */
   layers = new Layer *[nlayers_local];  
@@ -67,7 +103,8 @@ void Network::createLayerBlock(int StartLayerID, int EndLayerID, Config *config)
 
     /* Create a layer */
     Layer* newlayer = createLayer(ilayer, config);
-    ndesign_local += newlayer->getnDesign();
+    if (channelcomm != MPI_COMM_NULL) newlayer->setChannelComm(channelcomm);
+    nlayerdesign += newlayer->getnDesign();
     // printf("creating hidden/class layer %d/%d, ndesign_local%d\n", ilayer,
     // nlayers_local, layers[storeID]->getnDesign());
 
@@ -79,21 +116,79 @@ void Network::createLayerBlock(int StartLayerID, int EndLayerID, Config *config)
     layers[getLocalID(ilayer)] = newlayer;
   }
 
-  /* Allocate memory for network design and gradient variables */
-  design = new MyReal[ndesign_local];
-  gradient = new MyReal[ndesign_local];
+  /* Communicate global ndesign and layermax */
+  long long nglobal;
+  MPI_Allreduce(&nlayerdesign, &nglobal, 1, MPI_LONG_LONG, MPI_SUM, comm);
+  MPI_Allreduce(&mylayermax, &ndesign_layermax, 1, MPI_INT, MPI_MAX, comm);
+  ndesign_global = nglobal;
+
+  /* Position of the local layers in the global design vector */
+  MPI_Exscan(&nlayerdesign, &designoffset, 1, MPI_LONG_LONG, MPI_SUM, comm);
+  if (mpirank == 0) designoffset = 0;
 
-  /* Set the memory locations for all layers */
+  /* Size of the local design: The weights of the local output channels of
+   * each layer, and the shared design variables if owned */
+  ndesign_local = 0;
+  nreplica = 0;
+  for (int ilayer = startlayerID; ilayer <= endlayerID; ilayer++) {
+    ndesign_local += getLayer(ilayer)->getnDesignSplit();
+    if (sharedowner) {
+      ndesign_local += getLayer(ilayer)->getnDesignShared();
+    } else {
+      nreplica += getLayer(ilayer)->getnDesignShared();
+    }
+  }
+
+  /* Allocate memory for network design and gradient variables, the replica
+   * of the shared variables goes behind the local design */
+  design = new MyReal[ndesign_local + nreplica];
+  gradient = new MyReal[ndesign_local + nreplica];
+  vec_setZero(ndesign_local + nreplica, design);
+  vec_setZero(ndesign_local + nreplica, gradient);
+
+  /* Set the memory locations for all layers and collect the pieces of the
+   * global design that are stored locally */
+  int *sharedsizes = new int[nlayers_local];
+  int *shareddispls = new int[nlayers_local];
+  int nshared = 0;
+  pieceoffsets = new long long[2 * nlayers_local];
+  piecesizes = new int[2 * nlayers_local];
+  npieces = 0;
   int istart = 0;
+  int ireplica = ndesign_local;
+  long long layeroffset = designoffset;
   for (int ilayer = startlayerID; ilayer <= endlayerID; ilayer++) 
   {
-    getLayer(ilayer)->setMemory(&(design[istart]), &(gradient[istart]));
-    istart += getLayer(ilayer)->getnDesign();
+    Layer *layer = getLayer(ilayer);
+    int nsplit = layer->getnDesignSplit();
+    int nlayershared = layer->getnDesignShared();
+    int isplit = istart;
+    istart += nsplit;
+    addPiece(layeroffset + layer->getSplitOffset(), nsplit);
+    if (sharedowner) {
+      sharedsizes[nshared] = nlayershared;
+      shareddispls[nshared] = istart;
+      nshared++;
+      addPiece(layeroffset + layer->getnDesign() - nlayershared,
+               nlayershared);
+      layer->setMemory(&(design[isplit]), &(gradient[isplit]),
+                       &(design[istart]), &(gradient[istart]));
+      istart += nlayershared;
+    } else {
+      layer->setMemory(&(design[isplit]), &(gradient[isplit]),
+                       &(design[ireplica]), &(gradient[ireplica]));
+      ireplica += nlayershared;
+    }
+    layeroffset += layer->getnDesign();
   }
-
-  /* Communicate global ndesign and layermax */
-  MPI_Allreduce(&ndesign_local, &ndesign_global, 1, MPI_INT, MPI_SUM, comm);
-  MPI_Allreduce(&mylayermax, &ndesign_layermax, 1, MPI_INT, MPI_MAX, comm);
+  MPI_CreateFileType(npieces, pieceoffsets, piecesizes, &designtype);
+  if (channelcomm != MPI_COMM_NULL && sharedowner) {
+    MPI_Type_indexed(nshared, sharedsizes, shareddispls, MPI_MyReal,
+                     &sharedtype);
+    MPI_Type_commit(&sharedtype);
+  }
+  delete[] sharedsizes;
+  delete[] shareddispls;
 
   /* Create left and right neighbouring layer */
   int leftID = startlayerID - 1;
@@ -103,18 +198,36 @@ void Network::createLayerBlock(int StartLayerID, int EndLayerID, Config *config)
 
   /* Allocate neighbouring layer's design, if exist on this proc */
   if (layer_left != NULL) {
-    MyReal *left_design = new MyReal[layer_left->getnDesign()];
-    MyReal *left_gradient = new MyReal[layer_left->getnDesign()];
+    if (channelcomm != MPI_COMM_NULL) layer_left->setChannelComm(channelcomm);
+    MyReal *left_design = new MyReal[layer_left->getnDesignLocal()];
+    MyReal *left_gradient = new MyReal[layer_left->getnDesignLocal()];
     layer_left->setMemory(left_design, left_gradient);
   }
   if (layer_right != NULL) {
-    MyReal *right_design = new MyReal[layer_right->getnDesign()];
-    MyReal *right_gradient = new MyReal[layer_right->getnDesign()];
+    if (channelcomm != MPI_COMM_NULL) layer_right->setChannelComm(channelcomm);
+    MyReal *right_design = new MyReal[layer_right->getnDesignLocal()];
+    MyReal *right_gradient = new MyReal[layer_right->getnDesignLocal()];
     layer_right->setMemory(right_design, right_gradient);
   }
 }
 
+void Network::addPiece(long long offset, int size) {
+  if (size == 0) return;
+
+  /* Extend the last piece, if contiguous */
+  if (npieces > 0 &&
+      pieceoffsets[npieces - 1] + piecesizes[npieces - 1] == offset) {
+    piecesizes[npieces - 1] += size;
+    return;
+  }
+  pieceoffsets[npieces] = offset;
+  piecesizes[npieces] = size;
+  npieces++;
+}
+
 Network::~Network() {
+  /* Free the persistent requests and buffers */
+  freeNeighbourRequests();
 
   /* Delete the layers */
   for (int ilayer = 0; ilayer < nlayers_local; ilayer++) {
@@ -125,6 +238,25 @@ Network::~Network() {
   /* Delete design and gradient */
   delete[] design;
   delete[] gradient;
+  delete[] pieceoffsets;
+  delete[] piecesizes;
+  if (designtype != MPI_DATATYPE_NULL) MPI_Type_free(&designtype);
+  if (sharedtype != MPI_DATATYPE_NULL) MPI_Type_free(&sharedtype);
+  if (coefftype != MPI_DATATYPE_NULL) MPI_Type_free(&coefftype);
+  if (unprunedidx != NULL) {
+    delete[] unprunedidx;
+    delete[] unprunedbuffer;
+  }
+
+  /* Delete the basis coefficients */
+  if (coeffs != NULL) {
+    delete[] coeffcounts;
+    delete[] coeffdispls;
+    delete[] coeffs;
+    delete[] coeffs_grad;
+    delete[] coeffs_tmp;
+    delete[] phi;
+  }
 
   /* Delete neighbouring layer information */
   if (layer_left != NULL) {
@@ -138,6 +270,7 @@ Network::~Network() {
     delete[] layer_right->getWeightsBar();
     delete layer_right;
   }
+
 }
 
 int Network::getnChannels() { return nchannels; }
@@ -159,10 +292,16 @@ int Network::getnDesignLocal() { return ndesign_local; }
 
 int Network::getnDesignGlobal() { return ndesign_global; }
 
+long long Network::getDesignOffset() { return designoffset; }
+
+MPI_Datatype Network::getDesignType() { return designtype; }
+
 MyReal *Network::getDesign() { return design; }
 
 MyReal *Network::getGradient() { return gradient; }
 
+int Network::getDesignVersion() { return design_version; }
+
 int Network::getStartLayerID() { return startlayerID; }
 int Network::getEndLayerID() { return endlayerID; }
 
@@ -194,9 +333,20 @@ Layer *Network::createLayer(int index, Config *config) {
   {
     switch (config->network_type) {
       case DENSE:
-        layer =
-            new DenseLayer(index, nchannels, nchannels, dt, config->activation,
-                           config->gamma_tik, config->gamma_ddt);
+        if (config->lowrank > 0) {
+          layer = new LowRankDenseLayer(index, nchannels, nchannels,
+                                        config->lowrank, dt,
+                                        config->activation, config->gamma_tik,
+                                        config->gamma_ddt);
+        } else if (config->pruning > 0.0) {
+          layer = new SparseDenseLayer(index, nchannels, nchannels, dt,
+                                       config->activation, config->gamma_tik,
+                                       config->gamma_ddt);
+        } else {
+          layer = new DenseLayer(index, nchannels, nchannels, dt,
+                                 config->activation, config->gamma_tik,
+                                 config->gamma_ddt);
+        }
         break;
       case CONVOLUTIONAL:
         // TODO: Fix
@@ -234,25 +384,59 @@ Layer *Network::getLayer(int layerindex) {
   return layer;
 }
 
+void Network::setChannelComm(MPI_Comm Channelcomm) {
+  int rank;
+  channelcomm = Channelcomm;
+  MPI_Comm_rank(channelcomm, &rank);
+  sharedowner = (rank == 0);
+}
+
+MPI_Comm Network::getChannelComm() { return channelcomm; }
+
 int Network::getnDesignLayermax() { return ndesign_layermax; }
 
 
-void Network::setDesignRandom(MyReal factor_open, MyReal factor_hidden, MyReal factor_classification) {
+void Network::setDesignRandom(MyReal factor_open, MyReal factor_hidden, MyReal factor_classification, int rng) {
   MyReal factor;
-  MyReal *design_init;
-  int myid;
-  MPI_Comm_rank(comm, &myid);
-
-  /* Create a random vector (do it on one processor for scaling test) */
-  if (myid == 0) {
-    srand(1.0);
-    design_init = new MyReal[ndesign_global];
-    for (int i = 0; i < ndesign_global; i++) {
-      design_init[i] = (MyReal)rand() / ((MyReal)RAND_MAX);
+  int idx = 0;
+
+  if (rng == RNG_COUNTER) {
+    /* Generate the local part of the random vector, keyed by the global
+     * index of each design variable */
+    for (int ip = 0; ip < npieces; ip++) {
+      for (int i = 0; i < piecesizes[ip]; i++) {
+        design[idx] = random_counter(pieceoffsets[ip] + i, 1);
+        idx++;
+      }
+    }
+  } else {
+    /* The sequence of rand() can't be split: The first processor generates
+     * the global random vector and scatters the design of the layers along
+     * the layers, the first processor of each channel group then scatters
+     * it into the pieces of the group */
+    int channelrank = 0;
+    if (channelcomm != MPI_COMM_NULL) MPI_Comm_rank(channelcomm, &channelrank);
+    MyReal *block = NULL;
+    if (channelrank == 0) {
+      int nblock = 0;
+      for (int ilayer = startlayerID; ilayer <= endlayerID; ilayer++) {
+        nblock += getLayer(ilayer)->getnDesign();
+      }
+      MyReal *design_init = NULL;
+      if (mpirank == 0) {
+        design_init = new MyReal[ndesign_global];
+        srand(1.0);
+        for (int i = 0; i < ndesign_global; i++) {
+          design_init[i] = (MyReal)rand() / ((MyReal)RAND_MAX);
+        }
+      }
+      block = new MyReal[nblock];
+      MPI_ScatterVector(design_init, block, nblock, 0, comm);
+      if (design_init != NULL) delete[] design_init;
     }
+    MPI_ScatterPieces(block);
+    if (block != NULL) delete[] block;
   }
-  /* Scatter random vector to local design for all procs */
-  MPI_ScatterVector(design_init, design, ndesign_local, 0, comm);
 
   /* Scale the weights and reset the gradien */
   for (int ilayer = startlayerID; ilayer <= endlayerID; ilayer++) {
@@ -263,17 +447,88 @@ void Network::setDesignRandom(MyReal factor_open, MyReal factor_hidden, MyReal f
     } else { // hidden layer
       factor = factor_hidden;
     }
-    vec_scale(getLayer(ilayer)->getnDesign(), factor, getLayer(ilayer)->getWeights());
-    vec_setZero(getLayer(ilayer)->getnDesign(), getLayer(ilayer)->getWeightsBar());
+    getLayer(ilayer)->scaleDesign(factor);
+    getLayer(ilayer)->resetGradient();
   }
 
   /* Communicate the neighbours across processors */
   MPI_CommunicateNeighbours();
+}
 
-  if (myid == 0) delete[] design_init;
 
-}
+void Network::MPI_ScatterPieces(MyReal *block) {
+  int idx = 0;
 
+  /* Without a channel split, the pieces are parts of the own block */
+  if (channelcomm == MPI_COMM_NULL) {
+    for (int ip = 0; ip < npieces; ip++) {
+      vec_copy(piecesizes[ip], &(block[pieceoffsets[ip] - designoffset]),
+               &(design[idx]));
+      idx += piecesizes[ip];
+    }
+    return;
+  }
+
+  /* Gather the pieces of all processors of the group on the first one. They
+   * store the same layers, hence the block is the same. */
+  int channelrank, channelsize;
+  int *npiecesall = NULL, *piecedispls = NULL;
+  int *sendcounts = NULL, *senddispls = NULL;
+  long long *offsetsall = NULL;
+  int *sizesall = NULL;
+  MyReal *sendbuffer = NULL;
+  MPI_Comm_rank(channelcomm, &channelrank);
+  MPI_Comm_size(channelcomm, &channelsize);
+  if (channelrank == 0) {
+    npiecesall = new int[channelsize];
+    piecedispls = new int[channelsize];
+  }
+  MPI_Gather(&npieces, 1, MPI_INT, npiecesall, 1, MPI_INT, 0, channelcomm);
+  int npiecestotal = 0;
+  if (channelrank == 0) {
+    for (int irank = 0; irank < channelsize; irank++) {
+      piecedispls[irank] = npiecestotal;
+      npiecestotal += npiecesall[irank];
+    }
+    offsetsall = new long long[npiecestotal];
+    sizesall = new int[npiecestotal];
+  }
+  MPI_Gatherv(pieceoffsets, npieces, MPI_LONG_LONG, offsetsall, npiecesall,
+              piecedispls, MPI_LONG_LONG, 0, channelcomm);
+  MPI_Gatherv(piecesizes, npieces, MPI_INT, sizesall, npiecesall,
+              piecedispls, MPI_INT, 0, channelcomm);
+
+  /* Pack the pieces of each processor behind each other and scatter them */
+  if (channelrank == 0) {
+    sendcounts = new int[channelsize];
+    senddispls = new int[channelsize];
+    int nsend = 0;
+    for (int ip = 0; ip < npiecestotal; ip++) nsend += sizesall[ip];
+    sendbuffer = new MyReal[nsend];
+    for (int irank = 0; irank < channelsize; irank++) {
+      senddispls[irank] = idx;
+      for (int ip = piecedispls[irank];
+           ip < piecedispls[irank] + npiecesall[irank]; ip++) {
+        vec_copy(sizesall[ip], &(block[offsetsall[ip] - designoffset]),
+                 &(sendbuffer[idx]));
+        idx += sizesall[ip];
+      }
+      sendcounts[irank] = idx - senddispls[irank];
+    }
+  }
+  MPI_Scatterv(sendbuffer, sendcounts, senddispls, MPI_MyReal, design,
+               ndesign_local, MPI_MyReal, 0, channelcomm);
+
+  if (channelrank == 0) {
+    delete[] npiecesall;
+    delete[] piecedispls;
+    delete[] offsetsall;
+    delete[] sizesall;
+    delete[] sendcounts;
+    delete[] senddispls;
+    delete[] sendbuffer;
+  }
+}
 
 void Network::setDesignFromFile(const char* datafolder, const char* openingfilename, const char* hiddenfilename, const char* classificationfilename) {
 
@@ -290,100 +545,540 @@ void Network::setDesignFromFile(const char* datafolder, const char* openingfilen
     sprintf(filename, "%s/%s", datafolder, classificationfilename);
     read_vector(filename, getLayer(nlayers_global-2)->getWeights(), getLayer(nlayers_global-2)->getnDesign());
   }
+
+  design_version++;
 }
 
-void Network::MPI_CommunicateNeighbours() {
-  int myid, comm_size;
-  MPI_Comm_rank(comm, &myid);
-  MPI_Comm_size(comm, &comm_size);
-  MPI_Request sendlastreq, recvlastreq;
-  MPI_Request sendfirstreq, recvfirstreq;
+/* Describe the local layers for the model file */
+static void describeLayers(Network *network, long long *desc) {
+  long long offset = network->getDesignOffset();
+  for (int ilayer = network->getStartLayerID();
+       ilayer <= network->getEndLayerID(); ilayer++) {
+    Layer *layer = network->getLayer(ilayer);
+    desc[0] = ilayer;
+    desc[1] = layer->getType();
+    desc[2] = layer->getActivation();
+    desc[3] = layer->getDimIn();
+    desc[4] = layer->getDimOut();
+    desc[5] = layer->getDimBias();
+    desc[6] = layer->getnWeights();
+    desc[7] = layer->getnConv();
+    desc[8] = layer->getCSize();
+    desc[9] = offset;
+    offset += layer->getnDesign();
+    desc += MODEL_NLAYERDESC;
+  }
+}
+
+int Network::writeModel(const char *filename, int write, MPI_Comm filecomm) {
+  MPI_File fh;
+  MPI_Status status;
+  MPI_Offset offset;
+  long long header[MODEL_NHEADER];
+  int myid, err;
+  MPI_Comm_rank(filecomm, &myid);
+
+  err = MPI_File_open(filecomm, (char *)filename,
+                      MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+  if (err != MPI_SUCCESS) {
+    if (myid == 0) printf("ERROR: Can't open model file %s!\n", filename);
+    return -1;
+  }
+  MPI_File_set_size(fh, 0);
+
+  /* Header, written by the first processor */
+  header[0] = MODEL_MAGIC;
+  header[1] = sizeof(MyReal);
+  header[2] = nlayers_global;
+  header[3] = nchannels;
+  header[4] = ndesign_global;
+  MPI_File_write_at_all(fh, 0, header, (myid == 0) ? MODEL_NHEADER : 0,
+                        MPI_LONG_LONG, &status);
+  offset = MODEL_NHEADER * sizeof(long long);
+  MPI_WriteVector(fh, offset, &dt, 1, 0, myid == 0);
+  offset += sizeof(MyReal);
+
+  /* Layer table, ordered by the layer index (starting with -1) */
+  long long *desc = new long long[nlayers_local * MODEL_NLAYERDESC];
+  describeLayers(this, desc);
+  MPI_File_write_at_all(
+      fh, offset + (startlayerID + 1) * MODEL_NLAYERDESC * sizeof(long long),
+      desc, (write && sharedowner) ? nlayers_local * MODEL_NLAYERDESC : 0,
+      MPI_LONG_LONG, &status);
+  offset += nlayers_global * MODEL_NLAYERDESC * sizeof(long long);
+  delete[] desc;
+
+  /* Design */
+  MPI_WriteVectorView(fh, offset, design, ndesign_local, designtype, write);
+
+  MPI_File_close(&fh);
+
+  return 0;
+}
+
+int Network::readModel(const char *filename, MPI_Comm filecomm) {
+  MPI_File fh;
   MPI_Status status;
+  MPI_Offset offset;
+  long long header[MODEL_NHEADER];
+  MyReal filedt;
+  int myid, err;
+  MPI_Comm_rank(filecomm, &myid);
+
+  err = MPI_File_open(filecomm, (char *)filename, MPI_MODE_RDONLY,
+                      MPI_INFO_NULL, &fh);
+  if (err != MPI_SUCCESS) {
+    if (myid == 0) printf("ERROR: Can't open model file %s!\n", filename);
+    return -1;
+  }
+
+  /* Check the header */
+  MPI_File_read_at_all(fh, 0, header, MODEL_NHEADER, MPI_LONG_LONG, &status);
+  offset = MODEL_NHEADER * sizeof(long long);
+  MPI_ReadVector(fh, offset, &filedt, 1, 0);
+  offset += sizeof(MyReal);
+  err = 0;
+  if (header[0] != MODEL_MAGIC || header[1] != (long long)sizeof(MyReal) ||
+      header[2] != nlayers_global || header[3] != nchannels ||
+      header[4] != ndesign_global) {
+    err = -1;
+  }
+
+  /* Check the descriptions of the local layers */
+  long long *desc = new long long[nlayers_local * MODEL_NLAYERDESC];
+  long long *filedesc = new long long[nlayers_local * MODEL_NLAYERDESC];
+  describeLayers(this, desc);
+  MPI_File_read_at_all(
+      fh, offset + (startlayerID + 1) * MODEL_NLAYERDESC * sizeof(long long),
+      filedesc, nlayers_local * MODEL_NLAYERDESC, MPI_LONG_LONG, &status);
+  offset += nlayers_global * MODEL_NLAYERDESC * sizeof(long long);
+  for (int i = 0; i < nlayers_local * MODEL_NLAYERDESC; i++) {
+    /* Dense and sparse dense layers share the design layout */
+    if (i % MODEL_NLAYERDESC == 1 &&
+        (desc[i] == Layer::DENSE || desc[i] == Layer::SPARSEDENSE) &&
+        (filedesc[i] == Layer::DENSE || filedesc[i] == Layer::SPARSEDENSE)) {
+      continue;
+    }
+    if (desc[i] != filedesc[i]) err = -1;
+  }
+  delete[] desc;
+  delete[] filedesc;
+
+  MPI_Allreduce(MPI_IN_PLACE, &err, 1, MPI_INT, MPI_MIN, filecomm);
+  if (err) {
+    if (myid == 0)
+      printf("ERROR: Model file %s doesn't match the network!\n", filename);
+    MPI_File_close(&fh);
+    return -1;
+  }
+  if (myid == 0 && filedt != dt)
+    printf("WARNING: Model file %s was trained with dt = %1.8e\n", filename,
+           filedt);
 
-  /* Allocate buffers */
-  int size_left = -1;
-  int size_right = -1;
+  /* Design */
+  MPI_ReadVectorView(fh, offset, design, ndesign_local, designtype);
 
-  MyReal *sendlast = 0;
-  MyReal *recvlast = 0;
-  MyReal *sendfirst = 0;
-  MyReal *recvfirst = 0;
+  MPI_File_close(&fh);
 
-  /* --- All but the first process receive the last layer from left neighbour
-   * --- */
-  if (myid > 0) {
-    /* Receive from left neighbour */
-    int source = myid - 1;
+  /* Communicate the neighbours across processors */
+  MPI_CommunicateNeighbours();
+
+  return 0;
+}
 
-    size_left = layer_left->getnDesign();
-    recvlast = new MyReal[size_left];
+MyReal Network::pruneDesign(MyReal fraction) {
+  long long counts[2] = {0, 0}; /* Number of zero and of all hidden weights */
 
-    MPI_Irecv(recvlast, size_left, MPI_MyReal, source, 0, comm, &recvlastreq);
+  /* Prune the local layers */
+  MPI_CommunicateNeighboursComplete();
+  for (int ilayer = startlayerID; ilayer <= endlayerID; ilayer++) {
+    SparseDenseLayer *layer =
+        dynamic_cast<SparseDenseLayer *>(getLayer(ilayer));
+    if (layer != NULL) layer->pruneWeights(fraction);
   }
 
-  /* --- All but the last process sent their last layer to right neighbour ---
-   */
-  if (myid < comm_size - 1) {
-    size_left = layers[getLocalID(endlayerID)]->getnDesign();
-    sendlast = new MyReal[size_left];
+  /* Send the pruned layers to the neighbours, all layers take the pattern of
+   * their nonzero weights */
+  MPI_CommunicateNeighbours();
+  for (int ilayer = startlayerID - 1; ilayer <= endlayerID + 1; ilayer++) {
+    SparseDenseLayer *layer =
+        dynamic_cast<SparseDenseLayer *>(getLayer(ilayer));
+    if (layer == NULL) continue;
+    layer->setPattern();
+    if (startlayerID <= ilayer && ilayer <= endlayerID) {
+      counts[0] += layer->getnWeightsLocal() - layer->getnNonzeros();
+      counts[1] += layer->getnWeightsLocal();
+    }
+  }
 
-    /* Pack the last layer into a buffer */
-    layers[getLocalID(endlayerID)]->packDesign(sendlast, size_left);
+  /* The packed layers have shrunk, new requests are needed */
+  freeNeighbourRequests();
 
-    /* Send to right neighbour */
-    int receiver = myid + 1;
-    MPI_Isend(sendlast, size_left, MPI_MyReal, receiver, 0, comm, &sendlastreq);
+  /* Find the local design variables that are left */
+  if (unprunedidx != NULL) {
+    delete[] unprunedidx;
+    delete[] unprunedbuffer;
   }
+  MyReal *mask = new MyReal[ndesign_local];
+  for (int i = 0; i < ndesign_local; i++) mask[i] = 1.0;
+  applyPattern(mask);
+  nunpruned = 0;
+  for (int i = 0; i < ndesign_local; i++) {
+    if (mask[i] != 0.0) nunpruned++;
+  }
+  unprunedidx = new int[nunpruned];
+  unprunedbuffer = new MyReal[nunpruned];
+  nunpruned = 0;
+  for (int i = 0; i < ndesign_local; i++) {
+    if (mask[i] != 0.0) unprunedidx[nunpruned++] = i;
+  }
+  delete[] mask;
 
-  /* --- All but the last processor recv the first layer from the right
-   * neighbour --- */
-  if (myid < comm_size - 1) {
-    /* Receive from right neighbour */
-    int source = myid + 1;
+  MPI_Allreduce(MPI_IN_PLACE, counts, 2, MPI_LONG_LONG, MPI_SUM, comm);
+  if (channelcomm != MPI_COMM_NULL) {
+    MPI_Allreduce(MPI_IN_PLACE, counts, 2, MPI_LONG_LONG, MPI_SUM,
+                  channelcomm);
+  }
+  if (counts[1] == 0) return 0.0;
+  return counts[0] / (MyReal)counts[1];
+}
+
+void Network::applyPattern(MyReal *vec) {
+  for (int ilayer = startlayerID; ilayer <= endlayerID; ilayer++) {
+    SparseDenseLayer *layer =
+        dynamic_cast<SparseDenseLayer *>(getLayer(ilayer));
+    if (layer != NULL) {
+      layer->applyPattern(&(vec[layer->getWeights() - design]));
+    }
+  }
+}
+
+void Network::MPI_AllreduceUnpruned(MyReal *vec, MPI_Comm comm) {
+  for (int i = 0; i < nunpruned; i++) unprunedbuffer[i] = vec[unprunedidx[i]];
+  MPI_Allreduce(MPI_IN_PLACE, unprunedbuffer, nunpruned, MPI_MyReal, MPI_SUM,
+                comm);
+  vec_setZero(ndesign_local, vec);
+  for (int i = 0; i < nunpruned; i++) vec[unprunedidx[i]] = unprunedbuffer[i];
+}
 
-    size_right = layer_right->getnDesign();
-    recvfirst = new MyReal[size_right];
+void Network::evalBasis(int ilayer, MyReal *phi) {
+  /* Hidden layers are equidistant in [0,1] */
+  MyReal s = 0.0;
+  if (nlayers_global > 3) s = ilayer / (MyReal)(nlayers_global - 3);
+  bspline_basis(basis_degree, nbasis, s, phi);
+}
 
-    MPI_Irecv(recvfirst, size_right, MPI_MyReal, source, 1, comm,
-              &recvfirstreq);
+void Network::projectLayers(MyReal *vec, MyReal *projected) {
+  vec_setZero(ncoeffs_global, projected);
+  for (int ilayer = startlayerID; ilayer <= endlayerID; ilayer++) {
+    Layer *layer = getLayer(ilayer);
+    int nlayerdesign = layer->getnDesign();
+    MyReal *layervec = &(vec[layer->getWeights() - design]);
+
+    if (ilayer == -1) {
+      vec_copy(nlayerdesign, layervec, projected);
+    } else if (ilayer == nlayers_global - 2) {
+      vec_copy(nlayerdesign, layervec,
+               &(projected[ncoeffs_global - nlayerdesign]));
+    } else {
+      evalBasis(ilayer, phi);
+      for (int k = 0; k < nbasis; k++) {
+        vec_axpy(nlayerdesign, phi[k], layervec,
+                 &(projected[ndesign_open + k * ndesign_hidden]));
+      }
+    }
   }
+}
 
-  /* --- All but the first processor send their first layer to the left
-   * neighbour --- */
-  if (myid > 0) {
-    size_right = layers[getLocalID(startlayerID)]->getnDesign();
-    sendfirst = new MyReal[size_right];
+void Network::evalLayerFromCoefficients(int ilayer, Layer *layer) {
+  int nlayerdesign = layer->getnDesign();
 
-    /* Pack the first layer into a buffer */
-    layers[getLocalID(startlayerID)]->packDesign(sendfirst, size_right);
+  if (ilayer == -1) {
+    vec_copy(nlayerdesign, coeffs, layer->getWeights());
+  } else if (ilayer == nlayers_global - 2) {
+    vec_copy(nlayerdesign, &(coeffs[ncoeffs_global - nlayerdesign]),
+             layer->getWeights());
+  } else {
+    evalBasis(ilayer, phi);
+    vec_setZero(nlayerdesign, layer->getWeights());
+    for (int k = 0; k < nbasis; k++) {
+      vec_axpy(nlayerdesign, phi[k],
+               &(coeffs[ndesign_open + k * ndesign_hidden]),
+               layer->getWeights());
+    }
+  }
+}
+
+void Network::setBasis(int nBasis, int degree) {
+  int comm_size;
+  int nsizes[3] = {0, 0, 0}; /* Design of opening, hidden and class. layer */
+  MyReal *gram;
+  MyReal *rhs;
+
+  MPI_Comm_size(comm, &comm_size);
+  nbasis = nBasis;
+  basis_degree = degree;
 
-    /* Send to left neighbour */
-    int receiver = myid - 1;
-    MPI_Isend(sendfirst, size_right, MPI_MyReal, receiver, 1, comm,
-              &sendfirstreq);
+  /* Sizes of the layers, same for all hidden layers */
+  for (int ilayer = startlayerID; ilayer <= endlayerID; ilayer++) {
+    if (ilayer == -1) {
+      nsizes[0] = getLayer(ilayer)->getnDesign();
+    } else if (ilayer == nlayers_global - 2) {
+      nsizes[2] = getLayer(ilayer)->getnDesign();
+    } else {
+      nsizes[1] = getLayer(ilayer)->getnDesign();
+    }
+  }
+  MPI_Allreduce(MPI_IN_PLACE, nsizes, 3, MPI_INT, MPI_MAX, comm);
+  ndesign_open = nsizes[0];
+  ndesign_hidden = nsizes[1];
+  ncoeffs_global = ndesign_open + nbasis * ndesign_hidden + nsizes[2];
+
+  /* Distribute the coefficients in blocks over the processors */
+  coeffcounts = new int[comm_size];
+  coeffdispls = new int[comm_size];
+  for (int irank = 0; irank < comm_size; irank++) {
+    coeffcounts[irank] = ncoeffs_global / comm_size;
+    if (irank < ncoeffs_global % comm_size) coeffcounts[irank]++;
+    coeffdispls[irank] = 0;
+    if (irank > 0)
+      coeffdispls[irank] = coeffdispls[irank - 1] + coeffcounts[irank - 1];
+  }
+  coeffs = new MyReal[ncoeffs_global];
+  coeffs_grad = new MyReal[ncoeffs_global];
+  coeffs_tmp = new MyReal[ncoeffs_global];
+  phi = new MyReal[nbasis + basis_degree];
+  vec_setZero(ncoeffs_global, coeffs_grad);
+  long long coeffoffset = coeffdispls[mpirank];
+  MPI_CreateFileType(1, &coeffoffset, &coeffcounts[mpirank], &coefftype);
+
+  /* Least-squares fit of the hidden coefficients to the design: The normal
+   * equations G c = P^T w with the Gram matrix G of the basis functions at
+   * the hidden layers are the same for each design variable. The opening and
+   * classification design are taken as they are. */
+  MPI_CommunicateNeighboursComplete();
+  projectLayers(design, coeffs);
+  MPI_Allreduce(MPI_IN_PLACE, coeffs, ncoeffs_global, MPI_MyReal, MPI_SUM,
+                comm);
+
+  gram = new MyReal[nbasis * nbasis];
+  rhs = new MyReal[nbasis];
+  vec_setZero(nbasis * nbasis, gram);
+  for (int ilayer = 0; ilayer < nlayers_global - 2; ilayer++) {
+    evalBasis(ilayer, phi);
+    for (int j = 0; j < nbasis; j++) {
+      for (int k = 0; k < nbasis; k++) gram[j * nbasis + k] += phi[j] * phi[k];
+    }
   }
 
-  /* Wait to finish up communication */
-  if (myid > 0) MPI_Wait(&recvlastreq, &status);
-  if (myid < comm_size - 1) MPI_Wait(&sendlastreq, &status);
-  if (myid < comm_size - 1) MPI_Wait(&recvfirstreq, &status);
-  if (myid > 0) MPI_Wait(&sendfirstreq, &status);
+  /* Cholesky factorization G = L L^T, L overwrites the lower part of G */
+  for (int j = 0; j < nbasis; j++) {
+    for (int k = 0; k < j; k++) {
+      gram[j * nbasis + j] -= gram[j * nbasis + k] * gram[j * nbasis + k];
+    }
+    gram[j * nbasis + j] = sqrt(gram[j * nbasis + j]);
+    for (int i = j + 1; i < nbasis; i++) {
+      for (int k = 0; k < j; k++) {
+        gram[i * nbasis + j] -= gram[i * nbasis + k] * gram[j * nbasis + k];
+      }
+      gram[i * nbasis + j] /= gram[j * nbasis + j];
+    }
+  }
 
-  /* Unpack and store the left received layer */
-  if (myid > 0) {
-    layer_left->unpackDesign(recvlast);
+  /* Forward and backward substitution for each hidden design variable */
+  for (int idesign = 0; idesign < ndesign_hidden; idesign++) {
+    MyReal *c = &(coeffs[ndesign_open + idesign]);
+    for (int j = 0; j < nbasis; j++) {
+      rhs[j] = c[j * ndesign_hidden];
+      for (int k = 0; k < j; k++) rhs[j] -= gram[j * nbasis + k] * rhs[k];
+      rhs[j] /= gram[j * nbasis + j];
+    }
+    for (int j = nbasis - 1; j >= 0; j--) {
+      for (int k = j + 1; k < nbasis; k++) {
+        rhs[j] -= gram[k * nbasis + j] * rhs[k];
+      }
+      rhs[j] /= gram[j * nbasis + j];
+      c[j * ndesign_hidden] = rhs[j];
+    }
+  }
+
+  delete[] gram;
+  delete[] rhs;
+
+  /* Continue with the fitted design */
+  setDesignFromCoefficients();
+  MPI_CommunicateNeighbours();
+}
+
+int Network::getnBasis() { return nbasis; }
+
+MyReal *Network::getCoefficients() { return &(coeffs[coeffdispls[mpirank]]); }
+
+MyReal *Network::getCoefficientsGradient() {
+  return &(coeffs_grad[coeffdispls[mpirank]]);
+}
+
+int Network::getnCoefficientsLocal() { return coeffcounts[mpirank]; }
+
+int Network::getnCoefficientsGlobal() { return ncoeffs_global; }
+
+long long Network::getCoefficientsOffset() { return coeffdispls[mpirank]; }
+
+MPI_Datatype Network::getCoefficientsType() { return coefftype; }
+
+void Network::setDesignFromCoefficients() {
+  MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, coeffs, coeffcounts,
+                 coeffdispls, MPI_MyReal, comm);
+
+  /* Finish a pending communication, it would overwrite the neighbours */
+  MPI_CommunicateNeighboursComplete();
+
+  for (int ilayer = startlayerID; ilayer <= endlayerID; ilayer++) {
+    evalLayerFromCoefficients(ilayer, getLayer(ilayer));
+  }
+  if (layer_left != NULL) evalLayerFromCoefficients(startlayerID - 1, layer_left);
+  if (layer_right != NULL) evalLayerFromCoefficients(endlayerID + 1, layer_right);
+}
+
+void Network::projectGradient() {
+  projectLayers(gradient, coeffs_tmp);
+  MPI_Reduce_scatter(coeffs_tmp, getCoefficientsGradient(), coeffcounts,
+                     MPI_MyReal, MPI_SUM, comm);
+}
+
+void Network::freeNeighbourRequests() {
+  MPI_CommunicateNeighboursComplete();
+  for (int ireq = 0; ireq < nneighbourreqs; ireq++) {
+    MPI_Request_free(&neighbourreqs[ireq]);
+  }
+  if (sendlast != NULL) delete[] sendlast;
+  if (recvlast != NULL) delete[] recvlast;
+  if (sendfirst != NULL) delete[] sendfirst;
+  if (recvfirst != NULL) delete[] recvfirst;
+  sendlast = NULL;
+  recvlast = NULL;
+  sendfirst = NULL;
+  recvfirst = NULL;
+  nneighbourreqs = -1;
+}
+
+void Network::MPI_CommunicateNeighbours() {
+  MPI_CommunicateNeighboursStart();
+  MPI_CommunicateNeighboursComplete();
+}
+
+void Network::MPI_CommunicateNeighboursStart() {
+  int myid, comm_size;
+  MPI_Comm_rank(comm, &myid);
+  MPI_Comm_size(comm, &comm_size);
+
+  /* Finish a previous communication */
+  MPI_CommunicateNeighboursComplete();
+
+  /* The design has changed */
+  design_version++;
+
+  /* Update the replica of the shared design variables */
+  if (channelcomm != MPI_COMM_NULL) {
+    if (sharedowner) {
+      MPI_Bcast(design, 1, sharedtype, 0, channelcomm);
+    } else {
+      MPI_Bcast(&(design[ndesign_local]), nreplica, MPI_MyReal, 0,
+                channelcomm);
+    }
+  }
+
+  /* With a basis in time, setDesignFromCoefficients() has evaluated the
+   * neighbouring layers already */
+  if (nbasis > 0) {
+    evalRegulLocal();
+    return;
+  }
+
+  /* Allocate buffers and create the persistent requests at first call */
+  if (nneighbourreqs < 0) {
+    nneighbourreqs = 0;
+
+    /* --- All but the first process receive the last layer from left
+     * neighbour and send their first layer to the left neighbour --- */
+    if (myid > 0) {
+      int size_left = layer_left->getnPacked();
+      recvlast = new MyReal[size_left];
+      MPI_Recv_init(recvlast, size_left, MPI_MyReal, myid - 1, 0, comm,
+                    &neighbourreqs[nneighbourreqs++]);
+
+      int size_first = layers[getLocalID(startlayerID)]->getnPacked();
+      sendfirst = new MyReal[size_first];
+      MPI_Send_init(sendfirst, size_first, MPI_MyReal, myid - 1, 1, comm,
+                    &neighbourreqs[nneighbourreqs++]);
+    }
+
+    /* --- All but the last process send their last layer to the right
+     * neighbour and receive the first layer from the right neighbour --- */
+    if (myid < comm_size - 1) {
+      int size_last = layers[getLocalID(endlayerID)]->getnPacked();
+      sendlast = new MyReal[size_last];
+      MPI_Send_init(sendlast, size_last, MPI_MyReal, myid + 1, 0, comm,
+                    &neighbourreqs[nneighbourreqs++]);
+
+      int size_right = layer_right->getnPacked();
+      recvfirst = new MyReal[size_right];
+      MPI_Recv_init(recvfirst, size_right, MPI_MyReal, myid + 1, 1, comm,
+                    &neighbourreqs[nneighbourreqs++]);
+    }
   }
 
-  /* Unpack and store the right received layer */
+  /* Pack the first and the last layer into the send buffers */
+  if (myid > 0) {
+    Layer *first = layers[getLocalID(startlayerID)];
+    first->packDesign(sendfirst, first->getnPacked());
+  }
   if (myid < comm_size - 1) {
-    layer_right->unpackDesign(recvfirst);
+    Layer *last = layers[getLocalID(endlayerID)];
+    last->packDesign(sendlast, last->getnPacked());
+  }
+
+  /* Start communication */
+  if (nneighbourreqs > 0) MPI_Startall(nneighbourreqs, neighbourreqs);
+  neighbours_pending = 1;
+
+  /* Meanwhile, evaluate the local part of the regularization */
+  evalRegulLocal();
+}
+
+void Network::MPI_CommunicateNeighboursComplete() {
+  if (!neighbours_pending) return;
+
+  /* Wait to finish up communication */
+  if (nneighbourreqs > 0) {
+    MPI_Waitall(nneighbourreqs, neighbourreqs, MPI_STATUSES_IGNORE);
+  }
+  neighbours_pending = 0;
+
+  /* Unpack and store the received layers */
+  if (recvlast != NULL) layer_left->unpackDesign(recvlast);
+  if (recvfirst != NULL) layer_right->unpackDesign(recvfirst);
+}
+
+void Network::evalRegulLocal() {
+  regul_local = 0.0;
+  for (int ilayer = startlayerID; ilayer <= endlayerID; ilayer++) {
+    Layer *layer = getLayer(ilayer);
+    regul_local += layer->evalTikh();
+    if (ilayer > startlayerID) {
+      regul_local += layer->evalRegulDDT(getLayer(ilayer - 1), dt);
+    }
   }
+  regul_version = design_version;
+}
+
+MyReal Network::evalRegularization() {
+  MPI_CommunicateNeighboursComplete();
+  if (regul_version != design_version) evalRegulLocal();
 
-  /* Free the buffer */
-  if (sendlast != 0) delete[] sendlast;
-  if (recvlast != 0) delete[] recvlast;
-  if (sendfirst != 0) delete[] sendfirst;
-  if (recvfirst != 0) delete[] recvfirst;
+  /* Add the DDT term of the first layer, which needs layer_left */
+  Layer *first = getLayer(startlayerID);
+  return regul_local + first->evalRegulDDT(layer_left, dt);
 }
 
 void Network::evalClassification(DataSet *data, MyReal **state, int output) {
@@ -435,6 +1130,99 @@ void Network::evalClassification(DataSet *data, MyReal **state, int output) {
   delete[] tmpstate;
 }
 
+void Network::evalForward(DataSet *data) {
+  int nchunk = data->getnBatchMax();
+  int nelements, nex, ibuf, class_id;
+  int success = 0;
+  MyReal *state;
+  ClassificationLayer *classificationlayer = NULL;
+
+  /* Get classification layer, if stored on this processor */
+  if (endlayerID == nlayers_global - 2) {
+    classificationlayer =
+        dynamic_cast<ClassificationLayer *>(getLayer(nlayers_global - 2));
+    if (classificationlayer == NULL) {
+      printf("\n ERROR: Network can't access classification layer!\n\n");
+      exit(1);
+    }
+  }
+
+  /* Allocate two chunk buffers, so that sending one chunk overlaps with
+   * computing the next one */
+  MyReal *chunk[2];
+  MPI_Request sendreq[2] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL};
+  chunk[0] = new MyReal[nchunk * nchannels];
+  chunk[1] = new MyReal[nchunk * nchannels];
+  MyReal **states = new MyReal *[nchunk];
+
+  loss = 0.0;
+  accuracy = 0.0;
+  nelements = 0;
+  ibuf = 0;
+  for (int ichunk = 0; ichunk < data->getnChunks(); ichunk++) {
+    data->selectChunk(ichunk);
+    nex = data->getnBatch();
+    state = chunk[ibuf];
+
+    /* Wait until the previous send from this buffer has finished */
+    MPI_Wait(&sendreq[ibuf], MPI_STATUS_IGNORE);
+
+    if (startlayerID == -1) {
+      /* First processor applies the opening layer */
+      Layer *openlayer = getLayer(-1);
+      for (int iex = 0; iex < nex; iex++) {
+        openlayer->setExample(data->getExample(iex));
+        openlayer->applyFWD(&state[iex * nchannels]);
+      }
+    } else {
+      /* Receive the states from the left neighbour */
+      MPI_Recv(state, nex * nchannels, MPI_MyReal, mpirank - 1, 2, comm,
+               MPI_STATUS_IGNORE);
+    }
+
+    /* Apply the local hidden layers */
+    for (int iex = 0; iex < nex; iex++) states[iex] = &state[iex * nchannels];
+    for (int ilayer = std::max(startlayerID, 0);
+         ilayer <= std::min(endlayerID, nlayers_global - 3); ilayer++) {
+      Layer *layer = getLayer(ilayer);
+      layer->setDt(dt);
+      layer->applyFWDBatch(states, nex);
+    }
+
+    if (classificationlayer != NULL) {
+      /* Apply classification and evaluate loss and accuracy */
+      for (int iex = 0; iex < nex; iex++) {
+        classificationlayer->setLabel(data->getLabel(iex));
+        classificationlayer->applyFWD(&state[iex * nchannels]);
+        loss += classificationlayer->crossEntropy(&state[iex * nchannels]);
+        success +=
+            classificationlayer->prediction(&state[iex * nchannels], &class_id);
+      }
+    } else {
+      /* Send the states to the right neighbour */
+      MPI_Isend(state, nex * nchannels, MPI_MyReal, mpirank + 1, 2, comm,
+                &sendreq[ibuf]);
+    }
+    nelements += nex;
+
+    /* Switch buffer */
+    ibuf = 1 - ibuf;
+  }
+
+  /* Finish communication */
+  MPI_Waitall(2, sendreq, MPI_STATUSES_IGNORE);
+
+  /* Set loss and accuracy */
+  if (classificationlayer != NULL) {
+    loss = 1. / nelements * loss;
+    accuracy = 100.0 * ((MyReal)success) / nelements;
+  }
+
+  delete[] chunk[0];
+  delete[] chunk[1];
+  delete[] states;
+}
+
 void Network::evalClassification_diff(DataSet *data, MyReal **primalstate,
                                       MyReal **adjointstate,
                                       int compute_gradient) {
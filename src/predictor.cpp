@@ -0,0 +1,589 @@
+// Copyright
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Underlying paper:
+//
+// Layer-Parallel Training of Deep Residual Neural Networks
+// S. Guenther, L. Ruthotto, J.B. Schroder, E.C. Czr, and N.R. Gauger
+//
+// Download: https://arxiv.org/pdf/1812.04352.pdf
+//
+#include "predictor.hpp"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* Int8 GEMM with int32 accumulation: C = A * B^T, where A is m x k, B is
+ * n x k and C is m x n, all stored row-major */
+static void gemm_int8(int m, int n, int k, const signed char *A,
+                      const signed char *B, int *C) {
+  for (int i = 0; i < m; i++) {
+    const signed char *a = &(A[i * k]);
+    for (int j = 0; j < n; j++) {
+      const signed char *b = &(B[j * k]);
+      int acc = 0;
+      for (int l = 0; l < k; l++) {
+        acc += a[l] * b[l];
+      }
+      C[i * n + j] = acc;
+    }
+  }
+}
+
+/* Round x * invscale to the nearest integer in [-127, 127] */
+static signed char quantize_int8(MyReal x, MyReal invscale) {
+  MyReal q = nearbyint(x * invscale);
+  if (q > 127.0) q = 127.0;
+  if (q < -127.0) q = -127.0;
+  return (signed char)q;
+}
+
+Predictor::Predictor() {
+  nlayers = 0;
+  nchannels = 0;
+  nfeatures = 0;
+  nclasses = 0;
+  dt = 0.0;
+  layerdesc = NULL;
+  ndesign = 0;
+  design = NULL;
+  gradient = NULL;
+  layers = NULL;
+  states = NULL;
+  qweights = NULL;
+  wscale = NULL;
+  yscale = NULL;
+  qstates = NULL;
+  accums = NULL;
+  exitcriterion = EXIT_NONE;
+  exitthreshold = 0.0;
+  exitinterval = 1;
+  prevstates = NULL;
+  exitslots = NULL;
+  nlayers_applied = 0;
+  nexamples = 0;
+#ifdef _OPENMP
+  nthreads = omp_get_max_threads();
+#else
+  nthreads = 1;
+#endif
+}
+
+Predictor::~Predictor() { clear(); }
+
+void Predictor::clear() {
+  if (layers != NULL) {
+    for (int ithread = 0; ithread < nthreads; ithread++) {
+      for (int ilayer = 0; ilayer < nlayers; ilayer++) {
+        delete layers[ithread][ilayer];
+      }
+      delete[] layers[ithread];
+      delete[] states[ithread];
+      delete[] qstates[ithread];
+      delete[] accums[ithread];
+      delete[] prevstates[ithread];
+      delete[] exitslots[ithread];
+    }
+    delete[] layers;
+    delete[] states;
+    delete[] qstates;
+    delete[] accums;
+    delete[] prevstates;
+    delete[] exitslots;
+    layers = NULL;
+  }
+  if (qweights != NULL) {
+    for (int ilayer = 0; ilayer < nlayers; ilayer++) {
+      if (qweights[ilayer] != NULL) delete[] qweights[ilayer];
+    }
+    delete[] qweights;
+    delete[] wscale;
+    delete[] yscale;
+    qweights = NULL;
+  }
+  if (layerdesc != NULL) delete[] layerdesc;
+  if (design != NULL) delete[] design;
+  if (gradient != NULL) delete[] gradient;
+  layerdesc = NULL;
+  design = NULL;
+  gradient = NULL;
+}
+
+Layer *Predictor::createLayer(long long *desc) {
+  int index = desc[0];
+  int activ = desc[2];
+  int dimI = desc[3];
+  int dimO = desc[4];
+  int nconv = desc[7];
+  int csize = desc[8];
+  Layer *layer = NULL;
+
+  /* Regularization doesn't matter for inference */
+  switch (desc[1]) {
+    case Layer::OPENZERO:
+      layer = new OpenExpandZero(dimI, dimO);
+      break;
+    case Layer::OPENDENSE:
+      layer = new OpenDenseLayer(dimI, dimO, activ, 0.0);
+      break;
+    case Layer::DENSE:
+      layer = new DenseLayer(index, dimI, dimO, dt, activ, 0.0, 0.0);
+      break;
+    case Layer::SPARSEDENSE:
+      layer = new SparseDenseLayer(index, dimI, dimO, dt, activ, 0.0, 0.0);
+      break;
+    case Layer::LOWRANK:
+      layer = new LowRankDenseLayer(index, dimI, dimO,
+                                    desc[6] / (dimI + dimO), dt, activ, 0.0,
+                                    0.0);
+      break;
+    case Layer::CLASSIFICATION:
+      layer = new ClassificationLayer(index, dimI, dimO, 0.0);
+      break;
+    case Layer::OPENCONV:
+      layer = new OpenConvLayer(dimI, dimO);
+      break;
+    case Layer::OPENCONVMNIST:
+      layer = new OpenConvLayerMNIST(dimI, dimO);
+      break;
+    case Layer::CONVOLUTION:
+      layer = new ConvLayer(index, dimI, dimO, csize, nconv, dt, activ, 0.0,
+                            0.0);
+      break;
+  }
+
+  return layer;
+}
+
+int Predictor::createThreads(long long *desc) {
+  int err = 0;
+
+  layers = new Layer **[nthreads];
+  states = new MyReal *[nthreads];
+  qstates = new signed char *[nthreads];
+  accums = new int *[nthreads];
+  prevstates = new MyReal *[nthreads];
+  exitslots = new int *[nthreads];
+  for (int ithread = 0; ithread < nthreads; ithread++) {
+    layers[ithread] = new Layer *[nlayers];
+    states[ithread] = new MyReal[PREDICT_BLOCK * nchannels];
+    qstates[ithread] = new signed char[PREDICT_BLOCK * nchannels];
+    accums[ithread] = new int[PREDICT_BLOCK * nchannels];
+    prevstates[ithread] = new MyReal[PREDICT_BLOCK * nchannels];
+    exitslots[ithread] = new int[PREDICT_BLOCK];
+    for (int ilayer = 0; ilayer < nlayers; ilayer++) {
+      long long *ldesc = &(desc[ilayer * MODEL_NLAYERDESC]);
+      Layer *layer = createLayer(ldesc);
+      if (layer == NULL) {
+        printf("ERROR: Unknown layer type %lld!\n", ldesc[1]);
+        layer = new OpenExpandZero(0, 0);
+        err = -1;
+      }
+      layer->setMemory(&(design[ldesc[9]]), &(gradient[ldesc[9]]));
+      layers[ithread][ilayer] = layer;
+
+      /* Pruned layers only apply their nonzero weights */
+      SparseDenseLayer *sparse = dynamic_cast<SparseDenseLayer *>(layer);
+      if (sparse != NULL) sparse->setPattern();
+    }
+  }
+
+  return err;
+}
+
+int Predictor::load(const char *filename) {
+  FILE *file;
+  long long header[MODEL_NHEADER];
+  int err = 0;
+
+  clear();
+
+  /* Open file */
+  file = fopen(filename, "rb");
+  if (file == NULL) {
+    printf("Can't open %s \n", filename);
+    return -1;
+  }
+
+  /* Read the header */
+  if (fread(header, sizeof(long long), MODEL_NHEADER, file) != MODEL_NHEADER ||
+      fread(&dt, sizeof(MyReal), 1, file) != 1 ||
+      (header[0] != MODEL_MAGIC && header[0] != MODEL_MAGIC_INT8) ||
+      header[1] != (long long)sizeof(MyReal)) {
+    printf("ERROR: %s is not a model file of this precision!\n", filename);
+    fclose(file);
+    return -1;
+  }
+  nlayers = header[2];
+  nchannels = header[3];
+  ndesign = header[4];
+
+  /* Read the layer table */
+  layerdesc = new long long[nlayers * MODEL_NLAYERDESC];
+  design = new MyReal[ndesign];
+  gradient = new MyReal[ndesign];
+  if (fread(layerdesc, sizeof(long long), nlayers * MODEL_NLAYERDESC, file) !=
+      (size_t)(nlayers * MODEL_NLAYERDESC)) {
+    err = -1;
+  }
+
+  /* Read the design, the int8 file stores the weights of the quantized layers
+   * with their scales. They are dequantized into the design as well. */
+  if (!err && header[0] == MODEL_MAGIC) {
+    if (fread(design, sizeof(MyReal), ndesign, file) != (size_t)ndesign) {
+      err = -1;
+    }
+  } else if (!err) {
+    qweights = new signed char *[nlayers];
+    wscale = new MyReal[nlayers];
+    yscale = new MyReal[nlayers];
+    for (int ilayer = 0; ilayer < nlayers && !err; ilayer++) {
+      long long *ldesc = &(layerdesc[ilayer * MODEL_NLAYERDESC]);
+      MyReal *ldesign = &(design[ldesc[9]]);
+      int nweights = ldesc[6];
+      int nlayerdesign = ldesc[5] + ldesc[6];
+      MyReal scales[2];
+      qweights[ilayer] = NULL;
+      wscale[ilayer] = 1.0;
+      yscale[ilayer] = 1.0;
+      if (ldesc[1] == Layer::DENSE) {
+        qweights[ilayer] = new signed char[nweights];
+        if (fread(scales, sizeof(MyReal), 2, file) != 2 ||
+            fread(qweights[ilayer], 1, nweights, file) != (size_t)nweights ||
+            fread(&(ldesign[nweights]), sizeof(MyReal), ldesc[5], file) !=
+                (size_t)ldesc[5]) {
+          err = -1;
+        }
+        wscale[ilayer] = scales[0];
+        yscale[ilayer] = scales[1];
+        for (int i = 0; i < nweights; i++) {
+          ldesign[i] = wscale[ilayer] * qweights[ilayer][i];
+        }
+      } else if (fread(ldesign, sizeof(MyReal), nlayerdesign, file) !=
+                 (size_t)nlayerdesign) {
+        err = -1;
+      }
+    }
+  }
+  fclose(file);
+  if (err) {
+    printf("ERROR: Can't read model file %s!\n", filename);
+    clear();
+    nlayers = 0;
+    return -1;
+  }
+  nfeatures = layerdesc[3];
+  nclasses = layerdesc[(nlayers - 1) * MODEL_NLAYERDESC + 4];
+
+  /* Create the layers of each thread, sharing the design */
+  err = createThreads(layerdesc);
+  if (err) {
+    clear();
+    nlayers = 0;
+  }
+  return err;
+}
+
+int Predictor::save(const char *filename) {
+  FILE *file;
+  long long header[MODEL_NHEADER];
+
+  file = fopen(filename, "wb");
+  if (file == NULL) {
+    printf("Can't open %s \n", filename);
+    return -1;
+  }
+
+  header[0] = isQuantized() ? MODEL_MAGIC_INT8 : MODEL_MAGIC;
+  header[1] = sizeof(MyReal);
+  header[2] = nlayers;
+  header[3] = nchannels;
+  header[4] = ndesign;
+  fwrite(header, sizeof(long long), MODEL_NHEADER, file);
+  fwrite(&dt, sizeof(MyReal), 1, file);
+  fwrite(layerdesc, sizeof(long long), nlayers * MODEL_NLAYERDESC, file);
+
+  if (!isQuantized()) {
+    fwrite(design, sizeof(MyReal), ndesign, file);
+  } else {
+    for (int ilayer = 0; ilayer < nlayers; ilayer++) {
+      long long *ldesc = &(layerdesc[ilayer * MODEL_NLAYERDESC]);
+      MyReal *ldesign = &(design[ldesc[9]]);
+      int nweights = ldesc[6];
+      if (qweights[ilayer] != NULL) {
+        MyReal scales[2] = {wscale[ilayer], yscale[ilayer]};
+        fwrite(scales, sizeof(MyReal), 2, file);
+        fwrite(qweights[ilayer], 1, nweights, file);
+        fwrite(&(ldesign[nweights]), sizeof(MyReal), ldesc[5], file);
+      } else {
+        fwrite(ldesign, sizeof(MyReal), ldesc[5] + ldesc[6], file);
+      }
+    }
+  }
+
+  fclose(file);
+  return 0;
+}
+
+void Predictor::quantize(const MyReal *calibration, int n) {
+  MyReal *state = states[0];
+  Layer **chain = layers[0];
+
+  if (isQuantized()) return;
+
+  /* Calibrate: maximum state entering each layer */
+  MyReal *ymax = new MyReal[nlayers];
+  for (int ilayer = 0; ilayer < nlayers; ilayer++) ymax[ilayer] = 0.0;
+  for (int iex = 0; iex < n; iex++) {
+    chain[0]->setExample((MyReal *)&(calibration[(size_t)iex * nfeatures]));
+    for (int ilayer = 0; ilayer < nlayers; ilayer++) {
+      if (ilayer > 0) {
+        for (int ic = 0; ic < nchannels; ic++) {
+          ymax[ilayer] = std::max(ymax[ilayer], fabs(state[ic]));
+        }
+      }
+      chain[ilayer]->applyFWD(state);
+    }
+  }
+
+  /* Quantize the weights of the hidden dense layers */
+  int nskipped = 0;
+  qweights = new signed char *[nlayers];
+  wscale = new MyReal[nlayers];
+  yscale = new MyReal[nlayers];
+  for (int ilayer = 0; ilayer < nlayers; ilayer++) {
+    Layer *layer = chain[ilayer];
+    int nweights = layer->getnWeights();
+    MyReal *weights = layer->getWeights();
+
+    qweights[ilayer] = NULL;
+    wscale[ilayer] = 1.0;
+    yscale[ilayer] = 1.0;
+    if (layer->getType() == Layer::SPARSEDENSE ||
+        layer->getType() == Layer::LOWRANK) {
+      nskipped++;
+    }
+    if (layer->getType() != Layer::DENSE || nweights <= 0) continue;
+
+    MyReal wmax = 0.0;
+    for (int i = 0; i < nweights; i++) wmax = std::max(wmax, fabs(weights[i]));
+    if (wmax > 0.0) wscale[ilayer] = wmax / 127.0;
+    if (ymax[ilayer] > 0.0) yscale[ilayer] = ymax[ilayer] / 127.0;
+
+    qweights[ilayer] = new signed char[nweights];
+    for (int i = 0; i < nweights; i++) {
+      qweights[ilayer][i] = quantize_int8(weights[i], 1.0 / wscale[ilayer]);
+    }
+  }
+
+  /* Pruned and low-rank layers have no int8 kernel */
+  if (nskipped > 0) {
+    printf(
+        "WARNING: %d pruned or low-rank hidden layers are not quantized, they "
+        "stay in floating point!\n",
+        nskipped);
+  }
+
+  delete[] ymax;
+}
+
+int Predictor::isQuantized() { return qweights != NULL; }
+
+int Predictor::getnFeatures() { return nfeatures; }
+
+int Predictor::getnClasses() { return nclasses; }
+
+int Predictor::getnLayers() { return nlayers; }
+
+void Predictor::setnThreads(int nThreads) {
+  /* The layers of each thread are created when loading the model */
+  if (layers != NULL) {
+    printf("WARNING: Set the number of threads before loading the model!\n");
+    return;
+  }
+  nthreads = nThreads;
+}
+
+void Predictor::setEarlyExit(int criterion, MyReal threshold, int interval) {
+  exitcriterion = criterion;
+  exitthreshold = threshold;
+  exitinterval = std::max(1, interval);
+}
+
+MyReal Predictor::getAverageLayers() {
+  if (nexamples == 0) return 0.0;
+  return nlayers_applied / (MyReal)nexamples;
+}
+
+void Predictor::resetStatistics() {
+  nlayers_applied = 0;
+  nexamples = 0;
+}
+
+int Predictor::checkExit(int ithread, int islot) {
+  Layer *classification = layers[ithread][nlayers - 1];
+  MyReal *state = &(states[ithread][islot * nchannels]);
+  MyReal *prev = &(prevstates[ithread][islot * nchannels]);
+
+  if (exitcriterion == EXIT_UPDATE) {
+    /* Relative norm of the update of the last layer */
+    MyReal dnorm = 0.0;
+    MyReal ynorm = 0.0;
+    for (int ic = 0; ic < nchannels; ic++) {
+      dnorm += (state[ic] - prev[ic]) * (state[ic] - prev[ic]);
+      ynorm += prev[ic] * prev[ic];
+    }
+    if (dnorm > exitthreshold * exitthreshold * ynorm) return 0;
+    classification->applyFWD(state);
+    return 1;
+  }
+
+  /* EXIT_CONFIDENCE: Classify a copy of the state. The logits are shifted
+   * by their maximum, hence the maximum probability is 1 / sum(exp). */
+  MyReal exp_sum = 0.0;
+  for (int ic = 0; ic < nchannels; ic++) prev[ic] = state[ic];
+  classification->applyFWD(prev);
+  for (int ic = 0; ic < nclasses; ic++) exp_sum += exp(prev[ic]);
+  if (1.0 / exp_sum < exitthreshold) return 0;
+  for (int ic = 0; ic < nchannels; ic++) state[ic] = prev[ic];
+  return 1;
+}
+
+void Predictor::classify(const MyReal *logits, int iex, int *classes,
+                         MyReal *probabilities) {
+  MyReal exp_sum = 0.0;
+  int class_id = 0;
+
+  /* The classification layer returns the logits, shifted by their maximum.
+   * Predicted class is the one with maximum probability (Softmax). */
+  for (int ic = 0; ic < nclasses; ic++) {
+    exp_sum += exp(logits[ic]);
+    if (logits[ic] > logits[class_id]) class_id = ic;
+  }
+  classes[iex] = class_id;
+  if (probabilities != NULL) {
+    for (int ic = 0; ic < nclasses; ic++) {
+      probabilities[(size_t)iex * nclasses + ic] = exp(logits[ic]) / exp_sum;
+    }
+  }
+}
+
+void Predictor::applyInt8(int ilayer, int ithread, int nblock) {
+  Layer *layer = layers[ithread][ilayer];
+  MyReal *state = states[ithread];
+  signed char *qstate = qstates[ithread];
+  int *accum = accums[ithread];
+  int dimI = layer->getDimIn();
+  int dimO = layer->getDimOut();
+  MyReal bias = layer->getBias()[0];
+  MyReal scale = wscale[ilayer] * yscale[ilayer];
+  MyReal invscale = 1.0 / yscale[ilayer];
+
+  /* Quantize the states of the block */
+  for (int i = 0; i < nblock * dimI; i++) {
+    qstate[i] = quantize_int8(state[i], invscale);
+  }
+
+  /* Affine transformation of all states at once */
+  gemm_int8(nblock, dimO, dimI, qstate, qweights[ilayer], accum);
+
+  /* Apply step in floating point */
+  for (int iex = 0; iex < nblock; iex++) {
+    for (int io = 0; io < dimO; io++) {
+      MyReal update = scale * accum[iex * dimO + io] + bias;
+      state[iex * nchannels + io] += layer->getDt() * layer->activation(update);
+    }
+  }
+}
+
+void Predictor::predict(const MyReal *batch, int n, int *classes,
+                        MyReal *probabilities) {
+  int nblocks = (n + PREDICT_BLOCK - 1) / PREDICT_BLOCK;
+  long long napplied = 0;
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(static) \
+    reduction(+ : napplied)
+#endif
+  for (int iblock = 0; iblock < nblocks; iblock++) {
+#ifdef _OPENMP
+    int ithread = omp_get_thread_num();
+#else
+    int ithread = 0;
+#endif
+    Layer **chain = layers[ithread];
+    int *slots = exitslots[ithread];
+    int first = iblock * PREDICT_BLOCK;
+    int nblock = std::min(PREDICT_BLOCK, n - first);
+
+    /* Examples that left early are swapped behind the nblock active ones */
+    for (int iex = 0; iex < nblock; iex++) slots[iex] = iex;
+
+    /* Propagate the block through the network, layer by layer */
+    for (int ilayer = 0; ilayer < nlayers; ilayer++) {
+      int check = exitcriterion != EXIT_NONE && ilayer > 0 &&
+                  ilayer < nlayers - 2 && ilayer % exitinterval == 0;
+      if (check && exitcriterion == EXIT_UPDATE) {
+        for (int i = 0; i < nblock * nchannels; i++) {
+          prevstates[ithread][i] = states[ithread][i];
+        }
+      }
+
+      if (qweights != NULL && qweights[ilayer] != NULL) {
+        applyInt8(ilayer, ithread, nblock);
+      } else {
+        for (int iex = 0; iex < nblock; iex++) {
+          MyReal *state = &(states[ithread][iex * nchannels]);
+          if (ilayer == 0) {
+            chain[0]->setExample(
+                (MyReal *)&(batch[(size_t)(first + slots[iex]) * nfeatures]));
+          }
+          chain[ilayer]->applyFWD(state);
+        }
+      }
+      napplied += nblock;
+      if (!check) continue;
+
+      /* Classify the examples that meet the exit criterion */
+      if (exitcriterion == EXIT_CONFIDENCE) napplied += nblock;
+      for (int iex = 0; iex < nblock;) {
+        if (!checkExit(ithread, iex)) {
+          iex++;
+          continue;
+        }
+        MyReal *state = &(states[ithread][iex * nchannels]);
+        MyReal *last = &(states[ithread][(nblock - 1) * nchannels]);
+        classify(state, first + slots[iex], classes, probabilities);
+        if (exitcriterion == EXIT_UPDATE) napplied++;
+
+        /* Move the last active example into the free slot */
+        for (int ic = 0; ic < nchannels; ic++) state[ic] = last[ic];
+        for (int ic = 0; ic < nchannels; ic++) {
+          prevstates[ithread][iex * nchannels + ic] =
+              prevstates[ithread][(nblock - 1) * nchannels + ic];
+        }
+        slots[iex] = slots[nblock - 1];
+        nblock--;
+      }
+    }
+
+    for (int iex = 0; iex < nblock; iex++) {
+      classify(&(states[ithread][iex * nchannels]), first + slots[iex],
+               classes, probabilities);
+    }
+  }
+
+  nlayers_applied += napplied;
+  nexamples += n;
+}
@@ -11,12 +11,16 @@ void read_matrix(char *filename, MyReal **var, int dimx, int dimy) {
     exit(1);
   }
 
+  /* Last stored row */
+  int xlast = dimx - 1;
+  while (xlast >= 0 && var[xlast] == NULL) xlast--;
+
   /* Read data */
   printf("Reading file %s\n", filename);
-  for (int ix = 0; ix < dimx; ix++) {
+  for (int ix = 0; ix <= xlast; ix++) {
     for (int iy = 0; iy < dimy; iy++) {
       fscanf(file, "%lf", &tmp);
-      var[ix][iy] = tmp;
+      if (var[ix] != NULL) var[ix][iy] = tmp;
     }
   }
 
@@ -65,6 +69,7 @@ void write_vector(char *filename, MyReal *var, int dimN) {
   fclose(file);
 }
 
+#ifndef SERIAL
 void MPI_GatherVector(MyReal *sendbuffer, int localsendcount,
                       MyReal *recvbuffer, int rootprocessID, MPI_Comm comm) {
   int comm_size;
@@ -117,4 +122,119 @@ void MPI_ScatterVector(MyReal *sendbuffer, MyReal *recvbuffer,
   /* Clean up */
   delete[] sendcount;
   delete[] displs;
-}
\ No newline at end of file
+}
+
+void MPI_WriteVector(MPI_File fh, MPI_Offset offset, MyReal *localvec,
+                     int nlocal, long long localoffset, int write) {
+  MPI_Status status;
+
+  if (!write) nlocal = 0;
+  MPI_File_write_at_all(fh, offset + localoffset * sizeof(MyReal), localvec,
+                        nlocal, MPI_MyReal, &status);
+}
+
+void MPI_ReadVector(MPI_File fh, MPI_Offset offset, MyReal *localvec,
+                    int nlocal, long long localoffset) {
+  MPI_Status status;
+
+  MPI_File_read_at_all(fh, offset + localoffset * sizeof(MyReal), localvec,
+                       nlocal, MPI_MyReal, &status);
+}
+
+void MPI_CreateFileType(int npieces, long long *offsets, int *sizes,
+                        MPI_Datatype *filetype) {
+  MPI_Aint *displs = new MPI_Aint[npieces];
+  for (int i = 0; i < npieces; i++) displs[i] = offsets[i] * sizeof(MyReal);
+
+  /* A file view can't be empty, processors without a piece get a dummy one
+   * that they never access */
+  if (npieces > 0) {
+    MPI_Type_create_hindexed(npieces, sizes, displs, MPI_MyReal, filetype);
+  } else {
+    MPI_Type_contiguous(1, MPI_MyReal, filetype);
+  }
+  MPI_Type_commit(filetype);
+
+  delete[] displs;
+}
+
+void MPI_WriteVectorView(MPI_File fh, MPI_Offset offset, MyReal *localvec,
+                         int nlocal, MPI_Datatype filetype, int write) {
+  MPI_Status status;
+
+  if (!write) nlocal = 0;
+  MPI_File_set_view(fh, offset, MPI_MyReal, filetype, (char *)"native",
+                    MPI_INFO_NULL);
+  MPI_File_write_all(fh, localvec, nlocal, MPI_MyReal, &status);
+  MPI_File_set_view(fh, 0, MPI_BYTE, MPI_BYTE, (char *)"native",
+                    MPI_INFO_NULL);
+}
+
+void MPI_ReadVectorView(MPI_File fh, MPI_Offset offset, MyReal *localvec,
+                        int nlocal, MPI_Datatype filetype) {
+  MPI_Status status;
+
+  MPI_File_set_view(fh, offset, MPI_MyReal, filetype, (char *)"native",
+                    MPI_INFO_NULL);
+  MPI_File_read_all(fh, localvec, nlocal, MPI_MyReal, &status);
+  MPI_File_set_view(fh, 0, MPI_BYTE, MPI_BYTE, (char *)"native",
+                    MPI_INFO_NULL);
+}
+
+#endif
+
+MyReal random_counter(uint64_t counter, uint32_t seed) {
+  uint32_t x0 = (uint32_t)counter;
+  uint32_t x1 = (uint32_t)(counter >> 32);
+  uint32_t key = seed;
+
+  /* Ten Philox rounds, bumping the key with the golden ratio */
+  for (int round = 0; round < 10; round++) {
+    uint64_t product = (uint64_t)0xD256D193u * x0;
+    x0 = (uint32_t)(product >> 32) ^ key ^ x1;
+    x1 = (uint32_t)product;
+    key += 0x9E3779B9u;
+  }
+
+  /* Combine 53 random bits to a double in [0,1) */
+  uint64_t bits = ((uint64_t)(x0 >> 5) << 26) | (x1 >> 6);
+  return (MyReal)(bits * (1.0 / 9007199254740992.0));
+}
+
+/* Knot m of the clamped uniform knot vector */
+static MyReal bspline_knot(int degree, int nbasis, int m) {
+  if (m <= degree) return 0.0;
+  if (m >= nbasis) return 1.0;
+  return (m - degree) / (MyReal)(nbasis - degree);
+}
+
+void bspline_basis(int degree, int nbasis, MyReal s, MyReal *phi) {
+  MyReal left, right, denom;
+
+  /* Degree 0: indicator of the knot interval that contains s. The right end
+   * belongs to the last interval. */
+  int nint = nbasis - degree;
+  int span = (int)(s * nint);
+  if (span > nint - 1) span = nint - 1;
+  if (span < 0) span = 0;
+  for (int m = 0; m < nbasis + degree; m++) phi[m] = 0.0;
+  phi[span + degree] = 1.0;
+
+  /* Raise the degree, N_m^q from N_m^(q-1) and N_(m+1)^(q-1) */
+  for (int q = 1; q <= degree; q++) {
+    for (int m = 0; m < nbasis + degree - q; m++) {
+      left = 0.0;
+      right = 0.0;
+      denom = bspline_knot(degree, nbasis, m + q) -
+              bspline_knot(degree, nbasis, m);
+      if (denom > 0.0)
+        left = (s - bspline_knot(degree, nbasis, m)) / denom * phi[m];
+      denom = bspline_knot(degree, nbasis, m + q + 1) -
+              bspline_knot(degree, nbasis, m + 1);
+      if (denom > 0.0)
+        right = (bspline_knot(degree, nbasis, m + q + 1) - s) / denom *
+                phi[m + 1];
+      phi[m] = left + right;
+    }
+  }
+}
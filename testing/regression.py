@@ -0,0 +1,324 @@
+#!/usr/bin/env python
+
+import sys
+import argparse
+import os
+import copy
+import subprocess
+import shutil
+import filecmp
+sys.path.insert(0, '../pythonutil')
+from config import *
+from util import *
+
+# Regression checks of the features that testing.py doesn't cover. Unlike
+# testing.py, they don't compare to stored reference files, but check that
+# two runs which must agree do so, or check a statistic that main prints:
+#   unittest       - counter-based random numbers and B-spline basis
+#                    (../unittest)
+#   rng            - counter-based initialization for any number of processors
+#   openlayercache - each example passes the opening layer only once
+#   chunkcache     - the same with micro-batches and validation chunks
+#   microbatch     - micro-batched vs. unsplit gradient
+#   checkpoint     - restart from a checkpoint continues the original run
+#   model          - model file read and written again on other processors
+#   int8           - int8 quantized vs. floating point model (../quantize)
+#   channelsplit   - layers split between two processors vs. unsplit
+#   validation     - validation by a forward sweep vs. by xbraid
+#   checkpointstride - primal checkpoints with recomputation vs. all stored
+#   batchcoarsen   - fewer examples on the coarse levels, same objective
+#   channelcoarsen - fewer channels on the coarse levels, same objective
+#   pruning        - pruned layers sent between processors, any npt
+#   lowrank        - low-rank layers sent between processors, any npt
+# Build the code before ('make').
+
+# Define the command line arguments
+parser = argparse.ArgumentParser()
+parser.add_argument('-c', '--case', help='name of test case', default='peaks')
+parser.add_argument('-npt', '--nprocs', type=int, nargs='+', help='number of processors to be tested',  default=[1,2,5])
+parser.add_argument('-mpi', '--mpirun', help='command to run in parallel', default='mpirun')
+
+# Parse command line arguments
+args = parser.parse_args()
+case = args.case
+nptlist = args.nprocs
+mpirun = args.mpirun
+print("Regression tests of case \"" + case +  "\", npt=" + str(nptlist))
+
+# Tolerance for runs that only differ in the order of summation
+tol = 1e-10
+
+# Get the global config file, shorten the optimization
+config = Config(case + ".cfg")
+config.optim_maxiter = 10
+
+# Count the failed tests
+nfail = 0
+
+
+def runtest(testname, konfig, npt):
+    """ Run main with the given configuration in folder test.<testname>,
+        return the folder name """
+    testfoldername = "test." + testname
+    if not os.path.exists(testfoldername):
+        os.mkdir(testfoldername)
+    make_link(config.datafolder, testfoldername + "/data")
+
+    konfig = copy.deepcopy(konfig)
+    konfig.datafolder = "data"
+    testconfig = testname + ".cfg"
+    konfig.dump(testfoldername + "/" + testconfig)
+
+    os.chdir(testfoldername)
+    runcommand = mpirun + " -n " + str(npt) + " ../../main " + testconfig + " > tmp"
+    print("Running Test: " + testname)
+    subprocess.call(runcommand, shell=True)
+    os.chdir("../")
+
+    return testfoldername
+
+
+def readoptim(filename):
+    """ Return the lines of an optim.dat file as lists of numbers, without
+        comments and the last element (time) """
+    lines = []
+    if not os.path.exists(filename):
+        return lines
+    for line in open(filename, 'r'):
+        words = line.split()
+        if not words or words[0] == '#':
+            continue
+        lines.append([float(word.rstrip('%')) for word in words[:-1]])
+    return lines
+
+
+def compareoptim(reflines, testlines):
+    """ Compare lines of optim.dat files up to the relative tolerance,
+        return 0 if they agree """
+    if not reflines or len(reflines) != len(testlines):
+        return 1
+    for refline, testline in zip(reflines, testlines):
+        for ref, test in zip(refline, testline):
+            if abs(ref - test) > tol * max(abs(ref), abs(test)):
+                return 1
+    return 0
+
+
+def compareobjective(reflines, testlines, tolerance):
+    """ Compare the objective of the last optimization iteration up to the
+        given relative tolerance, return 0 if they agree """
+    if not reflines or not testlines:
+        return 1
+    ref = reflines[-1][3]
+    test = testlines[-1][3]
+    return int(abs(ref - test) > tolerance * max(abs(ref), abs(test)))
+
+
+def readstat(filename, name):
+    """ Return the number after the given name in the output of main """
+    if os.path.exists(filename):
+        for line in open(filename, 'r'):
+            if line.strip().startswith(name + ":"):
+                return float(line.split(":")[1].split()[0])
+    return -1
+
+
+def report(testname, err):
+    """ Print the result of a test, return 1 if it failed """
+    if (err > 0):
+        print("  !!! Test failed: " + testname + " !!!")
+        return 1
+    print("  Test passed!")
+    return 0
+
+
+# --- Unit tests of the utility routines ---
+print("Running Test: unittest")
+err = 1
+if os.path.exists("../unittest"):
+    err = subprocess.call("../unittest", shell=True)
+else:
+    print("  ../unittest not found, build it with 'make unittest'")
+nfail += report("unittest", err)
+
+# --- Counter-based initialization: same optimization for any npt ---
+konfig = copy.deepcopy(config)
+konfig.weights_init = 1e-3
+konfig.weights_rng = "counter"
+reflines = []
+for npt in nptlist:
+    folder = runtest(case + ".rng.npt" + str(npt), konfig, npt)
+    testlines = readoptim(folder + "/optim.dat")
+    if not reflines:
+        reflines = testlines
+    nfail += report("rng npt" + str(npt), compareoptim(reflines, testlines))
+
+# --- Opening layer cache: without weights in the opening layer, each
+# example of the (deterministic) batch and of the validation set passes it
+# only once, whatever the number of braid runs ---
+konfig = copy.deepcopy(config)
+konfig.weights_open_init = 0.0
+konfig.validation_chunksize = 0
+folder = runtest(case + ".openlayercache", konfig, nptlist[-1])
+nevals = readstat(folder + "/tmp", "Opening layer")
+nfail += report("openlayercache", nevals != config.nbatch + config.nvalidation)
+
+# --- The same with the batch and the validation set split into chunks ---
+konfig.nmicrobatches = 4
+konfig.validation_chunksize = config.nvalidation // 4
+folder = runtest(case + ".chunkcache", konfig, nptlist[-1])
+nevals = readstat(folder + "/tmp", "Opening layer")
+nfail += report("chunkcache", nevals != config.nbatch + config.nvalidation)
+
+# --- Micro-batches: same gradient as the unsplit batch ---
+npt = nptlist[-1]
+konfig = copy.deepcopy(config)
+konfig.nmicrobatches = 1
+folder = runtest(case + ".microbatch1", konfig, npt)
+reflines = readoptim(folder + "/optim.dat")
+konfig.nmicrobatches = 4
+folder = runtest(case + ".microbatch4", konfig, npt)
+testlines = readoptim(folder + "/optim.dat")
+nfail += report("microbatch", compareoptim(reflines, testlines))
+
+# --- Checkpoint: the restart continues the original run, on other npt ---
+konfig = copy.deepcopy(config)
+konfig.checkpoint_interval = config.optim_maxiter // 2
+konfig.modelfile_out = "model.bin"
+reffolder = runtest(case + ".checkpoint", konfig, nptlist[-1])
+reflines = readoptim(reffolder + "/optim.dat")
+konfig = copy.deepcopy(config)
+konfig.restart = 1
+testfoldername = "test." + case + ".restart"
+if not os.path.exists(testfoldername):
+    os.mkdir(testfoldername)
+if os.path.exists(testfoldername + "/optim.dat"):
+    os.remove(testfoldername + "/optim.dat")  # the restart appends to it
+err = 1
+if os.path.exists(reffolder + "/checkpoint.bin"):
+    shutil.copy(reffolder + "/checkpoint.bin", testfoldername)
+    folder = runtest(case + ".restart", konfig, nptlist[0])
+    testlines = readoptim(folder + "/optim.dat")
+    if testlines:
+        reflines = [line for line in reflines if line[0] >= testlines[0][0]]
+        err = compareoptim(reflines, testlines)
+nfail += report("checkpoint", err)
+
+# --- Model file: read on other npt and written again, byte by byte ---
+konfig = copy.deepcopy(config)
+konfig.optim_maxiter = 0
+konfig.modelfile_in = "../" + reffolder + "/model.bin"
+konfig.modelfile_out = "model.bin"
+folder = runtest(case + ".model", konfig, nptlist[0])
+err = 1
+if os.path.exists(folder + "/model.bin"):
+    err = not filecmp.cmp(reffolder + "/model.bin", folder + "/model.bin",
+                          shallow=False)
+nfail += report("model", err)
+
+# --- int8 quantization: (almost) the same classes and accuracy as float ---
+print("Running Test: int8")
+err = 1
+if os.path.exists("../quantize"):
+    os.chdir(reffolder)
+    runcommand = ("../../quantize " + case + ".checkpoint.cfg model.bin "
+                  "model.int8.bin > tmp.int8")
+    subprocess.call(runcommand, shell=True)
+    accuracy = {}
+    for line in open("tmp.int8", 'r'):
+        words = line.split()
+        if words and words[0] in ["float", "int8"]:
+            accuracy[words[0]] = float(words[1].rstrip('%'))
+        if "Same class as float" in line:
+            agree = float(words[-1].rstrip('%'))
+            err = agree < 95.0
+    if len(accuracy) < 2 or abs(accuracy["float"] - accuracy["int8"]) > 2.0:
+        err = 1
+    os.chdir("../")
+else:
+    print("  ../quantize not found, build it with 'make quantize'")
+nfail += report("int8", err)
+
+# --- Channel split: same optimization as the unsplit layers, on the same
+# number of processors ---
+konfig = copy.deepcopy(config)
+konfig.nchannelsplit = 1
+folder = runtest(case + ".channelsplit1", konfig, 2)
+reflines = readoptim(folder + "/optim.dat")
+konfig.nchannelsplit = 2
+folder = runtest(case + ".channelsplit2", konfig, 2)
+testlines = readoptim(folder + "/optim.dat")
+nfail += report("channelsplit", compareoptim(reflines, testlines))
+
+# --- Validation: the forward sweep gives the same accuracy as xbraid ---
+npt = nptlist[-1]
+konfig = copy.deepcopy(config)
+konfig.validation_type = "xbraid"
+folder = runtest(case + ".validation.xbraid", konfig, npt)
+reflines = readoptim(folder + "/optim.dat")
+konfig.validation_type = "forward"
+folder = runtest(case + ".validation.forward", konfig, npt)
+testlines = readoptim(folder + "/optim.dat")
+nfail += report("validation", compareoptim(reflines, testlines))
+
+# --- Checkpoints of the primal states: recomputing the points in between
+# gives the same gradient as storing all of them ---
+npt = nptlist[-1]
+konfig = copy.deepcopy(config)
+konfig.braid_checkpointstride = 0
+folder = runtest(case + ".checkpointstride0", konfig, npt)
+reflines = readoptim(folder + "/optim.dat")
+konfig.braid_checkpointstride = 2
+folder = runtest(case + ".checkpointstride2", konfig, npt)
+testlines = readoptim(folder + "/optim.dat")
+nfail += report("checkpointstride", compareoptim(reflines, testlines))
+
+# --- Spatial coarsening: with converged multilevel braid runs, coarsening
+# the batch on the coarse levels gives the same objective. The braid
+# residuals differ, so only the objective is compared. ---
+npt = nptlist[-1]
+mlkonfig = copy.deepcopy(config)
+mlkonfig.braid_maxlevels = 2
+mlkonfig.braid_maxiter = 30
+folder = runtest(case + ".multilevel", mlkonfig, npt)
+mlreflines = readoptim(folder + "/optim.dat")
+konfig = copy.deepcopy(mlkonfig)
+konfig.braid_batchcoarsen = 2
+folder = runtest(case + ".batchcoarsen", konfig, npt)
+testlines = readoptim(folder + "/optim.dat")
+nfail += report("batchcoarsen", compareobjective(mlreflines, testlines, 1e-6))
+
+# --- The same with fewer channels on the coarse levels ---
+konfig = copy.deepcopy(mlkonfig)
+konfig.braid_channelcoarsen = 2
+folder = runtest(case + ".channelcoarsen", konfig, npt)
+testlines = readoptim(folder + "/optim.dat")
+nfail += report("channelcoarsen", compareobjective(mlreflines, testlines, 1e-6))
+
+# --- Pruning: the sparse layers keep their pattern and weights when braid
+# sends them to the next processor, same optimization for any npt ---
+konfig = copy.deepcopy(config)
+konfig.pruning = 0.5
+konfig.pruning_iter = 2
+reflines = []
+for npt in nptlist:
+    folder = runtest(case + ".pruning.npt" + str(npt), konfig, npt)
+    testlines = readoptim(folder + "/optim.dat")
+    if not reflines:
+        reflines = testlines
+    nfail += report("pruning npt" + str(npt), compareoptim(reflines, testlines))
+
+# --- Low-rank layers: the same for the factorized weights ---
+konfig = copy.deepcopy(config)
+konfig.lowrank = 2
+konfig.weights_init = 1e-3
+reflines = []
+for npt in nptlist:
+    folder = runtest(case + ".lowrank.npt" + str(npt), konfig, npt)
+    testlines = readoptim(folder + "/optim.dat")
+    if not reflines:
+        reflines = testlines
+    nfail += report("lowrank npt" + str(npt), compareoptim(reflines, testlines))
+
+print(str(nfail) + " tests failed")
+sys.exit(nfail)
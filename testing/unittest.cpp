@@ -0,0 +1,171 @@
+// Copyright
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Underlying paper:
+//
+// Layer-Parallel Training of Deep Residual Neural Networks
+// S. Guenther, L. Ruthotto, J.B. Schroder, E.C. Czr, and N.R. Gauger
+//
+// Download: https://arxiv.org/pdf/1812.04352.pdf
+//
+//
+// Unit tests of the utility routines that the end-to-end tests in
+// regression.py can't isolate: The counter-based random numbers and the
+// B-spline basis in time. Returns the number of failed tests.
+//
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "defs.hpp"
+#include "util.hpp"
+
+/* Print the result of a test, return 1 if it failed */
+static int report(const char *name, int fail) {
+  if (fail) {
+    printf("  %-40s !!! Test failed !!!\n", name);
+  } else {
+    printf("  %-40s Test passed!\n", name);
+  }
+  return fail;
+}
+
+/* Reference values of random_counter() with seed 42. They must not change,
+ * otherwise counter-based initializations and their checkpoints are not
+ * reproducible anymore. */
+static int testPhiloxReference() {
+  uint64_t counters[4] = {0, 1, 2, ((uint64_t)1 << 40) + 7};
+  MyReal reference[4] = {0.14529031504159451, 0.30493375993138128,
+                         0.066313504243077692, 0.93016357907956282};
+  int fail = 0;
+
+  for (int i = 0; i < 4; i++) {
+    if (random_counter(counters[i], 42) != reference[i]) fail = 1;
+  }
+  return report("Philox reference values", fail);
+}
+
+/* The numbers depend on the counter only, not on the order of the calls, and
+ * they are uniform in [0,1) */
+static int testPhiloxCounter() {
+  int n = 100000;
+  MyReal *forward = new MyReal[n];
+  MyReal mean = 0.0;
+  int fail = 0;
+
+  for (int i = 0; i < n; i++) forward[i] = random_counter(i, 7);
+  for (int i = n - 1; i >= 0; i--) {
+    MyReal r = random_counter(i, 7);
+    if (r != forward[i] || r < 0.0 || r >= 1.0) fail = 1;
+    if (r == random_counter(i, 8)) fail = 1;
+    mean += r / n;
+  }
+  if (fabs(mean - 0.5) > 0.01) fail = 1;
+
+  delete[] forward;
+  return report("Philox order independence", fail);
+}
+
+/* The B-splines are nonnegative and sum up to one everywhere in [0,1] */
+static int testBsplineUnity() {
+  int degrees[2] = {1, 3};
+  MyReal phi[16];
+  int fail = 0;
+
+  for (int idegree = 0; idegree < 2; idegree++) {
+    int degree = degrees[idegree];
+    for (int nbasis = degree + 1; nbasis <= 12; nbasis++) {
+      for (int i = 0; i <= 100; i++) {
+        MyReal sum = 0.0;
+        bspline_basis(degree, nbasis, i / 100.0, phi);
+        for (int k = 0; k < nbasis; k++) {
+          if (phi[k] < 0.0) fail = 1;
+          sum += phi[k];
+        }
+        if (fabs(sum - 1.0) > 1e-12) fail = 1;
+      }
+    }
+  }
+  return report("B-spline partition of unity", fail);
+}
+
+/* The least-squares fit with B-splines of degree q at equidistant samples
+ * (as Network::setBasis() does for the hidden layers) reproduces any
+ * polynomial of degree q exactly */
+static int testBsplineFit() {
+  int degrees[2] = {1, 3};
+  int nsamples = 30;
+  MyReal phi[16];
+  MyReal gram[12 * 12], rhs[12];
+  int fail = 0;
+
+  for (int idegree = 0; idegree < 2; idegree++) {
+    int degree = degrees[idegree];
+    for (int nbasis = degree + 1; nbasis <= 12; nbasis++) {
+      /* Normal equations G c = P^T f for f(s) = 1 - 2s + s^q */
+      for (int j = 0; j < nbasis * nbasis; j++) gram[j] = 0.0;
+      for (int j = 0; j < nbasis; j++) rhs[j] = 0.0;
+      for (int i = 0; i < nsamples; i++) {
+        MyReal s = i / (MyReal)(nsamples - 1);
+        MyReal f = 1.0 - 2.0 * s + pow(s, degree);
+        bspline_basis(degree, nbasis, s, phi);
+        for (int j = 0; j < nbasis; j++) {
+          rhs[j] += phi[j] * f;
+          for (int k = 0; k < nbasis; k++) {
+            gram[j * nbasis + k] += phi[j] * phi[k];
+          }
+        }
+      }
+
+      /* Gaussian elimination, G is symmetric positive definite */
+      for (int j = 0; j < nbasis; j++) {
+        for (int i = j + 1; i < nbasis; i++) {
+          MyReal factor = gram[i * nbasis + j] / gram[j * nbasis + j];
+          for (int k = j; k < nbasis; k++) {
+            gram[i * nbasis + k] -= factor * gram[j * nbasis + k];
+          }
+          rhs[i] -= factor * rhs[j];
+        }
+      }
+      for (int j = nbasis - 1; j >= 0; j--) {
+        for (int k = j + 1; k < nbasis; k++) {
+          rhs[j] -= gram[j * nbasis + k] * rhs[k];
+        }
+        rhs[j] /= gram[j * nbasis + j];
+      }
+
+      /* Compare the fit to f, also between the samples */
+      for (int i = 0; i <= 100; i++) {
+        MyReal s = i / 100.0;
+        MyReal fit = 0.0;
+        bspline_basis(degree, nbasis, s, phi);
+        for (int k = 0; k < nbasis; k++) fit += rhs[k] * phi[k];
+        if (fabs(fit - (1.0 - 2.0 * s + pow(s, degree))) > 1e-10) fail = 1;
+      }
+    }
+  }
+  return report("B-spline least-squares fit", fail);
+}
+
+int main(int argc, char *argv[]) {
+  int nfail = 0;
+
+  printf("Unit tests\n");
+  nfail += testPhiloxReference();
+  nfail += testPhiloxCounter();
+  nfail += testBsplineUnity();
+  nfail += testBsplineFit();
+
+  return nfail;
+}
@@ -0,0 +1,149 @@
+// Copyright
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Underlying paper:
+//
+// Layer-Parallel Training of Deep Residual Neural Networks
+// S. Guenther, L. Ruthotto, J.B. Schroder, E.C. Czr, and N.R. Gauger
+//
+// Download: https://arxiv.org/pdf/1812.04352.pdf
+//
+//
+// Early-exit inference: Classifies the examples of a data file with the full
+// network and with early exit for each of the given thresholds. Reports the
+// average number of layers applied per example, the accuracy and its loss
+// compared to the full network, and the throughput.
+//
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "defs.hpp"
+#include "predictor.hpp"
+#include "util.hpp"
+
+#define EARLYEXIT_NREPEAT 10 /* Repetitions for measuring the throughput */
+
+/* Classify all examples, return the accuracy and the throughput in examples
+ * per second */
+static void evaluate(Predictor *predictor, MyReal *examples, MyReal **labels,
+                     int n, int *classes, MyReal *accuracy_ptr,
+                     MyReal *throughput_ptr) {
+  int ncorrect = 0;
+
+  predictor->resetStatistics();
+  MyReal time = omp_get_wtime();
+  for (int irepeat = 0; irepeat < EARLYEXIT_NREPEAT; irepeat++) {
+    predictor->predict(examples, n, classes, NULL);
+  }
+  time = omp_get_wtime() - time;
+
+  for (int iex = 0; iex < n; iex++) {
+    if (labels[iex][classes[iex]] > 0.99) ncorrect++;
+  }
+  *accuracy_ptr = 100.0 * ncorrect / n;
+  *throughput_ptr = EARLYEXIT_NREPEAT * n / time;
+}
+
+int main(int argc, char *argv[]) {
+  Predictor *predictor;
+  int nexamples, nfeatures, nclasses;
+  int criterion, interval;
+  MyReal *examples;    /**< Examples, stored contiguously */
+  MyReal **rows;       /**< Pointers to the examples, for read_matrix */
+  MyReal **labels;     /**< Labels of the examples */
+  int *classes_full;   /**< Classes predicted by the full network */
+  int *classes;        /**< Classes predicted with early exit */
+  MyReal accuracy_full, throughput_full;
+  MyReal accuracy, throughput;
+
+  if (argc < 8) {
+    printf("\n");
+    printf(
+        "USAGE: ./earlyexit <modelfile> <examplefile> <labelfile> "
+        "<nexamples> <update|confidence> <interval> <threshold> "
+        "[<threshold> ...]\n");
+    return 0;
+  }
+  nexamples = atoi(argv[4]);
+  if (strcmp(argv[5], "update") == 0) {
+    criterion = EXIT_UPDATE;
+  } else if (strcmp(argv[5], "confidence") == 0) {
+    criterion = EXIT_CONFIDENCE;
+  } else {
+    printf("Invalid exit criterion: %s! \n", argv[5]);
+    return 0;
+  }
+  interval = atoi(argv[6]);
+
+  /* Load the network */
+  predictor = new Predictor();
+  if (predictor->load(argv[1])) return 0;
+  nfeatures = predictor->getnFeatures();
+  nclasses = predictor->getnClasses();
+
+  /* Read the examples and labels */
+  examples = new MyReal[(size_t)nexamples * nfeatures];
+  rows = new MyReal *[nexamples];
+  labels = new MyReal *[nexamples];
+  for (int iex = 0; iex < nexamples; iex++) {
+    rows[iex] = &(examples[(size_t)iex * nfeatures]);
+    labels[iex] = new MyReal[nclasses];
+  }
+  read_matrix(argv[2], rows, nexamples, nfeatures);
+  read_matrix(argv[3], labels, nexamples, nclasses);
+  classes_full = new int[nexamples];
+  classes = new int[nexamples];
+
+  /* Reference: the full network */
+  evaluate(predictor, examples, labels, nexamples, classes_full,
+           &accuracy_full, &throughput_full);
+
+  printf("\n");
+  printf(" Criterion: %s, checked after every %d. hidden layer\n", argv[5],
+         interval);
+  printf("\n");
+  printf(" Threshold  Layers  Accuracy  Acc. loss  Agreement  Throughput\n");
+  printf("      full  %6.2f  %7.2f%%  %8.2f%%  %8.2f%%  %10.1f\n",
+         (MyReal)predictor->getnLayers(), accuracy_full, 0.0, 100.0,
+         throughput_full);
+
+  /* Early exit with each threshold */
+  for (int iarg = 7; iarg < argc; iarg++) {
+    MyReal threshold = atof(argv[iarg]);
+    int nagree = 0;
+
+    predictor->setEarlyExit(criterion, threshold, interval);
+    evaluate(predictor, examples, labels, nexamples, classes, &accuracy,
+             &throughput);
+    for (int iex = 0; iex < nexamples; iex++) {
+      if (classes[iex] == classes_full[iex]) nagree++;
+    }
+    printf("  %.2e  %6.2f  %7.2f%%  %8.2f%%  %8.2f%%  %10.1f\n", threshold,
+           predictor->getAverageLayers(), accuracy, accuracy_full - accuracy,
+           100.0 * nagree / nexamples, throughput);
+  }
+  printf("\n");
+
+  delete predictor;
+  for (int iex = 0; iex < nexamples; iex++) delete[] labels[iex];
+  delete[] labels;
+  delete[] examples;
+  delete[] rows;
+  delete[] classes_full;
+  delete[] classes;
+
+  return 0;
+}
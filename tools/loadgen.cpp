@@ -0,0 +1,182 @@
+// Copyright
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Underlying paper:
+//
+// Layer-Parallel Training of Deep Residual Neural Networks
+// S. Guenther, L. Ruthotto, J.B. Schroder, E.C. Czr, and N.R. Gauger
+//
+// Download: https://arxiv.org/pdf/1812.04352.pdf
+//
+//
+// Load generator for the prediction server (see serve.cpp): Each of
+// nclients concurrent clients connects to the server and sends nrequests
+// requests of a few examples, one after the other, waiting for each response.
+// Reports the median and 99th percentile of the request latency and the
+// overall throughput.
+//
+#include <errno.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "defs.hpp"
+#include "util.hpp"
+
+/* Write all bytes to a socket, return -1 on failure */
+static int writeAll(int fd, const char *buffer, size_t size) {
+  while (size > 0) {
+    ssize_t nwritten = write(fd, buffer, size);
+    if (nwritten < 0 && errno == EINTR) continue;
+    if (nwritten <= 0) return -1;
+    buffer += nwritten;
+    size -= nwritten;
+  }
+  return 0;
+}
+
+/* Read the given number of bytes from a socket, return -1 on failure */
+static int readAll(int fd, char *buffer, size_t size) {
+  while (size > 0) {
+    ssize_t nread = read(fd, buffer, size);
+    if (nread < 0 && errno == EINTR) continue;
+    if (nread <= 0) return -1;
+    buffer += nread;
+    size -= nread;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int nexamples, nfeatures;
+  int nclients = 8;
+  int nrequests = 1000;
+  int requestsize = 1; /**< Examples per request */
+  MyReal *examples;    /**< Examples, stored contiguously */
+  MyReal **rows;       /**< Pointers to the examples, for read_matrix */
+  double *latencies;   /**< Latency of all requests */
+  int nfailed = 0;
+  double time;
+
+  if (argc < 4) {
+    printf("\n");
+    printf(
+        "USAGE: ./loadgen <socketpath> <examplefile> <nexamples> [<nclients> "
+        "[<nrequests> [<requestsize>]]]\n");
+    return 0;
+  }
+  nexamples = atoi(argv[3]);
+  if (argc > 4) nclients = atoi(argv[4]);
+  if (argc > 5) nrequests = atoi(argv[5]);
+  if (argc > 6) requestsize = atoi(argv[6]);
+
+  /* Ask the server for the dimensions */
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+  int dims[2];
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      readAll(fd, (char *)dims, sizeof(dims))) {
+    printf("ERROR: Can't connect to %s: %s\n", argv[1], strerror(errno));
+    return 0;
+  }
+  close(fd);
+  nfeatures = dims[0];
+
+  /* Read the examples */
+  examples = new MyReal[(size_t)nexamples * nfeatures];
+  rows = new MyReal *[nexamples];
+  for (int iex = 0; iex < nexamples; iex++) {
+    rows[iex] = &(examples[(size_t)iex * nfeatures]);
+  }
+  read_matrix(argv[2], rows, nexamples, nfeatures);
+  latencies = new double[(size_t)nclients * nrequests];
+
+  /* Each client sends its requests, cycling through the examples */
+  time = omp_get_wtime();
+#pragma omp parallel num_threads(nclients) reduction(+ : nfailed)
+  {
+    int iclient = omp_get_thread_num();
+    int nclasses = 0;
+    int clientdims[2];
+    int size = sizeof(int) + requestsize * nfeatures * sizeof(MyReal);
+    char *request = new char[size];
+    char *response = NULL;
+    int responsesize = 0;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        readAll(fd, (char *)clientdims, sizeof(clientdims))) {
+      nfailed += nrequests;
+    } else {
+      nclasses = clientdims[1];
+      responsesize = requestsize * (sizeof(int) + nclasses * sizeof(MyReal));
+      response = new char[responsesize];
+      memcpy(request, &requestsize, sizeof(int));
+    }
+
+    for (int ir = 0; ir < nrequests && response != NULL; ir++) {
+      double *latency = &(latencies[(size_t)iclient * nrequests + ir]);
+      MyReal *features = (MyReal *)(request + sizeof(int));
+      for (int iex = 0; iex < requestsize; iex++) {
+        int example =
+            ((iclient * nrequests + ir) * requestsize + iex) % nexamples;
+        memcpy(&(features[iex * nfeatures]), rows[example],
+               nfeatures * sizeof(MyReal));
+      }
+
+      *latency = omp_get_wtime();
+      if (writeAll(fd, request, size) ||
+          readAll(fd, response, responsesize)) {
+        nfailed += nrequests - ir;
+        break;
+      }
+      *latency = omp_get_wtime() - *latency;
+    }
+
+    if (fd >= 0) close(fd);
+    delete[] request;
+    delete[] response;
+  }
+  time = omp_get_wtime() - time;
+
+  if (nfailed > 0) {
+    printf("\nERROR: %d requests failed.\n", nfailed);
+  } else {
+    long nlatencies = (long)nclients * nrequests;
+    std::sort(latencies, latencies + nlatencies);
+    printf("\n");
+    printf(" Clients:          %d\n", nclients);
+    printf(" Requests:         %ld of %d examples\n", nlatencies, requestsize);
+    printf(" Latency p50:      %.3e sec\n", latencies[nlatencies / 2]);
+    printf(" Latency p99:      %.3e sec\n",
+           latencies[std::min(nlatencies - 1, nlatencies * 99 / 100)]);
+    printf(" Throughput:       %.1f examples/sec\n",
+           nlatencies * requestsize / time);
+    printf("\n");
+  }
+
+  delete[] examples;
+  delete[] rows;
+  delete[] latencies;
+
+  return 0;
+}
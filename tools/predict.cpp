@@ -0,0 +1,125 @@
+// Copyright
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Underlying paper:
+//
+// Layer-Parallel Training of Deep Residual Neural Networks
+// S. Guenther, L. Ruthotto, J.B. Schroder, E.C. Czr, and N.R. Gauger
+//
+// Download: https://arxiv.org/pdf/1812.04352.pdf
+//
+//
+// Standalone inference with a trained network: Loads a model file written
+// with 'modelfile_out', classifies the examples of a data file in batches and
+// reports latency and throughput.
+//
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "defs.hpp"
+#include "predictor.hpp"
+#include "util.hpp"
+
+int main(int argc, char *argv[]) {
+  Predictor *predictor;
+  int nexamples, nfeatures, nclasses;
+  int batchsize = 1;
+  int nrepeat = 10;
+  MyReal *examples;         /**< Examples, stored contiguously */
+  MyReal **rows;            /**< Pointers to the examples, for read_matrix */
+  MyReal *probabilities;    /**< Class probabilities of one batch */
+  int *classes;             /**< Predicted classes of all examples */
+  MyReal time, mintime, maxtime, sumtime;
+  int nbatches;
+
+  if (argc < 4) {
+    printf("\n");
+    printf(
+        "USAGE: ./predict <modelfile> <examplefile> <nexamples> [<batchsize> "
+        "[<nrepeat> [<labelfile>]]]\n");
+    return 0;
+  }
+  nexamples = atoi(argv[3]);
+  if (argc > 4) batchsize = atoi(argv[4]);
+  if (argc > 5) nrepeat = atoi(argv[5]);
+
+  /* Load the network */
+  predictor = new Predictor();
+  if (predictor->load(argv[1])) return 0;
+  nfeatures = predictor->getnFeatures();
+  nclasses = predictor->getnClasses();
+
+  /* Read the examples */
+  examples = new MyReal[(size_t)nexamples * nfeatures];
+  rows = new MyReal *[nexamples];
+  for (int iex = 0; iex < nexamples; iex++) {
+    rows[iex] = &(examples[(size_t)iex * nfeatures]);
+  }
+  read_matrix(argv[2], rows, nexamples, nfeatures);
+  classes = new int[nexamples];
+  probabilities = new MyReal[(size_t)batchsize * nclasses];
+
+  /* Classify all examples in batches, repeat to measure the latency */
+  nbatches = (nexamples + batchsize - 1) / batchsize;
+  mintime = 1e+30;
+  maxtime = 0.0;
+  sumtime = 0.0;
+  for (int irepeat = 0; irepeat < nrepeat; irepeat++) {
+    for (int ibatch = 0; ibatch < nbatches; ibatch++) {
+      int first = ibatch * batchsize;
+      int n = std::min(batchsize, nexamples - first);
+      time = omp_get_wtime();
+      predictor->predict(rows[first], n, &(classes[first]), probabilities);
+      time = omp_get_wtime() - time;
+      mintime = std::min(mintime, time);
+      maxtime = std::max(maxtime, time);
+      sumtime += time;
+    }
+  }
+
+  printf("\n");
+  printf(" Layers:           %d\n", predictor->getnLayers());
+  printf(" Examples:         %d\n", nexamples);
+  printf(" Batch size:       %d\n", batchsize);
+  printf(" Latency (batch):  %.3e sec (min %.3e, max %.3e)\n",
+         sumtime / (nrepeat * nbatches), mintime, maxtime);
+  printf(" Throughput:       %.1f examples/sec\n",
+         nrepeat * (MyReal)nexamples / sumtime);
+
+  /* Accuracy, if the labels are given */
+  if (argc > 6) {
+    MyReal **labels = new MyReal *[nexamples];
+    int ncorrect = 0;
+    for (int iex = 0; iex < nexamples; iex++) {
+      labels[iex] = new MyReal[nclasses];
+    }
+    read_matrix(argv[6], labels, nexamples, nclasses);
+    for (int iex = 0; iex < nexamples; iex++) {
+      if (labels[iex][classes[iex]] > 0.99) ncorrect++;
+      delete[] labels[iex];
+    }
+    delete[] labels;
+    printf(" Accuracy:         %2.2f%%\n", 100.0 * ncorrect / nexamples);
+  }
+  printf("\n");
+
+  delete predictor;
+  delete[] examples;
+  delete[] rows;
+  delete[] classes;
+  delete[] probabilities;
+
+  return 0;
+}
@@ -0,0 +1,185 @@
+// Copyright
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Underlying paper:
+//
+// Layer-Parallel Training of Deep Residual Neural Networks
+// S. Guenther, L. Ruthotto, J.B. Schroder, E.C. Czr, and N.R. Gauger
+//
+// Download: https://arxiv.org/pdf/1812.04352.pdf
+//
+//
+// Post-training int8 quantization of a trained network: Calibrates the
+// scales on a random sample of the training data, writes the int8 model file
+// and compares accuracy and speed of the int8 and the float network on the
+// validation data.
+//
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#include "config.hpp"
+#include "defs.hpp"
+#include "predictor.hpp"
+#include "util.hpp"
+
+/* Read n of the nall rows (dim: ndim) of a data file into contiguous memory.
+ * With n < nall, the rows are a random sample. */
+static MyReal *readRows(const char *datafolder, const char *datafile,
+                        int nall, int n, int ndim) {
+  char filename[255];
+  MyReal *data = new MyReal[(size_t)n * ndim];
+  MyReal **rows = new MyReal *[nall];
+  int *ids = new int[nall];
+
+  /* Draw the rows by a partial shuffle of all IDs */
+  for (int i = 0; i < nall; i++) {
+    rows[i] = NULL;
+    ids[i] = i;
+  }
+  for (int i = 0; i < n; i++) {
+    int j = i;
+    if (n < nall) {
+      j += (int)(((double)rand()) / ((double)RAND_MAX + 1.0) * (nall - i));
+    }
+    std::swap(ids[i], ids[j]);
+    rows[ids[i]] = &(data[(size_t)i * ndim]);
+  }
+
+  sprintf(filename, "%s/%s", datafolder, datafile);
+  read_matrix(filename, rows, nall, ndim);
+
+  delete[] rows;
+  delete[] ids;
+  return data;
+}
+
+/* Classify the n validation examples nrepeat times, return the accuracy and
+ * the throughput in examples per second */
+static void evaluate(Predictor *predictor, MyReal *examples, MyReal *labels,
+                     int n, int nclasses, int *classes, int nrepeat,
+                     MyReal *accuracy_ptr, MyReal *throughput_ptr) {
+  int ncorrect = 0;
+
+  MyReal time = omp_get_wtime();
+  for (int irepeat = 0; irepeat < nrepeat; irepeat++) {
+    predictor->predict(examples, n, classes, NULL);
+  }
+  time = omp_get_wtime() - time;
+
+  for (int iex = 0; iex < n; iex++) {
+    if (labels[(size_t)iex * nclasses + classes[iex]] > 0.99) ncorrect++;
+  }
+  *accuracy_ptr = 100.0 * ncorrect / n;
+  *throughput_ptr = nrepeat * n / time;
+}
+
+/* Size of a file in bytes */
+static long fileSize(const char *filename) {
+  FILE *file = fopen(filename, "rb");
+  long size = -1;
+  if (file != NULL) {
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fclose(file);
+  }
+  return size;
+}
+
+int main(int argc, char *argv[]) {
+  Config *config;
+  Predictor *floatnet, *int8net;
+  MyReal *calibration, *validation, *labels;
+  int *floatclasses, *int8classes;
+  int ncalibration = 1000;
+  int nrepeat = 10;
+  int nagree;
+  MyReal accur_float, accur_int8, speed_float, speed_int8;
+
+  if (argc < 4) {
+    printf("\n");
+    printf(
+        "USAGE: ./quantize </path/to/configfile> <modelfile> <int8modelfile> "
+        "[<ncalibration>]\n");
+    return 0;
+  }
+  if (argc > 4) ncalibration = atoi(argv[4]);
+
+  config = new Config();
+  if (config->readFromFile(argv[1])) {
+    printf("Error while reading config file!\n");
+    return 0;
+  }
+  ncalibration = std::min(ncalibration, config->ntraining);
+
+  /* Load the float network twice, one of them is quantized */
+  floatnet = new Predictor();
+  int8net = new Predictor();
+  if (floatnet->load(argv[2]) || int8net->load(argv[2])) {
+    return 0;
+  }
+  if (floatnet->getnFeatures() != config->nfeatures ||
+      floatnet->getnClasses() != config->nclasses) {
+    printf("ERROR: Model doesn't match the data of the config file!\n");
+    return 0;
+  }
+
+  /* Calibrate on a random sample of the training data */
+  calibration = readRows(config->datafolder, config->ftrain_ex,
+                         config->ntraining, ncalibration, config->nfeatures);
+  int8net->quantize(calibration, ncalibration);
+  if (int8net->save(argv[3])) {
+    return 0;
+  }
+
+  /* Compare with the float network on the validation data */
+  validation = readRows(config->datafolder, config->fval_ex,
+                        config->nvalidation, config->nvalidation,
+                        config->nfeatures);
+  labels = readRows(config->datafolder, config->fval_labels,
+                    config->nvalidation, config->nvalidation, config->nclasses);
+  floatclasses = new int[config->nvalidation];
+  int8classes = new int[config->nvalidation];
+  evaluate(floatnet, validation, labels, config->nvalidation, config->nclasses,
+           floatclasses, nrepeat, &accur_float, &speed_float);
+  evaluate(int8net, validation, labels, config->nvalidation, config->nclasses,
+           int8classes, nrepeat, &accur_int8, &speed_int8);
+  nagree = 0;
+  for (int iex = 0; iex < config->nvalidation; iex++) {
+    if (floatclasses[iex] == int8classes[iex]) nagree++;
+  }
+
+  printf("\n");
+  printf(" Calibration examples: %d\n", ncalibration);
+  printf("           Accuracy   Throughput(ex/sec)   Model size(bytes)\n");
+  printf(" float     %6.2f%%    %14.1f       %12ld\n", accur_float, speed_float,
+         fileSize(argv[2]));
+  printf(" int8      %6.2f%%    %14.1f       %12ld\n", accur_int8, speed_int8,
+         fileSize(argv[3]));
+  printf(" Same class as float:  %2.2f%%\n",
+         100.0 * nagree / config->nvalidation);
+  printf("\n");
+
+  delete floatnet;
+  delete int8net;
+  delete[] calibration;
+  delete[] validation;
+  delete[] labels;
+  delete[] floatclasses;
+  delete[] int8classes;
+  delete config;
+
+  return 0;
+}
@@ -0,0 +1,330 @@
+// Copyright
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Underlying paper:
+//
+// Layer-Parallel Training of Deep Residual Neural Networks
+// S. Guenther, L. Ruthotto, J.B. Schroder, E.C. Czr, and N.R. Gauger
+//
+// Download: https://arxiv.org/pdf/1812.04352.pdf
+//
+//
+// Prediction server: Loads a model file once and answers classification
+// requests of other processes on the same host over a Unix domain socket.
+// Requests of all clients are collected into micro-batches of at most
+// maxbatch examples, which are classified once they are full or the oldest
+// request has waited for the deadline. Larger requests are split over several
+// micro-batches. The client sockets are non-blocking, responses are queued
+// per client and sent whenever the client reads them.
+//
+// Protocol (native byte order):
+//  - On connect, the server sends  int32 nfeatures, int32 nclasses.
+//  - Request:   int32 n, followed by n x nfeatures MyReal examples.
+//  - Response:  n x int32 classes, followed by n x nclasses MyReal
+//               probabilities.
+//
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <omp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include "defs.hpp"
+#include "predictor.hpp"
+
+#define SERVE_MAXREQUEST 65536 /* Maximum number of examples per request */
+#define SERVE_MAXQUEUE 16777216 /* Bytes queued for a client before the server
+                                   stops reading its requests */
+
+/* Connection to a client */
+struct Client {
+  int fd;                 /* Socket of the connection (-1: closed) */
+  long id;                /* Unique number of the connection */
+  std::vector<char> data; /* Received bytes, not yet part of a request */
+  std::vector<char> out;  /* Bytes to send, not yet written */
+};
+
+/* Request waiting for the micro-batches */
+struct Request {
+  long client;     /* Id of the client */
+  int n;           /* Number of examples */
+  int nbatched;    /* Examples already put into a micro-batch */
+  int ndone;       /* Examples already classified */
+  double arrival;  /* Time the request was complete */
+  std::vector<MyReal> examples;      /* Examples (dim: n x nfeatures) */
+  std::vector<int> classes;          /* Classes (dim: n) */
+  std::vector<MyReal> probabilities; /* Probabilities (dim: n x nclasses) */
+};
+
+static volatile sig_atomic_t stop = 0;
+
+static void handleSignal(int sig) { stop = 1; }
+
+/* Write as much of the output queue as the socket takes, return -1 on
+ * failure */
+static int flushClient(Client &client) {
+  size_t nsent = 0;
+  while (nsent < client.out.size()) {
+    ssize_t nwritten = write(client.fd, &(client.out[nsent]),
+                             client.out.size() - nsent);
+    if (nwritten < 0 && errno == EINTR) continue;
+    if (nwritten < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    if (nwritten <= 0) return -1;
+    nsent += nwritten;
+  }
+  client.out.erase(client.out.begin(), client.out.begin() + nsent);
+  return 0;
+}
+
+/* Append bytes to the output queue of a client */
+static void queueClient(Client &client, const void *buffer, size_t size) {
+  const char *bytes = (const char *)buffer;
+  client.out.insert(client.out.end(), bytes, bytes + size);
+}
+
+/* Find a client by its id, NULL if it is gone */
+static Client *findClient(std::vector<Client> &clients, long id) {
+  for (size_t ic = 0; ic < clients.size(); ic++) {
+    if (clients[ic].id == id) return &(clients[ic]);
+  }
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  Predictor *predictor;
+  int nfeatures, nclasses;
+  int maxbatch = 64;        /**< Maximum number of examples per micro-batch */
+  double deadline = 1e-3;   /**< Maximum waiting time of a request (sec) */
+  int listenfd;
+  struct sockaddr_un addr;
+  std::vector<Client> clients;
+  std::deque<Request> pending;   /**< Requests in order of arrival */
+  long nwaiting = 0;             /**< Pending examples not yet batched */
+  long nextid = 0;
+  std::vector<MyReal> batch;     /**< Examples of the micro-batch */
+  std::vector<int> classes;      /**< Classes of the micro-batch */
+  std::vector<MyReal> probabilities; /**< Probabilities of the micro-batch */
+  std::vector<struct pollfd> fds;
+  long nbatches = 0;
+  long nexamples = 0;
+
+  if (argc < 3) {
+    printf("\n");
+    printf(
+        "USAGE: ./serve <modelfile> <socketpath> [<maxbatch> "
+        "[<deadline (microsec)>]]\n");
+    return 0;
+  }
+  if (argc > 3) maxbatch = std::max(1, atoi(argv[3]));
+  if (argc > 4) deadline = atof(argv[4]) * 1e-6;
+
+  /* Load the network */
+  predictor = new Predictor();
+  if (predictor->load(argv[1])) return 0;
+  nfeatures = predictor->getnFeatures();
+  nclasses = predictor->getnClasses();
+  batch.resize((size_t)maxbatch * nfeatures);
+  classes.resize(maxbatch);
+  probabilities.resize((size_t)maxbatch * nclasses);
+
+  /* Listen on the socket */
+  listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, argv[2], sizeof(addr.sun_path) - 1);
+  unlink(argv[2]);
+  if (listenfd < 0 ||
+      bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(listenfd, 64) < 0) {
+    printf("ERROR: Can't listen on %s: %s\n", argv[2], strerror(errno));
+    return 0;
+  }
+  signal(SIGINT, handleSignal);
+  signal(SIGTERM, handleSignal);
+  signal(SIGPIPE, SIG_IGN);
+  printf("Serving %s on %s (maxbatch %d, deadline %.0f microsec)\n", argv[1],
+         argv[2], maxbatch, deadline * 1e6);
+
+  while (!stop) {
+    /* Wait for data, at most until the deadline of the oldest request. Don't
+     * wait, if a full micro-batch is pending. */
+    int timeout = -1;
+    if (nwaiting >= maxbatch) {
+      timeout = 0;
+    } else if (nwaiting > 0) {
+      double wait = pending[0].arrival + deadline - omp_get_wtime();
+      timeout = std::max(0, (int)ceil(wait * 1e3));
+    }
+    fds.clear();
+    struct pollfd listenpoll = {listenfd, POLLIN, 0};
+    fds.push_back(listenpoll);
+    for (size_t ic = 0; ic < clients.size(); ic++) {
+      struct pollfd clientpoll = {clients[ic].fd, 0, 0};
+      if (clients[ic].out.size() < SERVE_MAXQUEUE) clientpoll.events |= POLLIN;
+      if (!clients[ic].out.empty()) clientpoll.events |= POLLOUT;
+      fds.push_back(clientpoll);
+    }
+    if (poll(&(fds[0]), fds.size(), timeout) < 0 && errno != EINTR) break;
+
+    /* Accept new clients and queue the dimensions for them */
+    if (fds[0].revents & POLLIN) {
+      Client client;
+      client.fd = accept(listenfd, NULL, NULL);
+      if (client.fd >= 0 &&
+          fcntl(client.fd, F_SETFL, fcntl(client.fd, F_GETFL) | O_NONBLOCK) ==
+              0) {
+        int dims[2] = {nfeatures, nclasses};
+        client.id = nextid++;
+        queueClient(client, dims, sizeof(dims));
+        clients.push_back(client);
+      } else if (client.fd >= 0) {
+        close(client.fd);
+      }
+    }
+
+    /* Send queued responses, receive data and collect complete requests */
+    for (size_t ic = 0; ic + 1 < fds.size(); ic++) {
+      Client &client = clients[ic];
+      short revents = fds[ic + 1].revents;
+
+      if ((revents & POLLOUT) && flushClient(client)) {
+        close(client.fd);
+        client.fd = -1;
+        continue;
+      }
+      if (!(revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+      char buffer[65536];
+      ssize_t nread = read(client.fd, buffer, sizeof(buffer));
+      if (nread <= 0) {
+        if (nread < 0 && (errno == EINTR || errno == EAGAIN ||
+                          errno == EWOULDBLOCK)) {
+          continue;
+        }
+        close(client.fd);
+        client.fd = -1;
+        continue;
+      }
+      client.data.insert(client.data.end(), buffer, buffer + nread);
+
+      size_t used = 0;
+      while (client.data.size() - used >= sizeof(int)) {
+        int n;
+        memcpy(&n, &(client.data[used]), sizeof(int));
+        if (n <= 0 || n > SERVE_MAXREQUEST) {
+          close(client.fd);
+          client.fd = -1;
+          break;
+        }
+        size_t size = sizeof(int) + (size_t)n * nfeatures * sizeof(MyReal);
+        if (client.data.size() - used < size) break;
+
+        pending.push_back(Request());
+        Request &request = pending.back();
+        request.client = client.id;
+        request.n = n;
+        request.nbatched = 0;
+        request.ndone = 0;
+        request.arrival = omp_get_wtime();
+        request.examples.resize((size_t)n * nfeatures);
+        memcpy(&(request.examples[0]), &(client.data[used + sizeof(int)]),
+               size - sizeof(int));
+        nwaiting += n;
+        used += size;
+      }
+      client.data.erase(client.data.begin(), client.data.begin() + used);
+    }
+
+    /* Remove closed connections, the responses to their requests are dropped */
+    for (size_t ic = clients.size(); ic-- > 0;) {
+      if (clients[ic].fd < 0) clients.erase(clients.begin() + ic);
+    }
+
+    /* Classify a micro-batch if it is full or the deadline is reached */
+    if (nwaiting == 0 || (nwaiting < maxbatch &&
+                          omp_get_wtime() < pending[0].arrival + deadline)) {
+      continue;
+    }
+
+    /* Fill the micro-batch with the oldest examples, splitting requests */
+    int nbatch = 0;
+    for (size_t ir = 0; ir < pending.size() && nbatch < maxbatch; ir++) {
+      Request &request = pending[ir];
+      int ntake = std::min(maxbatch - nbatch, request.n - request.nbatched);
+      if (ntake <= 0) continue;
+      memcpy(&(batch[(size_t)nbatch * nfeatures]),
+             &(request.examples[(size_t)request.nbatched * nfeatures]),
+             (size_t)ntake * nfeatures * sizeof(MyReal));
+      request.nbatched += ntake;
+      nbatch += ntake;
+    }
+    nwaiting -= nbatch;
+    predictor->predict(&(batch[0]), nbatch, &(classes[0]),
+                       &(probabilities[0]));
+    nbatches++;
+    nexamples += nbatch;
+
+    /* Hand the results to the requests */
+    int first = 0;
+    for (size_t ir = 0; ir < pending.size() && first < nbatch; ir++) {
+      Request &request = pending[ir];
+      int ntake = request.nbatched - request.ndone;
+      if (ntake <= 0) continue;
+      request.classes.insert(request.classes.end(), &(classes[first]),
+                             &(classes[first]) + ntake);
+      request.probabilities.insert(
+          request.probabilities.end(),
+          &(probabilities[(size_t)first * nclasses]),
+          &(probabilities[(size_t)first * nclasses]) +
+              (size_t)ntake * nclasses);
+      request.ndone += ntake;
+      first += ntake;
+    }
+
+    /* Queue the responses of the completed requests, in order of arrival */
+    while (!pending.empty() && pending[0].ndone == pending[0].n) {
+      Request &request = pending[0];
+      Client *client = findClient(clients, request.client);
+      if (client != NULL) {
+        queueClient(*client, &(request.classes[0]), request.n * sizeof(int));
+        queueClient(*client, &(request.probabilities[0]),
+                    (size_t)request.n * nclasses * sizeof(MyReal));
+      }
+      pending.pop_front();
+    }
+  }
+
+  printf("\nServed %ld examples in %ld micro-batches (%.1f examples each)\n",
+         nexamples, nbatches,
+         nbatches > 0 ? nexamples / (double)nbatches : 0.0);
+
+  for (size_t ic = 0; ic < clients.size(); ic++) {
+    if (clients[ic].fd >= 0) close(clients[ic].fd);
+  }
+  close(listenfd);
+  unlink(argv[2]);
+  delete predictor;
+
+  return 0;
+}